@@ -0,0 +1,729 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_bench.c
+* The BlastMidi benchmark.
+*
+* This program generates a deterministic synthetic corpus of Standard Midi Files in a number of profiles, and measures how fast
+* they are read through the data callback and from memory, also with a read mask that drops system exclusive and text events
+* and with a read end that keeps only the first seconds of the file. It measures how fast the resulting events can be iterated,
+* how fast the instance is freed, how fast the events are converted to Universal Midi Packets and how fast the file is saved,
+* both in full, incrementally after one track has changed and with the tracks encoded in parallel. It also measures how fast
+* the file streams through the filter pipeline, how fast it is summarized by a probe and how fast its events can be walked
+* with cursors, without parsing it at all. Rates are given relative to the whole file, even for partial reads.
+* The same seed always produces byte for byte identical files, so results can be compared between builds.
+*
+* Usage: blastmidi_bench [-r repetitions] [-s scale] [-w directory]
+* -r sets how many times each measurement is repeated (the fastest run is reported), -s multiplies the size of every file,
+* and -w writes the generated files to the given directory so that they can be used with other tools.
+*
+* Build it together with blastmidi.c, blastmidi_ump.c and blastmidi_batch.c, for example:
+* cc -O2 -Iinclude bench/blastmidi_bench.c src/blastmidi.c src/blastmidi_ump.c src/blastmidi_batch.c -lpthread -o blastmidi_bench
+*/
+
+#include "blastmidi_bench_utility.h"
+#include "blastmidi_ump.h"
+#include "blastmidi_batch.h"
+
+void put_conductor ( byte_buffer* track, const char* name )
+{
+    uint8_t tempo[3] = { 0x07, 0xA1, 0x20 };
+    uint8_t time_signature[4] = { 4, 2, 24, 8 };
+    put_meta ( track, 0, 0x03, name, ( uint32_t ) strlen ( name ) );
+    put_meta ( track, 0, 0x51, tempo, 3 );
+    put_meta ( track, 0, 0x58, time_signature, 4 );
+}
+
+/*
+* The corpus profiles. Each generator appends one complete file to the given buffer. scale multiplies the number of events.
+*/
+void generate_dense_piano ( byte_buffer* file, unsigned int scale )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    uint8_t last_status = 0;
+    unsigned int i;
+    put_header ( file, 0, 1, 480 );
+    put_conductor ( &track, "Piano" );
+    for ( i = 0; i < 20000 * scale; ++i )
+    {
+        uint8_t note = ( uint8_t ) ( 36 + next_random ( 60 ) );
+        put_channel_event ( &track, next_random ( 4 ) == 0 ? next_random ( 60 ) : 0, 0x90, note, 40 + next_random ( 80 ), &last_status, 0 );
+        put_channel_event ( &track, next_random ( 120 ), 0x80, note, 64, &last_status, 0 );
+        if ( next_random ( 32 ) == 0 )
+        {
+            put_channel_event ( &track, 0, 0xB0, 64, next_random ( 2 ) ? 127 : 0, &last_status, 0 );
+        }
+    }
+    finish_track ( file, &track );
+    free ( track.data );
+}
+
+void generate_orchestral ( byte_buffer* file, unsigned int scale )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    uint16_t track_count = 64;
+    uint16_t t;
+    put_header ( file, 1, track_count, 960 );
+    put_conductor ( &track, "Symphony" );
+    for ( t = 0; t < 200 * scale; ++t )
+    {
+        uint8_t tempo[3];
+        uint32_t value = 400000 + next_random ( 300000 );
+        tempo[0] = ( uint8_t ) ( value >> 16 );
+        tempo[1] = ( uint8_t ) ( value >> 8 );
+        tempo[2] = ( uint8_t ) value;
+        put_meta ( &track, 960, 0x51, tempo, 3 );
+    }
+    finish_track ( file, &track );
+    for ( t = 1; t < track_count; ++t )
+    {
+        uint8_t last_status = 0;
+        uint8_t channel = ( uint8_t ) ( t % 16 );
+        char name[32];
+        unsigned int i;
+        sprintf ( name, "Instrument %u", ( unsigned int ) t );
+        put_meta ( &track, 0, 0x03, name, ( uint32_t ) strlen ( name ) );
+        put_channel_event ( &track, 0, 0xC0 | channel, ( uint8_t ) next_random ( 128 ), -1, &last_status, 1 );
+        put_channel_event ( &track, 0, 0xB0 | channel, 7, 100, &last_status, 1 );
+        for ( i = 0; i < 1000 * scale; ++i )
+        {
+            uint8_t note = ( uint8_t ) ( 40 + next_random ( 48 ) );
+            put_channel_event ( &track, next_random ( 240 ), 0x90 | channel, note, 60 + next_random ( 60 ), &last_status, 1 );
+            put_channel_event ( &track, 120 + next_random ( 480 ), 0x90 | channel, note, 0, &last_status, 1 );
+            if ( next_random ( 8 ) == 0 )
+            {
+                put_channel_event ( &track, 0, 0xB0 | channel, 11, next_random ( 128 ), &last_status, 1 );
+            }
+        }
+        finish_track ( file, &track );
+    }
+    free ( track.data );
+}
+
+void generate_sysex_heavy ( byte_buffer* file, unsigned int scale )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    uint8_t payload[512];
+    uint8_t last_status = 0;
+    unsigned int i;
+    put_header ( file, 0, 1, 480 );
+    put_conductor ( &track, "Patch dump" );
+    for ( i = 0; i < 2000 * scale; ++i )
+    {
+        uint32_t size = 8 + next_random ( sizeof ( payload ) - 8 );
+        uint32_t k;
+        for ( k = 0; k + 1 < size; ++k )
+        {
+            payload[k] = ( uint8_t ) next_random ( 128 );
+        }
+        payload[size - 1] = 0xF7;
+        put_variable_number ( &track, next_random ( 10 ) );
+        put_byte ( &track, 0xF0 );
+        put_variable_number ( &track, size );
+        put_bytes ( &track, payload, size );
+        put_channel_event ( &track, 10, 0x90, 60, 100, &last_status, 0 );
+        put_channel_event ( &track, 10, 0x80, 60, 0, &last_status, 0 );
+    }
+    finish_track ( file, &track );
+    free ( track.data );
+}
+
+void generate_lyric_heavy ( byte_buffer* file, unsigned int scale )
+{
+    static const char* syllables[] =
+    {
+        "la", "la", "love", "you", "ba", "by", "to", "night", "oh", "yeah", "hold", "me", "close", "for", "ev", "er",
+        "and", "the", "stars", "will", "shine", "on", "us", "tonight, my darling", "forever and always"
+    };
+    byte_buffer track = { NULL, 0, 0 };
+    uint8_t last_status = 0;
+    unsigned int i;
+    put_header ( file, 1, 2, 480 );
+    put_conductor ( &track, "Karaoke" );
+    for ( i = 0; i < 10000 * scale; ++i )
+    {
+        const char* syllable = syllables[next_random ( sizeof ( syllables ) / sizeof ( syllables[0] ) )];
+        put_meta ( &track, 120, 0x05, syllable, ( uint32_t ) strlen ( syllable ) );
+        if ( next_random ( 16 ) == 0 )
+        {
+            put_meta ( &track, 0, 0x06, "Chorus", 6 );
+        }
+    }
+    finish_track ( file, &track );
+    for ( i = 0; i < 10000 * scale; ++i )
+    {
+        uint8_t note = ( uint8_t ) ( 55 + next_random ( 24 ) );
+        put_channel_event ( &track, 0, 0x90, note, 90, &last_status, 1 );
+        put_channel_event ( &track, 120, 0x90, note, 0, &last_status, 1 );
+    }
+    finish_track ( file, &track );
+    free ( track.data );
+}
+
+void generate_running_status ( byte_buffer* file, unsigned int scale )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    uint8_t last_status = 0;
+    unsigned int i;
+    put_header ( file, 0, 1, 96 );
+    put_conductor ( &track, "Controllers" );
+    for ( i = 0; i < 40000 * scale; ++i )
+    {
+        /*
+        * Long runs of the same status byte, as produced by controller sweeps and dense drum parts.
+        */
+        if ( ( i / 256 ) % 2 == 0 )
+        {
+            put_channel_event ( &track, 1, 0xB0, 1, ( i & 0x7F ), &last_status, 1 );
+        }
+        else
+        {
+            put_channel_event ( &track, 1, 0xE0, ( uint8_t ) next_random ( 128 ), next_random ( 128 ), &last_status, 1 );
+        }
+    }
+    finish_track ( file, &track );
+    free ( track.data );
+}
+
+typedef void profile_generator ( byte_buffer*, unsigned int );
+
+typedef struct profile
+{
+    const char* name;
+    profile_generator* generate;
+} profile;
+
+/*
+* The data callback used for the callback path. It serves the file from memory, so the difference between the two paths is
+* only the cost of going through the callback.
+*/
+typedef struct memory_reader
+{
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+} memory_reader;
+
+int memory_callback ( int action, size_t size, uint8_t* buffer, void* user_data )
+{
+    memory_reader* reader = ( memory_reader* ) user_data;
+    if ( action == BLASTMIDI_CALLBACK_READ )
+    {
+        if ( size > reader->size - reader->position )
+        {
+            return 0;
+        }
+        memcpy ( buffer, reader->data + reader->position, size );
+        reader->position += size;
+        return 1;
+    }
+    if ( action == BLASTMIDI_CALLBACK_SEEK )
+    {
+        if ( size > reader->size )
+        {
+            return 0;
+        }
+        reader->position = size;
+        return 1;
+    }
+    return 0;
+}
+
+size_t count_events ( blastmidi* instance )
+{
+    size_t count = 0;
+    uint16_t i;
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        blastmidi_event* event = NULL;
+        blastmidi_get_first_event_on_track ( instance, i, &event );
+        while ( event )
+        {
+            ++count;
+            blastmidi_get_next_event_on_track ( instance, &event );
+        }
+    }
+    return count;
+}
+
+/*
+* The measurements. Each returns the fastest time of the given number of repetitions.
+*/
+enum read_modes
+{
+    READ_CALLBACK,
+    READ_MEMORY,
+    READ_MEMORY_RECYCLED,
+    READ_MEMORY_MASKED,
+    READ_MEMORY_PREVIEW
+};
+
+/*
+* A benchmark that silently fails would report the time it took to give up, so every operation that is measured is checked.
+*/
+void check_result ( const char* what, uint8_t result )
+{
+    if ( result != BLASTMIDI_OK )
+    {
+        fprintf ( stderr, "%s failed with error %u.\n", what, ( unsigned int ) result );
+        exit ( 1 );
+    }
+}
+
+/*
+* In masked mode, system exclusive events and the text meta events are dropped while reading, as a job that only needs the notes
+* and the tempo map would do. In preview mode, only the first five seconds of every track are read.
+* If stored is not NULL, it receives the number of events that the read kept. The preview row is reported against that count
+* and without a byte rate, since the read covers only part of the file.
+*/
+
+double measure_read ( byte_buffer* file, int mode, int repetitions, double* free_time, size_t* stored )
+{
+    double best = 0;
+    double best_free = 0;
+    blastmidi instance;
+    int r;
+    blastmidi_initialize ( &instance, NULL, NULL );
+    blastmidi_set_recycling ( &instance, mode == READ_MEMORY_RECYCLED );
+    if ( mode == READ_MEMORY_MASKED )
+    {
+        blastmidi_read_mask mask;
+        uint8_t subtype;
+        memset ( ( void* ) &mask, 0, sizeof ( blastmidi_read_mask ) );
+        mask.event_types = 1 << BLASTMIDI_SYSEX_EVENT;
+        for ( subtype = BLASTMIDI_META_TEXT; subtype <= BLASTMIDI_META_CUE_POINT; ++subtype )
+        {
+            mask.meta_events[subtype >> 3] |= ( uint8_t ) ( 1 << ( subtype & 7 ) );
+        }
+        blastmidi_set_read_mask ( &instance, &mask );
+    }
+    if ( mode == READ_MEMORY_PREVIEW )
+    {
+        blastmidi_set_read_end ( &instance, 0, 5.0 );
+    }
+    for ( r = 0; r < repetitions; ++r )
+    {
+        memory_reader reader;
+        double start = 0;
+        double elapsed = 0;
+        uint8_t result = 0;
+        reader.data = file->data;
+        reader.size = file->size;
+        reader.position = 0;
+        blastmidi_set_data_callback ( &instance, memory_callback, &reader );
+        start = get_time();
+        result = mode == READ_CALLBACK ? blastmidi_read ( &instance ) : blastmidi_read_memory ( &instance, file->data, file->size );
+        elapsed = get_time() - start;
+        check_result ( "Reading", result );
+        if ( stored && r == 0 )
+        {
+            *stored = count_events ( &instance );
+        }
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+        if ( mode != READ_MEMORY_RECYCLED )
+        {
+            start = get_time();
+            blastmidi_free ( &instance );
+            elapsed = get_time() - start;
+            if ( r == 0 || elapsed < best_free )
+            {
+                best_free = elapsed;
+            }
+        }
+    }
+    blastmidi_free ( &instance );
+    if ( free_time )
+    {
+        *free_time = best_free;
+    }
+    return best;
+}
+
+double measure_iteration ( blastmidi* instance, int repetitions, size_t* events )
+{
+    double best = 0;
+    int r;
+    for ( r = 0; r < repetitions; ++r )
+    {
+        double start = get_time();
+        double elapsed = 0;
+        *events = count_events ( instance );
+        elapsed = get_time() - start;
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+/*
+* Walks every track of the file with a cursor, straight from memory, without parsing it into an instance.
+*/
+double measure_cursor ( byte_buffer* file, int repetitions )
+{
+    double best = 0;
+    int r;
+    for ( r = 0; r < repetitions; ++r )
+    {
+        blastmidi_cursor cursor;
+        double start = get_time();
+        double elapsed = 0;
+        uint16_t t;
+        for ( t = 0; blastmidi_cursor_find_track ( &cursor, file->data, file->size, t ) == BLASTMIDI_OK; ++t )
+        {
+            blastmidi_event* event = NULL;
+            blastmidi_cursor_next ( &cursor, &event );
+            while ( event )
+            {
+                blastmidi_cursor_next ( &cursor, &event );
+            }
+        }
+        elapsed = get_time() - start;
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    return best;
+}
+
+double measure_ump ( blastmidi* instance, int repetitions )
+{
+    uint32_t* words = NULL;
+    size_t capacity = 0;
+    double best = 0;
+    uint8_t result = BLASTMIDI_OK;
+    uint16_t t;
+    int r;
+
+    /*
+    * Size the buffer for the longest track up front, so that only the conversion itself is timed.
+    */
+    for ( t = 0; t < instance->track_count; ++t )
+    {
+        size_t count = 0;
+        check_result ( "Converting to UMP", blastmidi_ump_convert_track ( instance, t, 0, 0, NULL, 0, &count ) );
+        if ( count > capacity )
+        {
+            capacity = count;
+        }
+    }
+    words = ( uint32_t* ) malloc ( sizeof ( uint32_t ) * ( capacity ? capacity : 1 ) );
+    if ( words == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        exit ( 1 );
+    }
+    for ( r = 0; r < repetitions; ++r )
+    {
+        double start = get_time();
+        double elapsed = 0;
+        for ( t = 0; t < instance->track_count; ++t )
+        {
+            size_t count = 0;
+            result = blastmidi_ump_convert_track ( instance, t, 0, 0, words, capacity, &count );
+            if ( result != BLASTMIDI_OK )
+            {
+                break;
+            }
+        }
+        elapsed = get_time() - start;
+        check_result ( "Converting to UMP", result );
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    free ( words );
+    return best;
+}
+
+int buffer_callback ( int action, size_t size, uint8_t* buffer, void* user_data )
+{
+    if ( action != BLASTMIDI_CALLBACK_WRITE )
+    {
+        return 0;
+    }
+    put_bytes ( ( byte_buffer* ) user_data, buffer, size );
+    return 1;
+}
+
+enum write_modes
+{
+    WRITE_FULL,
+    WRITE_INCREMENTAL,
+    WRITE_PARALLEL
+};
+
+/*
+* Saves the instance repeatedly. In incremental mode, the first track is marked as changed before every save, as if it had just
+* been edited, and the previous output serves as the source of the others. In parallel mode, every track is encoded, on one
+* thread per processor.
+*/
+double measure_write ( blastmidi* instance, int mode, int repetitions )
+{
+    byte_buffer outputs[2] = { { NULL, 0, 0 }, { NULL, 0, 0 } };
+    double best = 0;
+    int current = 0;
+    int r;
+
+    blastmidi_set_data_callback ( instance, buffer_callback, &outputs[current] );
+    check_result ( "Writing", blastmidi_write ( instance ) );
+    for ( r = 0; r < repetitions; ++r )
+    {
+        double start = 0;
+        double elapsed = 0;
+        uint8_t result = BLASTMIDI_OK;
+        byte_buffer* source = &outputs[current];
+        current = 1 - current;
+        outputs[current].size = 0;
+        blastmidi_set_data_callback ( instance, buffer_callback, &outputs[current] );
+        start = get_time();
+        if ( mode == WRITE_INCREMENTAL )
+        {
+            blastmidi_mark_track_dirty ( instance, 0 );
+            result = blastmidi_write_incremental ( instance, source->data, source->size );
+        }
+        else if ( mode == WRITE_PARALLEL )
+        {
+            result = blastmidi_batch_write ( instance, NULL, 0, 0 );
+        }
+        else
+        {
+            result = blastmidi_write ( instance );
+        }
+        elapsed = get_time() - start;
+        check_result ( "Writing", result );
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    blastmidi_set_data_callback ( instance, NULL, NULL );
+    free ( outputs[0].data );
+    free ( outputs[1].data );
+    return best;
+}
+
+int drop_sysex ( blastmidi_event* event, uint16_t track_id, void* user_data )
+{
+    ( void ) track_id;
+    ( void ) user_data;
+    return event->type != BLASTMIDI_SYSEX_EVENT;
+}
+
+/*
+* Streams the file from memory through a pipeline that drops system exclusive events and applies an identity transform.
+*/
+double measure_filter ( byte_buffer* file, int repetitions )
+{
+    byte_buffer output = { NULL, 0, 0 };
+    blastmidi instance;
+    blastmidi_transform transform;
+    blastmidi_filter_stage stages[2];
+    double best = 0;
+    int r;
+
+    blastmidi_transform_initialize ( &transform );
+    stages[0].function = drop_sysex;
+    stages[0].user_data = NULL;
+    stages[1].function = blastmidi_filter_transform;
+    stages[1].user_data = &transform;
+    blastmidi_initialize ( &instance, NULL, NULL );
+    blastmidi_set_data_callback ( &instance, buffer_callback, &output );
+    for ( r = 0; r < repetitions; ++r )
+    {
+        double start = 0;
+        double elapsed = 0;
+        uint8_t result = BLASTMIDI_OK;
+        output.size = 0;
+        start = get_time();
+        result = blastmidi_filter_memory ( &instance, file->data, file->size, stages, 2 );
+        elapsed = get_time() - start;
+        check_result ( "Filtering", result );
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    blastmidi_free ( &instance );
+    free ( output.data );
+    return best;
+}
+
+/*
+* Probes the file from memory, which summarizes it without storing any events.
+*/
+double measure_probe ( byte_buffer* file, int repetitions )
+{
+    blastmidi instance;
+    blastmidi_summary summary;
+    double best = 0;
+    int r;
+
+    blastmidi_initialize ( &instance, NULL, NULL );
+    for ( r = 0; r < repetitions; ++r )
+    {
+        double start = get_time();
+        double elapsed = 0;
+        uint8_t result = blastmidi_probe_memory ( &instance, file->data, file->size, &summary );
+        elapsed = get_time() - start;
+        check_result ( "Probing", result );
+        if ( r == 0 || elapsed < best )
+        {
+            best = elapsed;
+        }
+    }
+    blastmidi_free ( &instance );
+    return best;
+}
+
+void report ( const char* what, size_t events, size_t bytes, double seconds )
+{
+    if ( seconds <= 0 )
+    {
+        printf ( "  %-20s %12s\n", what, "too fast" );
+        return;
+    }
+    printf ( "  %-20s %10.2f Mevents/s", what, ( double ) events / seconds / 1000000.0 );
+    if ( bytes )
+    {
+        printf ( "  %9.2f MB/s", ( double ) bytes / seconds / 1048576.0 );
+    }
+    printf ( "  (%.3f ms)\n", seconds * 1000.0 );
+}
+
+int main ( int argc, char** argv )
+{
+    static const profile profiles[] =
+    {
+        { "dense-piano", generate_dense_piano },
+        { "orchestral", generate_orchestral },
+        { "sysex-heavy", generate_sysex_heavy },
+        { "lyric-heavy", generate_lyric_heavy },
+        { "running-status", generate_running_status }
+    };
+    int repetitions = 5;
+    unsigned int scale = 1;
+    const char* directory = NULL;
+    size_t p;
+    int a;
+
+    for ( a = 1; a < argc; ++a )
+    {
+        if ( strcmp ( argv[a], "-r" ) == 0 && a + 1 < argc )
+        {
+            repetitions = atoi ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-s" ) == 0 && a + 1 < argc )
+        {
+            scale = ( unsigned int ) atoi ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-w" ) == 0 && a + 1 < argc )
+        {
+            directory = argv[++a];
+        }
+        else
+        {
+            fprintf ( stderr, "Usage: %s [-r repetitions] [-s scale] [-w directory]\n", argv[0] );
+            return 1;
+        }
+    }
+    if ( repetitions < 1 )
+    {
+        repetitions = 1;
+    }
+    if ( scale < 1 )
+    {
+        scale = 1;
+    }
+
+    for ( p = 0; p < sizeof ( profiles ) / sizeof ( profiles[0] ); ++p )
+    {
+        byte_buffer file = { NULL, 0, 0 };
+        blastmidi instance;
+        size_t events = 0;
+        double free_time = 0;
+        double callback_time = 0;
+        double memory_time = 0;
+        double recycled_time = 0;
+        double iteration_time = 0;
+        double ump_time = 0;
+        double write_time = 0;
+        double incremental_time = 0;
+        double parallel_time = 0;
+        double filter_time = 0;
+        double masked_time = 0;
+        double preview_time = 0;
+        size_t preview_events = 0;
+        double probe_time = 0;
+        double cursor_time = 0;
+
+        random_state = 2463534242u + ( uint32_t ) p;
+        profiles[p].generate ( &file, scale );
+        if ( directory )
+        {
+            char path[1024];
+            FILE* output = NULL;
+            sprintf ( path, "%.900s/%s.mid", directory, profiles[p].name );
+            output = fopen ( path, "wb" );
+            if ( output == NULL || fwrite ( file.data, 1, file.size, output ) != file.size )
+            {
+                fprintf ( stderr, "Could not write %s.\n", path );
+                return 1;
+            }
+            fclose ( output );
+        }
+
+        blastmidi_initialize ( &instance, NULL, NULL );
+        if ( blastmidi_read_memory ( &instance, file.data, file.size ) != BLASTMIDI_OK )
+        {
+            fprintf ( stderr, "The %s profile could not be read.\n", profiles[p].name );
+            return 1;
+        }
+        iteration_time = measure_iteration ( &instance, repetitions, &events );
+        ump_time = measure_ump ( &instance, repetitions );
+        write_time = measure_write ( &instance, WRITE_FULL, repetitions );
+        incremental_time = measure_write ( &instance, WRITE_INCREMENTAL, repetitions );
+        parallel_time = measure_write ( &instance, WRITE_PARALLEL, repetitions );
+        blastmidi_free ( &instance );
+
+        callback_time = measure_read ( &file, READ_CALLBACK, repetitions, NULL, NULL );
+        memory_time = measure_read ( &file, READ_MEMORY, repetitions, &free_time, NULL );
+        recycled_time = measure_read ( &file, READ_MEMORY_RECYCLED, repetitions, NULL, NULL );
+        masked_time = measure_read ( &file, READ_MEMORY_MASKED, repetitions, NULL, NULL );
+        preview_time = measure_read ( &file, READ_MEMORY_PREVIEW, repetitions, NULL, &preview_events );
+        filter_time = measure_filter ( &file, repetitions );
+        probe_time = measure_probe ( &file, repetitions );
+        cursor_time = measure_cursor ( &file, repetitions );
+
+        printf ( "%s: %lu bytes, %lu events\n", profiles[p].name, ( unsigned long ) file.size, ( unsigned long ) events );
+        report ( "read (callback)", events, file.size, callback_time );
+        report ( "read (memory)", events, file.size, memory_time );
+        report ( "read (recycled)", events, file.size, recycled_time );
+        report ( "read (masked)", events, file.size, masked_time );
+        report ( "read (first 5 s)", preview_events, 0, preview_time );
+        report ( "probe", events, file.size, probe_time );
+        report ( "iterate", events, 0, iteration_time );
+        report ( "iterate (cursor)", events, file.size, cursor_time );
+        report ( "free", events, 0, free_time );
+        report ( "convert to UMP", events, 0, ump_time );
+        report ( "write", events, file.size, write_time );
+        report ( "write (incremental)", events, file.size, incremental_time );
+        report ( "write (parallel)", events, file.size, parallel_time );
+        report ( "filter (streaming)", events, file.size, filter_time );
+        free ( file.data );
+    }
+    return 0;
+}
@@ -0,0 +1,193 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_bench_utility.h
+* The clock, random number generator and file building functions that the benchmarks share.
+* Every benchmark is a single source file, so the functions are defined here, as static functions so that every file that
+* includes this header gets its own copy. Include this header before any other, since it selects the POSIX clock functions.
+*/
+
+#ifndef BLASTMIDI_BENCH_UTILITY_H
+#define BLASTMIDI_BENCH_UTILITY_H
+
+#ifndef _WIN32
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 199309L /* For clock_gettime and nanosleep */
+#endif
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blastmidi.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/*
+*          double get_time(void);
+* Returns the time in seconds on a monotonic clock.
+*/
+static double get_time ( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency ( &frequency );
+    QueryPerformanceCounter ( &counter );
+    return ( double ) counter.QuadPart / ( double ) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( double ) now.tv_sec + ( double ) now.tv_nsec / 1000000000.0;
+#endif
+}
+
+/*
+*          uint32_t next_random(uint32_t range);
+* A deterministic xorshift random number generator, so that the generated files do not depend on the C library.
+* Returns a number below range, or any 32 bit number if range is 0. Set random_state to start a new sequence.
+*/
+static uint32_t random_state = 2463534242u;
+
+static uint32_t next_random ( uint32_t range )
+{
+    random_state ^= random_state << 13;
+    random_state ^= random_state >> 17;
+    random_state ^= random_state << 5;
+    return range ? random_state % range : random_state;
+}
+
+/*
+* A growable byte buffer, used both to build files and to hold them.
+*/
+typedef struct byte_buffer
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} byte_buffer;
+
+/*
+*          void put_bytes(byte_buffer* buffer, const void* data, size_t size);
+* Appends size bytes to the buffer. The program exits if it runs out of memory.
+*/
+static void put_bytes ( byte_buffer* buffer, const void* data, size_t size )
+{
+    if ( size == 0 )
+    {
+        return;
+    }
+    if ( buffer->size + size > buffer->capacity )
+    {
+        size_t capacity = buffer->capacity ? buffer->capacity : 4096;
+        while ( capacity < buffer->size + size )
+        {
+            capacity *= 2;
+        }
+        buffer->data = ( uint8_t* ) realloc ( buffer->data, capacity );
+        if ( buffer->data == NULL )
+        {
+            fprintf ( stderr, "Out of memory.\n" );
+            exit ( 1 );
+        }
+        buffer->capacity = capacity;
+    }
+    memcpy ( buffer->data + buffer->size, data, size );
+    buffer->size += size;
+}
+
+static void put_byte ( byte_buffer* buffer, uint32_t value )
+{
+    uint8_t byte = ( uint8_t ) value;
+    put_bytes ( buffer, &byte, 1 );
+}
+
+static void put_32 ( byte_buffer* buffer, uint32_t value )
+{
+    put_byte ( buffer, value >> 24 );
+    put_byte ( buffer, value >> 16 );
+    put_byte ( buffer, value >> 8 );
+    put_byte ( buffer, value );
+}
+
+static void put_variable_number ( byte_buffer* buffer, uint32_t value )
+{
+    uint8_t bytes[4];
+    int count = 0;
+    bytes[count++] = value & 0x7F;
+    while ( ( value >>= 7 ) != 0 && count < 4 )
+    {
+        bytes[count++] = 0x80 | ( value & 0x7F );
+    }
+    while ( count-- )
+    {
+        put_byte ( buffer, bytes[count] );
+    }
+}
+
+static void put_meta ( byte_buffer* track, uint32_t delta, uint8_t type, const void* data, uint32_t size )
+{
+    put_variable_number ( track, delta );
+    put_byte ( track, 0xFF );
+    put_byte ( track, type );
+    put_variable_number ( track, size );
+    put_bytes ( track, data, size );
+}
+
+/*
+*          void put_channel_event(byte_buffer* track, uint32_t delta, uint8_t status, uint8_t first, int second, uint8_t* last_status, int running_status);
+* Appends a channel event. second is left out if it is negative, as for program changes and channel aftertouch.
+* If running_status is nonzero, the status byte is left out whenever the previous channel event of the track had the same one.
+*/
+static void put_channel_event ( byte_buffer* track, uint32_t delta, uint8_t status, uint8_t first, int second, uint8_t* last_status, int running_status )
+{
+    put_variable_number ( track, delta );
+    if ( !running_status || status != *last_status )
+    {
+        put_byte ( track, status );
+    }
+    *last_status = status;
+    put_byte ( track, first & 0x7F );
+    if ( second >= 0 )
+    {
+        put_byte ( track, second & 0x7F );
+    }
+}
+
+/*
+*          void finish_track(byte_buffer* file, byte_buffer* track);
+* Ends the track, appends it to the file as a chunk and empties it, so that the next track can be built in the same buffer.
+*/
+static void finish_track ( byte_buffer* file, byte_buffer* track )
+{
+    put_meta ( track, 0, 0x2F, NULL, 0 );
+    put_bytes ( file, "MTrk", 4 );
+    put_32 ( file, ( uint32_t ) track->size );
+    put_bytes ( file, track->data, track->size );
+    track->size = 0;
+}
+
+static void put_header ( byte_buffer* file, uint16_t type, uint16_t tracks, uint16_t division )
+{
+    put_bytes ( file, "MThd", 4 );
+    put_32 ( file, 6 );
+    put_byte ( file, type >> 8 );
+    put_byte ( file, type );
+    put_byte ( file, tracks >> 8 );
+    put_byte ( file, tracks );
+    put_byte ( file, division >> 8 );
+    put_byte ( file, division );
+}
+
+#endif /* BLASTMIDI_BENCH_UTILITY_H */
@@ -0,0 +1,290 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_render_bench.c
+* The BlastMidi render benchmark.
+*
+* This program renders Midi files to stereo audio with the render API, and reports how many times faster than real time it
+* renders them. Without any files, it generates a deterministic type 1 file with 16 channels of chords, melodies, drums, pitch
+* bends and volume changes under a changing tempo.
+* Build it a second time with -DBLASTMIDI_NO_SIMD to compare the SSE2 code with the portable code.
+*
+* Usage: blastmidi_render_bench [-r rate] [-w file.wav] [file.mid ...]
+* -r sets the sample rate (44100 by default), and -w writes the audio of the last file to a 32 bit float wave file.
+*
+* Build it together with blastmidi.c and blastmidi_render.c, for example:
+* cc -O2 -Iinclude bench/blastmidi_render_bench.c src/blastmidi.c src/blastmidi_render.c -lm -o blastmidi_render_bench
+*/
+
+#include "blastmidi_bench_utility.h"
+#include "blastmidi_render.h"
+
+/*
+* Appends a type 1 file of 3 minutes or so at 480 ticks per beat. The conductor track changes the tempo every 4 beats, the
+* drum channel plays sixteenth notes, channels 0 to 3 play chords of 4 notes per beat with the sustain pedal, and the other
+* channels play eighth note melodies with an occasional pitch bend and volume change, each with its own program and pan.
+*/
+void generate_file ( byte_buffer* file )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    const uint32_t beats = 360;
+    uint8_t last_status = 0;
+    uint32_t i;
+    uint8_t channel;
+
+    put_header ( file, 1, 17, 480 );
+
+    for ( i = 0; i < beats; i += 4 )
+    {
+        uint32_t tempo = 60000000u / ( 100 + next_random ( 41 ) );
+        put_variable_number ( &track, i ? 4 * 480 : 0 );
+        put_byte ( &track, 0xFF );
+        put_byte ( &track, 0x51 );
+        put_byte ( &track, 3 );
+        put_byte ( &track, tempo >> 16 );
+        put_byte ( &track, tempo >> 8 );
+        put_byte ( &track, tempo );
+    }
+    finish_track ( file, &track );
+
+    for ( channel = 0; channel < 16; ++channel )
+    {
+        uint32_t delta = 0;
+        if ( channel != 9 )
+        {
+            put_channel_event ( &track, 0, 0xC0 | channel, ( uint8_t ) ( channel * 8 ), -1, &last_status, 0 );
+            put_channel_event ( &track, 0, 0xB0 | channel, 10, ( uint8_t ) ( channel * 8 ), &last_status, 0 );
+            put_channel_event ( &track, 0, 0xB0 | channel, 7, 100, &last_status, 0 );
+        }
+        if ( channel == 9 )
+        {
+            for ( i = 0; i < beats * 4; ++i )
+            {
+                uint8_t note = ( uint8_t ) ( i % 4 == 0 ? 36 : 42 );
+                put_channel_event ( &track, i ? 60 : 0, 0x99, note, 100, &last_status, 0 );
+                put_channel_event ( &track, 60, 0x99, note, 0, &last_status, 0 );
+            }
+        }
+        else if ( channel < 4 )
+        {
+            for ( i = 0; i < beats; ++i )
+            {
+                uint8_t root = ( uint8_t ) ( 36 + channel * 6 + next_random ( 12 ) );
+                int n;
+                for ( n = 0; n < 4; ++n )
+                {
+                    put_channel_event ( &track, n ? 0 : delta, 0x90 | channel, ( uint8_t ) ( root + n * 4 ), ( uint8_t ) ( 60 + next_random ( 40 ) ), &last_status, 0 );
+                }
+                put_channel_event ( &track, 0, 0xB0 | channel, 64, 127, &last_status, 0 );
+                put_channel_event ( &track, 400, 0x80 | channel, root, 64, &last_status, 0 );
+                for ( n = 1; n < 4; ++n )
+                {
+                    put_channel_event ( &track, 0, 0x80 | channel, ( uint8_t ) ( root + n * 4 ), 64, &last_status, 0 );
+                }
+                put_channel_event ( &track, 70, 0xB0 | channel, 64, 0, &last_status, 0 );
+                delta = 10;
+            }
+        }
+        else
+        {
+            for ( i = 0; i < beats * 2; ++i )
+            {
+                uint8_t note = ( uint8_t ) ( 48 + next_random ( 36 ) );
+                if ( next_random ( 16 ) == 0 )
+                {
+                    uint32_t bend = next_random ( 16384 );
+                    put_channel_event ( &track, delta, 0xE0 | channel, bend & 0x7F, bend >> 7, &last_status, 0 );
+                    delta = 0;
+                }
+                if ( next_random ( 16 ) == 0 )
+                {
+                    put_channel_event ( &track, delta, 0xB0 | channel, 7, ( uint8_t ) ( 60 + next_random ( 68 ) ), &last_status, 0 );
+                    delta = 0;
+                }
+                put_channel_event ( &track, delta, 0x90 | channel, note, ( uint8_t ) ( 60 + next_random ( 68 ) ), &last_status, 0 );
+                put_channel_event ( &track, 200, 0x80 | channel, note, 64, &last_status, 0 );
+                delta = 40;
+            }
+        }
+        finish_track ( file, &track );
+    }
+    free ( track.data );
+}
+
+uint8_t load_file ( const char* path, byte_buffer* file )
+{
+    FILE* input = fopen ( path, "rb" );
+    uint8_t chunk[65536];
+    size_t size = 0;
+    if ( input == NULL )
+    {
+        return 0;
+    }
+    while ( ( size = fread ( chunk, 1, sizeof ( chunk ), input ) ) > 0 )
+    {
+        put_bytes ( file, chunk, size );
+    }
+    fclose ( input );
+    return 1;
+}
+
+void put_16_little ( byte_buffer* buffer, uint32_t value )
+{
+    put_byte ( buffer, value );
+    put_byte ( buffer, value >> 8 );
+}
+
+void put_32_little ( byte_buffer* buffer, uint32_t value )
+{
+    put_16_little ( buffer, value );
+    put_16_little ( buffer, value >> 16 );
+}
+
+/*
+* Writes stereo samples to a wave file in the IEEE float format.
+*/
+uint8_t write_wave ( const char* path, const float* samples, size_t frames, uint32_t sample_rate )
+{
+    byte_buffer header = { NULL, 0, 0 };
+    uint32_t data_size = ( uint32_t ) ( frames * 2 * sizeof ( float ) );
+    FILE* output = fopen ( path, "wb" );
+    uint8_t result = 0;
+    if ( output == NULL )
+    {
+        return 0;
+    }
+    put_bytes ( &header, "RIFF", 4 );
+    put_32_little ( &header, 36 + data_size );
+    put_bytes ( &header, "WAVEfmt ", 8 );
+    put_32_little ( &header, 16 );
+    put_16_little ( &header, 3 );
+    put_16_little ( &header, 2 );
+    put_32_little ( &header, sample_rate );
+    put_32_little ( &header, sample_rate * 2 * sizeof ( float ) );
+    put_16_little ( &header, 2 * sizeof ( float ) );
+    put_16_little ( &header, 32 );
+    put_bytes ( &header, "data", 4 );
+    put_32_little ( &header, data_size );
+    result = fwrite ( header.data, 1, header.size, output ) == header.size && fwrite ( samples, sizeof ( float ), frames * 2, output ) == frames * 2;
+    fclose ( output );
+    free ( header.data );
+    return result;
+}
+
+/*
+* Renders the whole track in blocks of a typical size for an audio stream, collecting the audio if samples is not NULL.
+*/
+void render_file ( const char* name, blastmidi* instance, uint32_t sample_rate, byte_buffer* samples )
+{
+    blastmidi_renderer* renderer = ( blastmidi_renderer* ) malloc ( sizeof ( blastmidi_renderer ) );
+    float block[1024 * 2];
+    size_t frames = 0;
+    size_t rendered = 0;
+    double elapsed = 0;
+    if ( renderer == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        exit ( 1 );
+    }
+    if ( blastmidi_render_initialize ( renderer, instance, 0, sample_rate, 2 ) != BLASTMIDI_OK )
+    {
+        fprintf ( stderr, "%s could not be rendered.\n", name );
+        free ( renderer );
+        return;
+    }
+    elapsed = get_time();
+    while ( ( rendered = blastmidi_render ( renderer, block, 1024 ) ) > 0 )
+    {
+        frames += rendered;
+        if ( samples )
+        {
+            put_bytes ( samples, block, rendered * 2 * sizeof ( float ) );
+        }
+    }
+    elapsed = get_time() - elapsed;
+    printf ( "%s: %.1f s of audio in %.3f s, %.0f times faster than real time\n", name, ( double ) frames / sample_rate, elapsed, elapsed > 0 ? ( double ) frames / sample_rate / elapsed : 0.0 );
+    free ( renderer );
+}
+
+int main ( int argc, char** argv )
+{
+    const char* wave_path = NULL;
+    const char** paths = ( const char** ) malloc ( sizeof ( const char* ) * argc );
+    uint32_t sample_rate = 44100;
+    byte_buffer samples = { NULL, 0, 0 };
+    int file_count = 0;
+    int a;
+
+    for ( a = 1; a < argc; ++a )
+    {
+        if ( strcmp ( argv[a], "-r" ) == 0 && a + 1 < argc )
+        {
+            sample_rate = ( uint32_t ) atol ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-w" ) == 0 && a + 1 < argc )
+        {
+            wave_path = argv[++a];
+        }
+        else if ( argv[a][0] == '-' )
+        {
+            fprintf ( stderr, "Usage: %s [-r rate] [-w file.wav] [file.mid ...]\n", argv[0] );
+            return 1;
+        }
+        else
+        {
+            paths[file_count++] = argv[a];
+        }
+    }
+    printf ( "%s code, %lu Hz\n",
+#if !defined(BLASTMIDI_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+             "SSE2",
+#else
+             "Portable",
+#endif
+             ( unsigned long ) sample_rate );
+
+    /*
+    * The files are merged into a single track first, which is what the renderer plays.
+    */
+    for ( a = 0; a < file_count || ( a == 0 && file_count == 0 ); ++a )
+    {
+        byte_buffer file = { NULL, 0, 0 };
+        blastmidi instance;
+        const char* name = file_count ? paths[a] : "generated";
+        if ( file_count == 0 )
+        {
+            generate_file ( &file );
+        }
+        else if ( !load_file ( name, &file ) )
+        {
+            fprintf ( stderr, "Could not read %s.\n", name );
+            continue;
+        }
+        blastmidi_initialize ( &instance, NULL, NULL );
+        if ( blastmidi_read_memory ( &instance, file.data, file.size ) != BLASTMIDI_OK || ( instance.file_type == 1 && blastmidi_merge_tracks ( &instance ) != BLASTMIDI_OK ) )
+        {
+            fprintf ( stderr, "%s could not be parsed.\n", name );
+        }
+        else
+        {
+            samples.size = 0;
+            render_file ( name, &instance, sample_rate, wave_path ? &samples : NULL );
+        }
+        blastmidi_free ( &instance );
+        free ( file.data );
+    }
+    if ( wave_path && samples.size > 0 && !write_wave ( wave_path, ( const float* ) samples.data, samples.size / ( 2 * sizeof ( float ) ), sample_rate ) )
+    {
+        fprintf ( stderr, "Could not write %s.\n", wave_path );
+    }
+    free ( samples.data );
+    free ( ( void* ) paths );
+    return 0;
+}
@@ -0,0 +1,311 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_scheduler_bench.c
+* The BlastMidi scheduler benchmark.
+*
+* This program generates a deterministic set of type 1 files with changing tempos, merges the tracks of each, and plays them
+* on a large number of sessions of a single scheduler, with staggered starts, as a server that streams to many clients would.
+* It first drives the scheduler with a simulated clock as fast as it can, and reports how many events it dispatches per second.
+* It then drives it with the real clock for a while, sleeping between calls, and reports how late the events are dispatched
+* relative to their due times as percentiles. Negative lateness means that an event was dispatched early, which the scheduler
+* does by up to one resolution unit.
+*
+* Usage: blastmidi_scheduler_bench [-n sessions] [-s simulated seconds] [-t real seconds] [-r resolution]
+* The resolution is given in microseconds.
+*
+* Build it together with blastmidi.c and blastmidi_scheduler.c, for example:
+* cc -O2 -Iinclude bench/blastmidi_scheduler_bench.c src/blastmidi.c src/blastmidi_scheduler.c -o blastmidi_scheduler_bench
+*/
+
+#include "blastmidi_bench_utility.h"
+#include "blastmidi_scheduler.h"
+
+#define FILE_COUNT 16
+
+/*
+* The time in microseconds, which is the unit of the clock of the scheduler.
+*/
+uint64_t get_microseconds ( void )
+{
+    return ( uint64_t ) ( get_time() * 1000000.0 );
+}
+
+void sleep_for ( uint64_t microseconds )
+{
+#ifdef _WIN32
+    Sleep ( ( DWORD ) ( microseconds / 1000 ) );
+#else
+    struct timespec duration;
+    duration.tv_sec = ( time_t ) ( microseconds / 1000000u );
+    duration.tv_nsec = ( long ) ( microseconds % 1000000u ) * 1000;
+    nanosleep ( &duration, NULL );
+#endif
+}
+
+/*
+* Appends a type 1 file of about the given number of beats at 480 ticks per beat, with a conductor track that changes the
+* tempo every 4 beats to anything from 60 to 180 beats per minute, and 3 tracks of eighth notes on their own channels.
+*/
+void generate_file ( byte_buffer* file, uint32_t beats )
+{
+    byte_buffer track = { NULL, 0, 0 };
+    uint8_t last_status = 0;
+    uint32_t i;
+    uint8_t channel;
+
+    put_header ( file, 1, 4, 480 );
+
+    for ( i = 0; i < beats; i += 4 )
+    {
+        uint32_t tempo = 60000000u / ( 60 + next_random ( 121 ) );
+        put_variable_number ( &track, i ? 4 * 480 : 0 );
+        put_byte ( &track, 0xFF );
+        put_byte ( &track, 0x51 );
+        put_byte ( &track, 3 );
+        put_byte ( &track, tempo >> 16 );
+        put_byte ( &track, tempo >> 8 );
+        put_byte ( &track, tempo );
+    }
+    finish_track ( file, &track );
+
+    for ( channel = 0; channel < 3; ++channel )
+    {
+        for ( i = 0; i < beats * 2; ++i )
+        {
+            uint8_t note = ( uint8_t ) ( 48 + next_random ( 36 ) );
+            put_channel_event ( &track, 0, 0x90 | channel, note, ( int ) ( 64 + next_random ( 64 ) ), &last_status, 0 );
+            put_channel_event ( &track, 240, 0x80 | channel, note, 64, &last_status, 0 );
+        }
+        finish_track ( file, &track );
+    }
+    free ( track.data );
+}
+
+/*
+* The state of a run. Lateness samples are only collected when samples is not NULL.
+*/
+typedef struct bench_state
+{
+    size_t events;
+    size_t ended;
+    uint32_t checksum;
+    int64_t* samples;
+    size_t sample_count;
+    size_t sample_capacity;
+} bench_state;
+
+void dispatch ( blastmidi_scheduler_session* session, const blastmidi_event* event, uint64_t due, void* user_data )
+{
+    bench_state* state = ( bench_state* ) user_data;
+    ( void ) session;
+    if ( event == NULL )
+    {
+        state->ended++;
+        return;
+    }
+    state->events++;
+    if ( event->data_size > 0 )
+    {
+        state->checksum += event->data[0];
+    }
+    if ( state->samples && state->sample_count < state->sample_capacity )
+    {
+        state->samples[state->sample_count++] = ( int64_t ) get_microseconds() - ( int64_t ) due;
+    }
+}
+
+int compare_samples ( const void* a, const void* b )
+{
+    int64_t first = * ( const int64_t* ) a;
+    int64_t second = * ( const int64_t* ) b;
+    return first < second ? -1 : first > second;
+}
+
+int64_t percentile ( const int64_t* samples, size_t count, double fraction )
+{
+    size_t index = ( size_t ) ( fraction * ( double ) ( count - 1 ) );
+    return samples[index];
+}
+
+/*
+* Starts every session on one of the files, spread evenly over the first second.
+*/
+void start_sessions ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* sessions, size_t session_count, blastmidi* instances, uint64_t now )
+{
+    size_t i;
+    for ( i = 0; i < session_count; ++i )
+    {
+        uint8_t result = blastmidi_scheduler_start ( scheduler, &sessions[i], &instances[i % FILE_COUNT], 0, now + ( uint64_t ) i * 1000000u / session_count, NULL );
+        if ( result != BLASTMIDI_OK )
+        {
+            fprintf ( stderr, "Starting a session failed with error %u.\n", ( unsigned int ) result );
+            exit ( 1 );
+        }
+    }
+}
+
+/*
+* The number of events that blastmidi_scheduler_advance reports must match the number that reached the callback, or the run
+* measured something other than what it claims.
+*/
+void check_dispatched ( const bench_state* state, size_t dispatched )
+{
+    if ( dispatched != state->events )
+    {
+        fprintf ( stderr, "The scheduler reported %lu events, but dispatched %lu.\n", ( unsigned long ) dispatched, ( unsigned long ) state->events );
+        exit ( 1 );
+    }
+}
+
+int main ( int argc, char** argv )
+{
+    blastmidi instances[FILE_COUNT];
+    blastmidi_scheduler* scheduler = NULL;
+    blastmidi_scheduler_session* sessions = NULL;
+    bench_state state;
+    size_t session_count = 10000;
+    uint32_t simulated_seconds = 60;
+    uint32_t real_seconds = 3;
+    uint32_t resolution = 1000;
+    uint64_t now = 0;
+    uint64_t end = 0;
+    size_t dispatched = 0;
+    double elapsed = 0;
+    size_t i;
+    int a;
+
+    for ( a = 1; a < argc; ++a )
+    {
+        if ( strcmp ( argv[a], "-n" ) == 0 && a + 1 < argc )
+        {
+            session_count = ( size_t ) atol ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-s" ) == 0 && a + 1 < argc )
+        {
+            simulated_seconds = ( uint32_t ) atol ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-t" ) == 0 && a + 1 < argc )
+        {
+            real_seconds = ( uint32_t ) atol ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-r" ) == 0 && a + 1 < argc )
+        {
+            resolution = ( uint32_t ) atol ( argv[++a] );
+        }
+        else
+        {
+            fprintf ( stderr, "Usage: %s [-n sessions] [-s simulated seconds] [-t real seconds] [-r resolution]\n", argv[0] );
+            return 1;
+        }
+    }
+    if ( session_count < 1 )
+    {
+        session_count = 1;
+    }
+    if ( resolution < 1 )
+    {
+        resolution = 1;
+    }
+
+    /*
+    * The files last long enough that no session runs out during the runs, even at the fastest tempo.
+    */
+    for ( i = 0; i < FILE_COUNT; ++i )
+    {
+        byte_buffer file = { NULL, 0, 0 };
+        uint32_t seconds = simulated_seconds > real_seconds ? simulated_seconds : real_seconds;
+        generate_file ( &file, 3 * ( seconds + 2 ) );
+        blastmidi_initialize ( &instances[i], NULL, NULL );
+        if ( blastmidi_read_memory ( &instances[i], file.data, file.size ) != BLASTMIDI_OK || blastmidi_merge_tracks ( &instances[i] ) != BLASTMIDI_OK )
+        {
+            fprintf ( stderr, "A file could not be prepared.\n" );
+            return 1;
+        }
+        free ( file.data );
+    }
+    scheduler = ( blastmidi_scheduler* ) malloc ( sizeof ( blastmidi_scheduler ) );
+    sessions = ( blastmidi_scheduler_session* ) malloc ( sizeof ( blastmidi_scheduler_session ) * session_count );
+    if ( scheduler == NULL || sessions == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        return 1;
+    }
+    printf ( "%lu sessions, resolution %lu us\n", ( unsigned long ) session_count, ( unsigned long ) resolution );
+
+    /*
+    * The simulated run advances the clock by one resolution unit per call, so only the scheduler itself is timed.
+    */
+    memset ( ( void* ) &state, 0, sizeof ( bench_state ) );
+    blastmidi_scheduler_initialize ( scheduler, resolution, 0 );
+    start_sessions ( scheduler, sessions, session_count, instances, 0 );
+    end = ( uint64_t ) simulated_seconds * 1000000u;
+    elapsed = get_time();
+    for ( now = 0; now < end; now += resolution )
+    {
+        dispatched += blastmidi_scheduler_advance ( scheduler, now, dispatch, &state );
+    }
+    elapsed = get_time() - elapsed;
+    check_dispatched ( &state, dispatched );
+    printf ( "simulated: %lu events in %u s of playback, %.3f s of processor time\n", ( unsigned long ) state.events, simulated_seconds, elapsed );
+    if ( elapsed > 0 )
+    {
+        printf ( "  %.2f Mevents/s, %.0f times faster than real time\n", ( double ) state.events / elapsed / 1000000.0, ( double ) simulated_seconds / elapsed );
+    }
+
+    /*
+    * The real time run sleeps until the next resolution unit after every call, as a streaming thread would.
+    */
+    memset ( ( void* ) &state, 0, sizeof ( bench_state ) );
+    state.sample_capacity = ( size_t ) real_seconds * session_count * 64 + 1024;
+    state.samples = ( int64_t* ) malloc ( sizeof ( int64_t ) * state.sample_capacity );
+    if ( state.samples == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        return 1;
+    }
+    dispatched = 0;
+    now = get_microseconds();
+    blastmidi_scheduler_initialize ( scheduler, resolution, now );
+    start_sessions ( scheduler, sessions, session_count, instances, now );
+    end = now + ( uint64_t ) real_seconds * 1000000u;
+    while ( now < end )
+    {
+        uint64_t next = ( now / resolution + 1 ) * resolution;
+        dispatched += blastmidi_scheduler_advance ( scheduler, now, dispatch, &state );
+        now = get_microseconds();
+        if ( now < next )
+        {
+            sleep_for ( next - now );
+            now = get_microseconds();
+        }
+    }
+    check_dispatched ( &state, dispatched );
+    printf ( "real time: %lu events in %u s\n", ( unsigned long ) state.events, real_seconds );
+    if ( state.sample_count > 0 )
+    {
+        qsort ( state.samples, state.sample_count, sizeof ( int64_t ), compare_samples );
+        printf ( "  lateness in us: min %ld", ( long ) state.samples[0] );
+        printf ( ", 50%% %ld", ( long ) percentile ( state.samples, state.sample_count, 0.5 ) );
+        printf ( ", 90%% %ld", ( long ) percentile ( state.samples, state.sample_count, 0.9 ) );
+        printf ( ", 99%% %ld", ( long ) percentile ( state.samples, state.sample_count, 0.99 ) );
+        printf ( ", 99.9%% %ld", ( long ) percentile ( state.samples, state.sample_count, 0.999 ) );
+        printf ( ", max %ld\n", ( long ) state.samples[state.sample_count - 1] );
+    }
+
+    free ( state.samples );
+    free ( sessions );
+    free ( scheduler );
+    for ( i = 0; i < FILE_COUNT; ++i )
+    {
+        blastmidi_free ( &instances[i] );
+    }
+    return 0;
+}
@@ -0,0 +1,489 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_fuzz.c
+* A fuzzing harness for the BlastMidi parser.
+*
+* Every input is parsed from memory with resource limits in place, and again through the data callback. The two results must
+* agree, since both paths share the same parser. Parsed files are written back and parsed again, and they are frozen and walked,
+* so that the writer and the snapshot code are covered as well. The input is also read partially, with a read end, probed
+* from memory and through the callback, walked with cursors and run through the streaming filter. The editing operations are
+* run on every track after the read through the callback. Before the first input, a fixed pitch bend message is checked.
+* Every input is also offered to blastmidi_snapshot_load, which must reject it or produce a snapshot that can be walked safely.
+*
+* To build it for libFuzzer:
+* clang -g -O1 -fsanitize=fuzzer,address,undefined -Iinclude fuzz/blastmidi_fuzz.c src/blastmidi.c -o blastmidi_fuzz
+*
+* To build it for AFL, or to replay a single input, define BLASTMIDI_FUZZ_MAIN. The program then reads the input from the file
+* given on the command line, or from standard input if there is none:
+* afl-clang-fast -DBLASTMIDI_FUZZ_MAIN -Iinclude fuzz/blastmidi_fuzz.c src/blastmidi.c -o blastmidi_fuzz_afl
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blastmidi.h"
+
+/*
+* Generous limits for real files, but small enough that no input can make the harness run out of memory.
+*/
+#define FUZZ_MAX_PAYLOAD_SIZE ( 1024 * 1024 )
+#define FUZZ_MAX_EVENTS 1000000
+#define FUZZ_MAX_MEMORY ( 64 * 1024 * 1024 )
+
+typedef struct fuzz_reader
+{
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+} fuzz_reader;
+
+static int fuzz_callback ( int action, size_t size, uint8_t* buffer, void* user_data )
+{
+    fuzz_reader* reader = ( fuzz_reader* ) user_data;
+    if ( action == BLASTMIDI_CALLBACK_READ )
+    {
+        if ( size > reader->size - reader->position )
+        {
+            return 0;
+        }
+        memcpy ( buffer, reader->data + reader->position, size );
+        reader->position += size;
+        return 1;
+    }
+    if ( action == BLASTMIDI_CALLBACK_SEEK )
+    {
+        if ( size > reader->size )
+        {
+            return 0;
+        }
+        reader->position = size;
+        return 1;
+    }
+    return 0;
+}
+
+typedef struct fuzz_writer
+{
+    uint8_t* data;
+    size_t size;
+    size_t capacity;
+} fuzz_writer;
+
+static int fuzz_write_callback ( int action, size_t size, uint8_t* buffer, void* user_data )
+{
+    fuzz_writer* writer = ( fuzz_writer* ) user_data;
+    if ( action != BLASTMIDI_CALLBACK_WRITE )
+    {
+        return 0;
+    }
+    if ( size > writer->capacity - writer->size )
+    {
+        size_t capacity = ( writer->size + size ) * 2;
+        uint8_t* data = ( uint8_t* ) realloc ( writer->data, capacity );
+        if ( data == NULL )
+        {
+            return 0;
+        }
+        writer->data = data;
+        writer->capacity = capacity;
+    }
+    memcpy ( writer->data + writer->size, buffer, size );
+    writer->size += size;
+    return 1;
+}
+
+/*
+* The walk touches the first and last byte of every payload, so that the sanitizers can check them.
+* The sum goes to a volatile variable so that the compiler cannot optimize the reads away.
+*/
+static volatile uint32_t fuzz_checksum = 0;
+
+static size_t fuzz_walk_snapshot ( const blastmidi_snapshot* snapshot )
+{
+    size_t count = 0;
+    uint64_t microseconds = 0;
+    uint16_t i;
+    for ( i = 0; i < snapshot->track_count; ++i )
+    {
+        const blastmidi_snapshot_track* track = NULL;
+        uint32_t e;
+        blastmidi_snapshot_get_track ( snapshot, i, &track );
+        for ( e = 0; e < track->event_count; ++e )
+        {
+            const blastmidi_snapshot_event* event = NULL;
+            blastmidi_snapshot_get_event ( snapshot, i, e, &event );
+            if ( event->data_size > 0 )
+            {
+                const uint8_t* data = blastmidi_snapshot_get_event_data ( snapshot, event );
+                fuzz_checksum += data[0] + data[event->data_size - 1];
+            }
+            if ( blastmidi_snapshot_get_time ( snapshot, event->tick, &microseconds ) == BLASTMIDI_OK )
+            {
+                fuzz_checksum += ( uint32_t ) microseconds;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+static size_t fuzz_walk ( blastmidi* instance )
+{
+    size_t count = 0;
+    uint16_t i;
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        blastmidi_event* event = NULL;
+        blastmidi_get_first_event_on_track ( instance, i, &event );
+        while ( event )
+        {
+            if ( event->data_size > 0 )
+            {
+                fuzz_checksum += event->data[0] + event->data[event->data_size - 1];
+            }
+            ++count;
+            blastmidi_get_next_event_on_track ( instance, &event );
+        }
+    }
+    return count;
+}
+
+/*
+* Every track is walked with a cursor straight from the input, up to its end or the first error.
+*/
+static void fuzz_walk_cursors ( const uint8_t* data, size_t size )
+{
+    blastmidi_cursor cursor;
+    uint16_t i;
+    for ( i = 0; blastmidi_cursor_find_track ( &cursor, data, size, i ) == BLASTMIDI_OK; ++i )
+    {
+        blastmidi_event* event = NULL;
+        cursor.max_payload_size = FUZZ_MAX_PAYLOAD_SIZE;
+        while ( blastmidi_cursor_next ( &cursor, &event ) == BLASTMIDI_OK && event )
+        {
+            if ( event->data_size > 0 )
+            {
+                fuzz_checksum += event->data[0] + event->data[event->data_size - 1];
+            }
+        }
+    }
+}
+
+/*
+* A parsed file is written back, both in full and by copying the clean tracks from the input, and each result must parse to
+* the same number of events.
+*/
+static void fuzz_check_write ( blastmidi* instance, const uint8_t* data, size_t size, size_t events )
+{
+    fuzz_writer writer;
+    blastmidi copy;
+    int pass;
+    memset ( ( void* ) &writer, 0, sizeof ( fuzz_writer ) );
+    blastmidi_initialize ( &copy, NULL, NULL );
+    blastmidi_set_data_callback ( instance, fuzz_write_callback, &writer );
+    for ( pass = 0; pass < 2; ++pass )
+    {
+        writer.size = 0;
+        if ( ( pass == 0 ? blastmidi_write_incremental ( instance, data, size ) : blastmidi_write ( instance ) ) != BLASTMIDI_OK )
+        {
+            abort();
+        }
+        if ( blastmidi_read_memory ( &copy, writer.data, writer.size ) != BLASTMIDI_OK || fuzz_walk ( &copy ) != events )
+        {
+            abort();
+        }
+    }
+    blastmidi_set_data_callback ( instance, NULL, NULL );
+    blastmidi_free ( &copy );
+    free ( writer.data );
+}
+
+/*
+* The editing operations are run on every track of the instance, whether or not the last read succeeded. A recycled instance keeps
+* its track array after a failed read while it holds no tracks, which they must handle as well. Quantizing moves events without
+* removing any, and so does inserting silence unless it would run past the largest time, so the number of events must not change.
+* Cutting and deleting ranges must always succeed.
+*/
+static void fuzz_check_edits ( blastmidi* instance )
+{
+    size_t events = 0;
+    if ( instance->tracks == NULL )
+    {
+        return;
+    }
+    events = fuzz_walk ( instance );
+    if ( blastmidi_quantize ( instance, BLASTMIDI_ALL_TRACKS, 120, 0.5, 0.25 ) != BLASTMIDI_OK || fuzz_walk ( instance ) != events )
+    {
+        abort();
+    }
+    if ( blastmidi_insert_silence ( instance, BLASTMIDI_ALL_TRACKS, 0, 480 ) == BLASTMIDI_OK && fuzz_walk ( instance ) != events )
+    {
+        abort();
+    }
+    if ( blastmidi_cut_range ( instance, BLASTMIDI_ALL_TRACKS, 480, 960 ) != BLASTMIDI_OK || blastmidi_delete_range ( instance, BLASTMIDI_ALL_TRACKS, 960, 1920 ) != BLASTMIDI_OK )
+    {
+        abort();
+    }
+    fuzz_walk ( instance );
+}
+
+/*
+* The input is also passed through the streaming filter, with a stage that keeps every event. The filter writes every event in
+* the same form that it decodes it from, so filtering its own output again must give exactly the same bytes.
+*/
+static int fuzz_keep_event ( blastmidi_event* event, uint16_t track_id, void* user_data )
+{
+    ( void ) track_id;
+    ( void ) user_data;
+    if ( event->data_size > 0 )
+    {
+        fuzz_checksum += event->data[0] + event->data[event->data_size - 1];
+    }
+    return 1;
+}
+
+static void fuzz_check_filter ( const uint8_t* data, size_t size, const blastmidi_limits* limits )
+{
+    fuzz_writer first;
+    fuzz_writer second;
+    blastmidi instance;
+    blastmidi_filter_stage stage;
+    memset ( ( void* ) &first, 0, sizeof ( fuzz_writer ) );
+    memset ( ( void* ) &second, 0, sizeof ( fuzz_writer ) );
+    stage.function = fuzz_keep_event;
+    stage.user_data = NULL;
+    blastmidi_initialize ( &instance, NULL, NULL );
+    blastmidi_set_limits ( &instance, limits );
+    blastmidi_set_data_callback ( &instance, fuzz_write_callback, &first );
+    if ( blastmidi_filter_memory ( &instance, data, size, &stage, 1 ) == BLASTMIDI_OK )
+    {
+        blastmidi_set_data_callback ( &instance, fuzz_write_callback, &second );
+        if ( blastmidi_filter_memory ( &instance, first.data, first.size, &stage, 1 ) != BLASTMIDI_OK )
+        {
+            abort();
+        }
+        if ( second.size != first.size || memcmp ( ( void* ) first.data, ( void* ) second.data, first.size ) != 0 )
+        {
+            abort();
+        }
+    }
+    blastmidi_free ( &instance );
+    free ( first.data );
+    free ( second.data );
+}
+
+/*
+* A fixed pitch bend message must decode to the bend amount that it encodes, with the first data byte as the lower 7 bits, both
+* when it is parsed and when the event is created directly. This is checked once, before the first input.
+*/
+static void fuzz_check_pitch_bend ( void )
+{
+    static const uint8_t file[] =
+    {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6, 0, 0, 0, 1, 0x01, 0xE0,
+        'M', 'T', 'r', 'k', 0, 0, 0, 8, 0, 0xE0, 0x01, 0x40, 0, 0xFF, 0x2F, 0
+    };
+    blastmidi instance;
+    blastmidi_event* event = NULL;
+    uint16_t bend = 0;
+    blastmidi_initialize ( &instance, NULL, NULL );
+    if ( blastmidi_read_memory ( &instance, file, sizeof ( file ) ) != BLASTMIDI_OK || blastmidi_get_first_event_on_track ( &instance, 0, &event ) != BLASTMIDI_OK || event == NULL )
+    {
+        abort();
+    }
+    memcpy ( ( void* ) &bend, ( void* ) event->data, sizeof ( uint16_t ) );
+    if ( event->subtype != BLASTMIDI_CHANNEL_PITCH_BEND || bend != 0x2001 )
+    {
+        abort();
+    }
+    if ( blastmidi_event_create_channel_event ( &instance, 0, BLASTMIDI_CHANNEL_PITCH_BEND, 0x7F, 0x00, &event ) != BLASTMIDI_OK )
+    {
+        abort();
+    }
+    memcpy ( ( void* ) &bend, ( void* ) event->data, sizeof ( uint16_t ) );
+    if ( bend != 0x007F )
+    {
+        abort();
+    }
+    blastmidi_event_free ( &instance, event );
+    blastmidi_free ( &instance );
+}
+
+int LLVMFuzzerTestOneInput ( const uint8_t* data, size_t size )
+{
+    static int checked = 0;
+    blastmidi instance;
+    blastmidi_limits limits;
+    fuzz_reader reader;
+    uint8_t memory_result = 0;
+    uint8_t callback_result = 0;
+    size_t memory_events = 0;
+    size_t callback_events = 0;
+
+    if ( !checked )
+    {
+        fuzz_check_pitch_bend();
+        checked = 1;
+    }
+    if ( size == 0 )
+    {
+        return 0;
+    }
+    limits.max_payload_size = FUZZ_MAX_PAYLOAD_SIZE;
+    limits.max_events = FUZZ_MAX_EVENTS;
+    limits.max_memory = FUZZ_MAX_MEMORY;
+
+    blastmidi_initialize ( &instance, NULL, NULL );
+    blastmidi_set_limits ( &instance, &limits );
+    memory_result = blastmidi_read_memory ( &instance, data, size );
+    if ( memory_result == BLASTMIDI_OK )
+    {
+        blastmidi_snapshot* snapshot = NULL;
+        memory_events = fuzz_walk ( &instance );
+        fuzz_check_write ( &instance, data, size, memory_events );
+        if ( blastmidi_freeze ( &instance, &snapshot ) == BLASTMIDI_OK )
+        {
+            const blastmidi_snapshot* loaded = NULL;
+            if ( snapshot->event_count != memory_events )
+            {
+                abort();
+            }
+
+            /*
+            * A fresh snapshot must always pass the checks of the loader.
+            */
+            if ( blastmidi_snapshot_load ( ( const uint8_t* ) snapshot, snapshot->size, &loaded ) != BLASTMIDI_OK || fuzz_walk_snapshot ( loaded ) != memory_events )
+            {
+                abort();
+            }
+            blastmidi_snapshot_free ( &instance, snapshot );
+        }
+    }
+
+    /*
+    * Parse the same input again through the callback, reusing the instance with recycling enabled.
+    */
+    reader.data = data;
+    reader.size = size;
+    reader.position = 0;
+    blastmidi_set_recycling ( &instance, 1 );
+    blastmidi_set_data_callback ( &instance, fuzz_callback, &reader );
+    callback_result = blastmidi_read ( &instance );
+    if ( callback_result == BLASTMIDI_OK )
+    {
+        callback_events = fuzz_walk ( &instance );
+    }
+    fuzz_check_edits ( &instance );
+
+    /*
+    * The memory path refuses payloads that run past the end of the buffer up front, while the callback path only notices when
+    * the read fails, so both must fail in that case but the error codes may differ.
+    */
+    if ( ( memory_result == BLASTMIDI_OK ) != ( callback_result == BLASTMIDI_OK ) || memory_events != callback_events )
+    {
+        abort();
+    }
+
+    /*
+    * A partial read skips to the end of every chunk by its size, where a full read follows the events, so on a malformed file the
+    * two may see different tracks. The partial read is thus only walked.
+    */
+    blastmidi_set_read_end ( &instance, 480, 1.0 );
+    if ( blastmidi_read_memory ( &instance, data, size ) == BLASTMIDI_OK )
+    {
+        fuzz_walk ( &instance );
+    }
+
+    /*
+    * The probe decodes the tracks in place from memory, and from a copy of every chunk through the callback, so both must give
+    * the same summary.
+    */
+    {
+        blastmidi_summary memory_summary;
+        blastmidi_summary callback_summary;
+        uint8_t memory_probe = blastmidi_probe_memory ( &instance, data, size, &memory_summary );
+        uint8_t callback_probe = 0;
+        reader.position = 0;
+        callback_probe = blastmidi_probe ( &instance, &callback_summary );
+        if ( ( memory_probe == BLASTMIDI_OK ) != ( callback_probe == BLASTMIDI_OK ) )
+        {
+            abort();
+        }
+        if ( memory_probe == BLASTMIDI_OK && memcmp ( ( void* ) &memory_summary, ( void* ) &callback_summary, sizeof ( blastmidi_summary ) ) != 0 )
+        {
+            abort();
+        }
+    }
+    blastmidi_free ( &instance );
+    fuzz_walk_cursors ( data, size );
+    fuzz_check_filter ( data, size, &limits );
+
+    /*
+    * The loader needs an aligned buffer, which the input is not guaranteed to be.
+    */
+    {
+        uint8_t* copy = ( uint8_t* ) malloc ( size );
+        const blastmidi_snapshot* loaded = NULL;
+        if ( copy )
+        {
+            memcpy ( copy, data, size );
+            if ( blastmidi_snapshot_load ( copy, size, &loaded ) == BLASTMIDI_OK )
+            {
+                fuzz_walk_snapshot ( loaded );
+            }
+            free ( copy );
+        }
+    }
+    return 0;
+}
+
+#ifdef BLASTMIDI_FUZZ_MAIN
+int main ( int argc, char** argv )
+{
+    FILE* input = stdin;
+    uint8_t* data = NULL;
+    size_t size = 0;
+    size_t capacity = 0;
+    size_t count = 0;
+
+    if ( argc > 1 )
+    {
+        input = fopen ( argv[1], "rb" );
+        if ( input == NULL )
+        {
+            fprintf ( stderr, "Could not open %s.\n", argv[1] );
+            return 1;
+        }
+    }
+    do
+    {
+        if ( size == capacity )
+        {
+            capacity = capacity ? capacity * 2 : 65536;
+            data = ( uint8_t* ) realloc ( data, capacity );
+            if ( data == NULL )
+            {
+                return 1;
+            }
+        }
+        count = fread ( data + size, 1, capacity - size, input );
+        size += count;
+    }
+    while ( count > 0 );
+    if ( input != stdin )
+    {
+        fclose ( input );
+    }
+    LLVMFuzzerTestOneInput ( data, size );
+    free ( data );
+    return 0;
+}
+#endif
@@ -33,7 +33,10 @@ enum blastmidi_errors
     BLASTMIDI_INCOMPLETECHUNK, /* The Midi file chunk ended unexpectedly */
     BLASTMIDI_UNEXPECTEDEND, /* The Midi file ended unexpectedly */
     BLASTMIDI_WRITINGFAILED, /* Writing failed */
-    BLASTMIDI_INVALID /* This is not a valid Midi file */
+    BLASTMIDI_INVALID, /* This is not a valid Midi file */
+    BLASTMIDI_FILEERROR, /* A file could not be opened or read */
+    BLASTMIDI_LIMITEXCEEDED, /* The Midi file exceeds one of the limits set with blastmidi_set_limits */
+    BLASTMIDI_BUFFERTOOSMALL /* The output buffer is too small */
 };
 
 /*
@@ -118,58 +121,236 @@ enum blastmidi_event_types
     BLASTMIDI_SYSEX_EVENT
 };
 
+/*
+* System exclusive event subtypes.
+* BLASTMIDI_SYSEX_NORMAL is an ordinary system exclusive message, or a part of one.
+* BLASTMIDI_SYSEX_ESCAPE is an escape event (stored in a Midi file as F7 without a preceding F0), whose data holds arbitrary
+* bytes that are meant to be sent as they are, such as real time or authorization messages.
+*/
+enum blastmidi_sysex_events
+{
+    BLASTMIDI_SYSEX_NORMAL = 0,
+    BLASTMIDI_SYSEX_ESCAPE = 0xF7
+};
+
+/*
+* The number of bytes in the inline payload buffer of a blastmidi_event.
+* This is chosen so that the structure has no padding on common 64 bit platforms, and is large enough to hold every channel
+* event, the tempo, time signature, key signature and SMPTE offset meta events, and short text meta events.
+*/
+#define BLASTMIDI_SMALL_POOL_SIZE 9
+
 /*
 * The blastmidi_event structure.
 * This structure represents a Midi event.
-* The track member indicates whether this event belongs to a track. If this is -1, the event has not yet been added to any track.
+* previous and next are pointers to the previous and the next event on the track, respectively.
+*
+* data is a pointer to the first data byte in the event, and data_size specifies the number of bytes present.
+* If data_size is 0, do not access data.
+*
 * time specifies the delta time in ticks where this event occurs.
+* The track member indicates whether this event belongs to a track. If this is -1, the event has not yet been added to any track.
 * type specifies the event type (Midi channel event, meta event or system exclusive event as listed in the enum above).
 * subtype specifies the type of the event in the given category if applicable.
 * If type is BLASTMIDI_META_EVENT, subtype corresponds to one of the values in the blastmidi_meta_events enum.
 * If type is BLASTMIDI_CHANNEL_EVENT, subtype corresponds to one of the values in the blastmidi_channel_events enum.
-* If type is BLASTMIDI_SYSEX_EVENT, subtype is not used.
+* If type is BLASTMIDI_SYSEX_EVENT, subtype corresponds to one of the values in the blastmidi_sysex_events enum.
 *
 * If type is BLASTMIDI_CHANNEL_EVENT, channel indicates the channel to which this event applies.
 * If type is BLASTMIDI_META_EVENT and subtype is BLASTMIDI_META_MIDI_CHANNEL_PREFIX, channel specifies the channel being referred to.
 * Otherwise, channel is not used.
 *
-* data is a pointer to the first data byte in the event, and data_size specifies the number of bytes present.
-* If data_size is 0, do not access data.
-*
 * If type is BLASTMIDI_CHANNEL_EVENT and subtype is BLASTMIDI_CHANNEL_PITCH_BEND, data should be interpreted as a
 * uint16_t (in native endian byte order) representing the bend amount.
 * The range is between 0 and 16383 (inclusive) where values below 8192 decrease the pitch, and values above increase it.
 *
 * end_of_sysex is only applicable when type is BLASTMIDI_SYSEX_EVENT.
+* The data of a system exclusive event includes neither the leading F0 nor the terminating F7.
 * System exclusive messages are sometimes split into several events if the amount of data is large.
 * end_of_sysex is nonzero if this is the final chunk of the given system exclusive data.
 * If all of the system exclusive data is contained in a single event, end_of_sysex is nonzero.
 * Otherwise, end_of_sysex is 0 for all the parts except the last one.
 *
-* small_pool is an array of two bytes which is used to store very short data buffers.
-* Since a lot of Midi events do not have more than two data bytes we can greatly reduce the number of allocations this way.
+* storage records where the data buffer lives, and is one of the values in the blastmidi_event_storage enum below.
+*
+* small_pool is an array of BLASTMIDI_SMALL_POOL_SIZE bytes which is used to store short data buffers.
+* Most Midi events fit in this array, so we can greatly reduce the number of allocations this way.
 * The data pointer above will refer to the first byte of small_pool if applicable.
 *
-* previous and next are pointers to the previous and the next event on the track, respectively.
+* The members are ordered from the largest to the smallest so that the compiler does not need to insert any padding.
+* On a typical 64 bit platform the structure occupies 48 bytes.
 *
 * Do not modify the members in this structure by hand, and do not access them before the structure has been populated by one of
 * the library functions.
 */
 typedef struct blastmidi_event
 {
-    int16_t track;
+    struct blastmidi_event* previous;
+    struct blastmidi_event* next;
+    uint8_t* data;
     uint32_t time;
+    uint32_t data_size;
+    int16_t track;
     uint8_t type;
     uint8_t subtype;
     int8_t channel;
-    uint8_t* data;
-    uint32_t data_size;
     uint8_t end_of_sysex;
-    uint8_t small_pool[2];
-    struct blastmidi_event* previous;
-    struct blastmidi_event* next;
+    uint8_t storage;
+    uint8_t small_pool[BLASTMIDI_SMALL_POOL_SIZE];
 } blastmidi_event;
 
+/*
+* Event data storage enum.
+* This enum lists the places where the data buffer of a blastmidi_event can live.
+*/
+enum blastmidi_event_storage
+{
+    BLASTMIDI_STORAGE_NONE = 0, /* The event has no data */
+    BLASTMIDI_STORAGE_INLINE, /* The data is held in the small_pool member of the event itself */
+    BLASTMIDI_STORAGE_HEAP, /* The data is held in a separate block owned by the event */
+    BLASTMIDI_STORAGE_SHARED, /* The data is held in an immutable buffer owned by an intern table, and must never be modified */
+    BLASTMIDI_STORAGE_POOLED /* The data is held in a separate block owned by the event, which a recycling instance reuses */
+};
+
+/*
+* The blastmidi_intern_stats structure.
+* This structure holds the statistics of an intern table.
+* entries is the number of distinct payloads currently held by the table, and bytes is the number of payload bytes they occupy.
+* references is the number of events that currently share one of these payloads.
+* lookups is the total number of payloads that have been looked up in the table, and hits is how many of them were already present.
+* bytes_saved is the total number of payload bytes that did not have to be allocated because of these hits.
+*/
+typedef struct blastmidi_intern_stats
+{
+    uint32_t entries;
+    size_t bytes;
+    size_t references;
+    size_t lookups;
+    size_t hits;
+    size_t bytes_saved;
+} blastmidi_intern_stats;
+
+/*
+* The blastmidi_intern_table structure.
+* You should never access the elements in this structure directly.
+* An intern table makes identical meta text payloads (track names, instrument names, lyrics, markers and so on) share a single
+* immutable buffer instead of each event holding its own copy. Only payloads that do not fit in the small_pool of an event are interned.
+* A table can be attached to one or several blastmidi instances with blastmidi_set_intern_table.
+* The table itself is not thread safe, so instances that share a table must not be used from different threads at the same time.
+* malloc_function and free_function are pointers to the memory allocation functions used for the table and its entries.
+* buckets is the hash table, which holds bucket_count chains of entries.
+* stats holds the statistics which are returned by blastmidi_intern_table_get_stats.
+*/
+typedef struct blastmidi_intern_table
+{
+    blastmidi_custom_malloc* malloc_function;
+    blastmidi_custom_free* free_function;
+    struct blastmidi_intern_entry** buckets;
+    uint32_t bucket_count;
+    blastmidi_intern_stats stats;
+} blastmidi_intern_table;
+
+/*
+* The number of payload size classes that a recycling blastmidi instance keeps free lists for.
+* The smallest class holds 16 bytes and every following class doubles in size, so the largest pooled payload is 4096 bytes.
+* Larger payloads are always given straight back to the allocator.
+*/
+#define BLASTMIDI_PAYLOAD_POOL_CLASSES 9
+
+/*
+* The blastmidi_stats structure.
+* This structure only exists when the library is built with BLASTMIDI_STATS defined. Without it, none of the instrumentation is
+* compiled in at all, so it costs nothing. BLASTMIDI_STATS must be defined the same way for the library and for all the code that
+* includes this header, since it changes the layout of the blastmidi structure.
+* All the values describe the most recent call to blastmidi_read or blastmidi_read_memory, together with any allocations and writes
+* made on the instance since then.
+* callbacks counts the invocations of the data callback, indexed by the values in the blastmidi_callback_actions enum.
+* No callbacks are made while reading from memory.
+* bytes_read is the number of bytes read from the file.
+* seeks_forward counts the skips over data that is not stored (such as unsupported meta events), and seeks_backward counts the
+* steps back that running status events require.
+* allocations and bytes_allocated count the calls made to malloc_function and the number of bytes they requested. The entries
+* and buckets that an attached intern table allocates for the instance are counted as well, although they are owned by the table.
+* Blocks that are taken from the recycling pools are not counted, since they do not involve the allocator.
+* events counts the events that were read, indexed by the values in the blastmidi_event_types enum.
+* header_time is the number of seconds spent reading the header chunk.
+* track_times holds track_time_count values, which are the numbers of seconds spent reading each track.
+* It is owned by the instance, and remains valid until the next read or until blastmidi_free is invoked.
+* track_time_capacity is the number of values that track_times has room for.
+*/
+#ifdef BLASTMIDI_STATS
+typedef struct blastmidi_stats
+{
+    size_t callbacks[3];
+    uint64_t bytes_read;
+    size_t seeks_forward;
+    size_t seeks_backward;
+    size_t allocations;
+    uint64_t bytes_allocated;
+    size_t events[4];
+    double header_time;
+    double* track_times;
+    uint16_t track_time_count;
+    uint16_t track_time_capacity;
+} blastmidi_stats;
+#endif
+
+/*
+* The blastmidi_limits structure.
+* This structure holds the resource limits that the parser enforces. A value of 0 means that there is no limit.
+* max_payload_size is the largest number of data bytes that a single meta or system exclusive event may have.
+* max_events is the largest number of events that a file may contain in total, including events that are not stored.
+* max_memory is the largest number of bytes that the parsed file may occupy, counting the event structures, their payloads and
+* the track arrays. While recycling is enabled, payloads count as the full size class that holds them.
+* All limits are checked before the corresponding memory is allocated, so a hostile file cannot make the parser allocate more than
+* the limits allow. Reading fails with BLASTMIDI_LIMITEXCEEDED as soon as a limit would be exceeded.
+*/
+typedef struct blastmidi_limits
+{
+    uint32_t max_payload_size;
+    uint32_t max_events;
+    size_t max_memory;
+} blastmidi_limits;
+
+/*
+* The blastmidi_read_mask structure.
+* This structure selects the events that the parser drops while reading, before any memory is allocated for them. Their data is
+* skipped over, and their delta times are added to the next event that is kept, so every kept event keeps its absolute time.
+* A zeroed mask drops nothing, which is the default.
+* meta_events has a bit for every meta event subtype: subtype n is dropped if bit n & 7 of meta_events[n >> 3] is set.
+* End of track events are never dropped.
+* controllers works the same way for controller numbers, and drops the controller events that set them.
+* channels is a bit mask where bit n stands for channel n, and drops every channel event on these channels.
+* event_types drops every event of a type, where the type is one of the values in the blastmidi_event_types enum and stands
+* for bit 1 << type. Dropping system exclusive events drops escape events as well.
+* channel_events drops channel events by subtype, where the subtype is one of the values in the blastmidi_channel_events enum
+* and stands for bit 1 << ( subtype - BLASTMIDI_CHANNEL_NOTE_OFF ).
+* An event is dropped if any of the masks selects it.
+*/
+typedef struct blastmidi_read_mask
+{
+    uint8_t meta_events[32];
+    uint8_t controllers[16];
+    uint16_t channels;
+    uint8_t event_types;
+    uint8_t channel_events;
+} blastmidi_read_mask;
+
+/*
+* The blastmidi_track_source structure.
+* This structure records where the encoded form of a track can be found, so that blastmidi_write_incremental can copy the track
+* instead of encoding it again.
+* offset and size describe the MTrk chunk of the track, including its 8 byte chunk header, within the bytes that the instance
+* was last read from or written to.
+* dirty is nonzero if the track has been modified since then, or if it has no such chunk at all.
+*/
+typedef struct blastmidi_track_source
+{
+    size_t offset;
+    size_t size;
+    uint8_t dirty;
+} blastmidi_track_source;
+
 /*
 * The blastmidi structure.
 * You should never access the elements in this structure directly.
@@ -192,8 +373,27 @@ typedef struct blastmidi_event
 * The number of items in the track_ends list is specified by chunk_count.
 * The next member of the blastmidi_event structures pointed to in this array should always be NULL.
 * cursor is an I/O cursor used by the parser.
+* memory and memory_size describe the buffer that is being parsed by blastmidi_read_memory. memory is NULL at all other times.
 * running_status holds the last received status byte in a Midi channel event, so that the status can be reused as needed.
 * sysex_continuation is a boolean flag which keeps track of whether a divided system exclusive message is being read.
+* recycle is a boolean flag which is set by blastmidi_set_recycling.
+* track_capacity is the number of elements that the tracks, track_ends and track_sources arrays can hold, which may exceed
+* track_count.
+* track_sources is an array holding the source chunk and the dirty state of each track.
+* event_pool is a list of free event structures linked through their next members, kept for reuse while recycle is set.
+* payload_pool holds one list of free payload blocks for each size class, kept for reuse while recycle is set.
+* intern_table is the intern table set by blastmidi_set_intern_table, or NULL if meta text payloads are not interned.
+* limits holds the resource limits set by blastmidi_set_limits, and read_mask holds the events to drop set by
+* blastmidi_set_read_mask. read_end_tick and read_end_seconds hold the read end set by blastmidi_set_read_end.
+* event_total and memory_total are the number of events and bytes that the file being read has used so far, and are checked
+* against limits.
+* stats holds the instrumentation counters, and is only present when the library is built with BLASTMIDI_STATS defined.
+*
+* Thread safety: a blastmidi instance is not synchronized in any way. The functions that only retrieve events
+* (blastmidi_get_first_event_on_track, blastmidi_get_last_event_on_track, blastmidi_get_next_event_on_track and
+* blastmidi_get_previous_event_on_track) do not modify the instance, so several threads may call them at the same time,
+* but only as long as no thread reads into, modifies or frees the instance meanwhile. Nothing prevents such a modification,
+* so if an instance is to be shared between threads it is safer to share a snapshot created with blastmidi_freeze instead.
 */
 typedef struct blastmidi
 {
@@ -212,8 +412,25 @@ typedef struct blastmidi
     blastmidi_event** tracks;
     blastmidi_event** track_ends;
     size_t cursor;
+    const uint8_t* memory;
+    size_t memory_size;
     uint8_t running_status;
     uint8_t sysex_continuation;
+    uint8_t recycle;
+    uint16_t track_capacity;
+    blastmidi_track_source* track_sources;
+    blastmidi_event* event_pool;
+    uint8_t* payload_pool[BLASTMIDI_PAYLOAD_POOL_CLASSES];
+    blastmidi_intern_table* intern_table;
+    blastmidi_limits limits;
+    blastmidi_read_mask read_mask;
+    double read_end_seconds;
+    uint32_t read_end_tick;
+    uint32_t event_total;
+    size_t memory_total;
+#ifdef BLASTMIDI_STATS
+    blastmidi_stats stats;
+#endif
 } blastmidi;
 
 /*
@@ -238,13 +455,228 @@ uint8_t blastmidi_initialize ( blastmidi* instance, blastmidi_custom_malloc* use
 */
 void blastmidi_set_data_callback ( blastmidi* instance, blastmidi_data_callback* callback, void* user_data );
 
+#ifdef BLASTMIDI_STATS
+/*
+*          void blastmidi_get_stats(blastmidi* instance, blastmidi_stats* stats);
+* Copies the statistics of the given instance into stats. This function only exists when BLASTMIDI_STATS is defined.
+*/
+void blastmidi_get_stats ( blastmidi* instance, blastmidi_stats* stats );
+#endif
+
+/*
+*          void blastmidi_set_recycling(blastmidi* instance, uint8_t enabled);
+* Enables or disables recycling for the given instance. Recycling is disabled by default.
+* When recycling is enabled, blastmidi_read keeps the track arrays of the previous file instead of freeing them,
+* and events that are freed (including all the events that blastmidi_read discards) are kept in internal pools together with
+* their payload storage. New events are then taken from these pools, so that an instance which parses file after file
+* makes almost no calls to the allocator once it has reached its steady state.
+* While recycling is enabled, payloads of up to 4096 bytes are allocated in power of two size classes, so that they can be reused
+* for payloads of other sizes. Their events have the storage BLASTMIDI_STORAGE_POOLED.
+* Disabling recycling gives all pooled memory back to the allocator. blastmidi_free always releases everything.
+*/
+void blastmidi_set_recycling ( blastmidi* instance, uint8_t enabled );
+
+/*
+*          uint8_t blastmidi_intern_table_initialize(blastmidi_intern_table* table, blastmidi_custom_malloc* user_malloc, blastmidi_custom_free* user_free);
+* This function should be invoked on each new instance of the blastmidi_intern_table structure that you instantiate.
+* The memory allocation functions follow the same rules as for blastmidi_initialize.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_intern_table_initialize ( blastmidi_intern_table* table, blastmidi_custom_malloc* user_malloc, blastmidi_custom_free* user_free );
+
+/*
+*          void blastmidi_intern_table_purge(blastmidi_intern_table* table);
+* Entries stay in the table when the last event that refers to them is freed, so that payloads which recur from file to file
+* do not have to be allocated again. This function frees all the entries that are no longer referred to by any event.
+*/
+void blastmidi_intern_table_purge ( blastmidi_intern_table* table );
+
+/*
+*          void blastmidi_intern_table_free(blastmidi_intern_table* table);
+* Frees all resources associated with the given table.
+* All the events that share payloads from this table must have been freed first, for example by calling blastmidi_free on every
+* instance that uses the table.
+*/
+void blastmidi_intern_table_free ( blastmidi_intern_table* table );
+
+/*
+*          void blastmidi_intern_table_get_stats(const blastmidi_intern_table* table, blastmidi_intern_stats* stats);
+* Copies the current statistics of the given table into stats.
+*/
+void blastmidi_intern_table_get_stats ( const blastmidi_intern_table* table, blastmidi_intern_stats* stats );
+
+/*
+*          void blastmidi_set_intern_table(blastmidi* instance, blastmidi_intern_table* table);
+* Associates an intern table with the given instance. If table is NULL, interning is disabled, which is the default.
+* From this point on, meta text events that are read by blastmidi_read or created by blastmidi_event_create_meta_data_event
+* share their payloads through the table. Events that have already been created are not affected.
+* The table must stay valid for as long as any event of the instance refers to it.
+*/
+void blastmidi_set_intern_table ( blastmidi* instance, blastmidi_intern_table* table );
+
+/*
+*          void blastmidi_set_limits(blastmidi* instance, const blastmidi_limits* limits);
+* Sets the resource limits that blastmidi_read and blastmidi_read_memory enforce on the given instance.
+* If limits is NULL, all limits are removed, which is the default.
+* Use limits when reading files that come from untrusted sources. Regardless of the limits, blastmidi_read_memory never
+* allocates a payload that is larger than the rest of the buffer.
+*/
+void blastmidi_set_limits ( blastmidi* instance, const blastmidi_limits* limits );
+
+/*
+*          void blastmidi_set_read_mask(blastmidi* instance, const blastmidi_read_mask* mask);
+* Sets the events that blastmidi_read and blastmidi_read_memory drop on the given instance, as described for the
+* blastmidi_read_mask structure. If mask is NULL, nothing is dropped, which is the default.
+* Dropped events still count towards the max_events limit, but their payloads are never allocated, so they do not count towards
+* max_payload_size or max_memory.
+* A track from which events were dropped no longer matches its chunk, so it is marked as dirty, and blastmidi_write_incremental
+* encodes it rather than copying the dropped events back.
+*/
+void blastmidi_set_read_mask ( blastmidi* instance, const blastmidi_read_mask* mask );
+
+/*
+*          void blastmidi_set_read_end(blastmidi* instance, uint32_t tick, double seconds);
+* Makes blastmidi_read and blastmidi_read_memory stop reading every track at the given point, for instance to load only the
+* beginning of each file for a preview. tick is the last absolute tick that is read, and seconds is the last time that is read.
+* A value of 0 means that there is no such limit, and passing 0 for both reads the whole file, which is the default.
+* Events after the read end are neither decoded nor stored. The rest of the track is skipped by its chunk size, so when reading
+* through the data callback it must support BLASTMIDI_CALLBACK_SEEK.
+* With ticks per beat, the time of an event depends on the tempo events before it. On the tracks of a type 1 file after the
+* first, the tempo map of the first track is used, as the standard requires. Every track of a type 0 or type 2 file is timed
+* with its own tempo events. Tempo events that are dropped by the read mask are still taken into account.
+* Tracks that are cut short are marked as dirty, so blastmidi_write_incremental encodes them.
+*/
+void blastmidi_set_read_end ( blastmidi* instance, uint32_t tick, double seconds );
+
 /*
 *          uint8_t blastmidi_read(blastmidi* instance)
 * Invoke this function to read a new Midi file stream.
+* Events that are not stored, such as unsupported meta events and the events dropped by the read mask, hand their delta times on
+* to the next event that is stored, so that every stored event keeps its absolute time.
 * The return value is one of the defined BlastMidi error codes.
 */
 uint8_t blastmidi_read ( blastmidi* instance );
 
+/*
+*          uint8_t blastmidi_read_memory(blastmidi* instance, const uint8_t* buffer, size_t size);
+* Reads a new Midi file which is already in memory. buffer points to the first byte of the file, and size is its size in bytes.
+* This works just like blastmidi_read, except that the bytes are taken straight from the buffer instead of going through the data
+* callback, which makes parsing considerably faster. The data callback is not used and does not need to be set.
+* All event data is copied into the instance, so the buffer does not need to be valid once this function returns.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_read_memory ( blastmidi* instance, const uint8_t* buffer, size_t size );
+
+/*
+* The blastmidi_summary structure.
+* This structure is filled in by blastmidi_probe and blastmidi_probe_memory, which describe a file without parsing it into an
+* instance.
+* duration is the playing time of the file in seconds, and length is the same in ticks. For a type 2 file these are the sums
+* over all the tracks, since its tracks are played one after the other. Otherwise they are taken from the longest track.
+* The end of a track is the time of its end of track event.
+* event_count is the number of events, not counting end of track events, and note_count is the number of note on events with
+* a velocity above 0.
+* file_type and track_count are taken from the header chunk.
+* channels is a bit mask where bit n is set if there is a channel event on channel n.
+* programs has a bit for every program that is selected by a program change: program n sets bit n & 7 of programs[n >> 3].
+* tempo is the initial tempo in microseconds per quarter note, or 500000 if the file sets none.
+* numerator and denominator are the initial time signature, where the denominator is a power of 2 as in the time signature
+* event, or 4 and 2 for 4/4 time if the file sets none.
+* key and scale are the initial key signature as in the key signature event, where key counts sharps if positive and flats if
+* negative, and scale is 0 for major and 1 for minor. They are 0 for C major if the file sets no key.
+* The initial value is the one with the earliest absolute time. Of several tempos at the same time, the last one in track order
+* wins, as in the tempo map that the duration is worked out from. Of several time or key signatures at the same time, the one
+* on the first track wins. In a type 2 file it is the first one found.
+*/
+typedef struct blastmidi_summary
+{
+    double duration;
+    uint64_t length;
+    uint64_t event_count;
+    uint64_t note_count;
+    uint32_t tempo;
+    uint16_t track_count;
+    uint16_t channels;
+    uint8_t programs[16];
+    uint8_t file_type;
+    uint8_t numerator;
+    uint8_t denominator;
+    int8_t key;
+    uint8_t scale;
+} blastmidi_summary;
+
+/*
+*          uint8_t blastmidi_probe(blastmidi* instance, blastmidi_summary* summary);
+* Reads a Midi file through the data callback, and fills in summary without storing a single event, for instance to index a
+* large collection of files. The file is read in one forward pass. The tracks are decoded one at a time with a blastmidi_cursor,
+* so the memory used is bounded by the largest track plus the tempo changes that are collected.
+* The duration takes every tempo change into account. In a type 0 or type 1 file the tempo changes on all the tracks make up
+* one tempo map, where the last one in track order wins if several fall on the same tick, as for blastmidi_freeze. Every track
+* of a type 2 file is timed with its own tempo changes. With SMPTE timing every tick stands for a fixed time.
+* The limits of the instance apply as for blastmidi_filter. The read mask and the read end do not.
+* Whatever file the instance held is freed, and the instance is left empty when this function returns.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_probe ( blastmidi* instance, blastmidi_summary* summary );
+
+/*
+*          uint8_t blastmidi_probe_memory(blastmidi* instance, const uint8_t* buffer, size_t size, blastmidi_summary* summary);
+* Works like blastmidi_probe, except that the file is read from buffer, which holds size bytes. The tracks are decoded in place,
+* so nothing is allocated but the list of tempo changes. The data callback is not used and does not need to be set.
+*/
+uint8_t blastmidi_probe_memory ( blastmidi* instance, const uint8_t* buffer, size_t size, blastmidi_summary* summary );
+
+/*
+*          uint8_t blastmidi_write(blastmidi* instance);
+* Writes the instance as a standard Midi file through the data callback, which is invoked with BLASTMIDI_CALLBACK_WRITE.
+* The header chunk is followed by one MTrk chunk for each track. Channel events use running status, and every track is ended
+* with an end of track meta event whether or not the track holds one.
+* Every chunk is encoded in memory first and handed to the callback in a single write.
+* BLASTMIDI_INVALID is returned if a delta time or a payload is too large to be stored in a Midi file, in which case nothing
+* has been written. BLASTMIDI_WRITINGFAILED is returned if the callback fails.
+* After a successful write all the tracks are clean, and their sources refer to the bytes that were just written.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_write ( blastmidi* instance );
+
+/*
+*          uint8_t blastmidi_write_incremental(blastmidi* instance, const uint8_t* source, size_t source_size);
+* Works like blastmidi_write, except that tracks which have not been modified are copied from source as they are, and only the
+* dirty tracks are encoded. The time a save takes is then proportional to the size of the edit rather than to the size of the file.
+* source must hold the bytes that the instance was last read from or written to, starting at the header chunk. source_size is
+* the number of bytes in source.
+* Since tracks are copied byte for byte, events that the parser skips (such as unknown meta events) survive on clean tracks.
+* A track is dirty if it has been changed by one of the library functions since it was read or written, or if it has been
+* marked with blastmidi_mark_track_dirty. Tracks that were created by blastmidi_split_by_channel are always dirty.
+* Every chunk that is to be copied is checked against source before anything is written, and BLASTMIDI_INVALIDPARAM is returned
+* if one of them does not fit in source or does not start with the expected chunk header.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_write_incremental ( blastmidi* instance, const uint8_t* source, size_t source_size );
+
+/*
+*          uint8_t blastmidi_encode_track(blastmidi* instance, uint16_t track_id, uint8_t* buffer, size_t capacity, size_t* size);
+* Encodes a single track as a complete MTrk chunk, including its 8 byte chunk header, exactly as blastmidi_write would write it.
+* size receives the number of bytes in the chunk. If buffer is NULL, nothing is written, so a first call with buffer set to NULL
+* gives the size of the buffer to allocate. If capacity is smaller than the chunk, nothing is written and
+* BLASTMIDI_BUFFERTOOSMALL is returned.
+* This function only reads the instance, so several threads may encode different tracks of the same instance at the same time,
+* as long as no thread modifies the instance meanwhile. blastmidi_batch_write in the batch API does this on a pool of threads.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_encode_track ( blastmidi* instance, uint16_t track_id, uint8_t* buffer, size_t capacity, size_t* size );
+
+/*
+*          uint8_t blastmidi_write_encoded(blastmidi* instance, const uint8_t* source, size_t source_size, const uint8_t* const* chunks, const size_t* chunk_sizes);
+* Works like blastmidi_write_incremental, or like blastmidi_write if source is NULL, except that the tracks which have to be
+* encoded are not encoded here. Their chunks are taken from chunks[track_id] and chunk_sizes[track_id] instead, which must
+* hold the output of blastmidi_encode_track for each of them. A track has to be encoded if source is NULL or if the dirty
+* member of its entry in track_sources is nonzero. The entries of the other tracks are not used, and may be NULL.
+* The header and every chunk are handed to the data callback in a single write each, in track order.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_write_encoded ( blastmidi* instance, const uint8_t* source, size_t source_size, const uint8_t* const* chunks, const size_t* chunk_sizes );
+
 /*
 * void blastmidi_whipe_track(blastmidi* instance, unsigned int track);
 * Removes all events from the given track. The track number starts at 0.
@@ -252,6 +684,14 @@ uint8_t blastmidi_read ( blastmidi* instance );
 */
 void blastmidi_whipe_track ( blastmidi* instance, unsigned int track );
 
+/*
+*          uint8_t blastmidi_mark_track_dirty(blastmidi* instance, uint16_t track_id);
+* Marks the given track as modified, so that blastmidi_write_incremental encodes it again instead of copying it.
+* The library functions that change a track do this by themselves. Call this function if you have changed the data of an event
+* on the track directly.
+*/
+uint8_t blastmidi_mark_track_dirty ( blastmidi* instance, uint16_t track_id );
+
 /*
 *         void blastmidi_free(blastmidi* instance);
 * Frees all resources associated with the given instance.
@@ -261,6 +701,9 @@ void blastmidi_free ( blastmidi* instance );
 /*
 * uint8_t blastmidi_event_create_channel_event(blastmidi* instance, uint8_t channel, uint8_t subtype, uint8_t param_1, uint8_t param_2, blastmidi_event** event);
 * Creates a Midi channel event. Depending on the event, param_1 and param_2 may or may not be used.
+* param_1 and param_2 are the data bytes in the order in which they appear in a Midi message. For a pitch bend event,
+* param_1 thus holds the lower 7 bits of the bend amount and param_2 the upper 7 bits. Older versions of BlastMidi combined
+* them the other way around, so the pitch bend of parsed files came out with the two halves swapped.
 * After a successful call to this function, event points to an initialized blastmidi_event structure representing the new event.
 */
 uint8_t blastmidi_event_create_channel_event ( blastmidi* instance, uint8_t channel, uint8_t subtype, uint8_t param_1, uint8_t param_2, blastmidi_event** event );
@@ -286,6 +729,7 @@ uint8_t blastmidi_event_create_meta_tempo_event ( blastmidi* instance, uint32_t
 * BLASTMIDI_META_INSTRUMENT_NAME, BLASTMIDI_META_LYRICS, BLASTMIDI_META_MARKER, BLASTMIDI_META_CUE_POINT
 * or BLASTMIDI_META_SEQUENCER_SPECIFIC.
 * The contents of data is copied into internal storage, so the memory does not need to be valid once this function returns.
+* If the instance has an intern table, the new event may share its payload with other events (see blastmidi_set_intern_table).
 * After a successful call to this function, event points to an initialized blastmidi_event structure representing the new event.
 */
 uint8_t blastmidi_event_create_meta_data_event ( blastmidi* instance, uint8_t subtype, uint8_t* data, unsigned int data_size, blastmidi_event** event );
@@ -417,6 +861,261 @@ uint8_t blastmidi_get_previous_event_on_track ( blastmidi* instance, blastmidi_e
 */
 uint8_t blastmidi_remove_event_from_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event );
 
+/*
+* uint8_t blastmidi_merge_tracks(blastmidi* instance);
+* Merges all the tracks of the given instance into a single track, which turns a type 1 file into a type 0 file.
+* The events are interleaved by their absolute time, and events that occur at the same time are taken in track order.
+* The delta times are recomputed, and the existing events are relinked rather than copied, so no event is allocated or moved
+* in memory. Pointers to events therefore stay valid, although their track and time members change.
+* End of track events are dropped, except for the latest one which is moved to the end of the merged track.
+* The merge takes O(n log k) time for n events on k tracks.
+* Type 2 files consist of independent sequences, so they cannot be merged and BLASTMIDI_INVALIDPARAM is returned.
+*/
+uint8_t blastmidi_merge_tracks ( blastmidi* instance );
+
+/*
+* uint8_t blastmidi_split_by_channel(blastmidi* instance, uint16_t track_id);
+* Splits the given track by channel, which turns a type 0 file into a type 1 file.
+* The channel events of every channel that the track uses are moved to a new track, and the new tracks are appended after
+* the existing ones in channel order. The meta and sysex events stay on track_id, which thus becomes the conductor track.
+* As with blastmidi_merge_tracks, the existing events are relinked rather than copied, and their delta times are recomputed
+* so that every event keeps its absolute time. The track arrays are grown as needed.
+* The file type is set to 1. Type 2 files are not supported, and BLASTMIDI_INVALIDPARAM is returned for them.
+*/
+uint8_t blastmidi_split_by_channel ( blastmidi* instance, uint16_t track_id );
+
+/*
+* The blastmidi_transform structure.
+* A transform describes an edit that is applied to every channel event of a track or a file in a single pass.
+* It consists of lookup tables, so that any curve or mapping can be expressed and applying it costs the same regardless.
+* note_map maps note numbers, and is applied to the note off, note on and note aftertouch events of the channels in note_channels.
+* note_channels is a bit mask where bit n stands for channel n, so that for instance the drum channel can be left alone.
+* velocity_map maps the velocities of note on events. Note on events with a velocity of 0 are note offs, and are left unchanged.
+* controller_map maps controller numbers.
+* channel_map maps channels, and is applied last. The other tables are thus indexed by the original channel.
+* Use blastmidi_transform_initialize to set all the tables to the identity, and then change what you need. Every entry
+* of note_map, velocity_map and controller_map must be below 128, and every entry of channel_map below 16.
+*/
+typedef struct blastmidi_transform
+{
+    uint8_t note_map[128];
+    uint8_t velocity_map[128];
+    uint8_t controller_map[128];
+    uint8_t channel_map[16];
+    uint16_t note_channels;
+} blastmidi_transform;
+
+/*
+* Pass this as the track to blastmidi_apply_transform to transform all the tracks.
+*/
+#define BLASTMIDI_ALL_TRACKS 65535
+
+/*
+* void blastmidi_transform_initialize(blastmidi_transform* transform);
+* Sets all the tables of the given transform to the identity, and selects all channels in note_channels.
+*/
+void blastmidi_transform_initialize ( blastmidi_transform* transform );
+
+/*
+* void blastmidi_transform_set_transpose(blastmidi_transform* transform, int semitones);
+* Fills note_map so that notes are shifted by the given number of semitones. Notes that would fall outside the range
+* 0 to 127 are clamped to it.
+*/
+void blastmidi_transform_set_transpose ( blastmidi_transform* transform, int semitones );
+
+/*
+* void blastmidi_transform_set_velocity_scale(blastmidi_transform* transform, double scale);
+* Fills velocity_map so that velocities are multiplied by scale and rounded. The results are clamped to the range 1 to 127,
+* so that a scaled note on never turns into a note off.
+*/
+void blastmidi_transform_set_velocity_scale ( blastmidi_transform* transform, double scale );
+
+/*
+* uint8_t blastmidi_apply_transform(blastmidi* instance, uint16_t track_id, const blastmidi_transform* transform);
+* Applies the given transform in place to every channel event on the given track, or on all the tracks if track_id
+* is BLASTMIDI_ALL_TRACKS. Meta and system exclusive events are not touched.
+*/
+uint8_t blastmidi_apply_transform ( blastmidi* instance, uint16_t track_id, const blastmidi_transform* transform );
+
+/*
+* uint8_t blastmidi_quantize(blastmidi* instance, uint16_t track_id, uint32_t grid_ticks, double strength, double swing);
+* Moves the note on and note off events on the given track, or on all the tracks if track_id is BLASTMIDI_ALL_TRACKS,
+* towards the nearest line of a grid.
+* grid_ticks is the distance between two grid lines, in ticks. For instance, with 480 ticks per beat a grid of 120 ticks
+* quantizes to sixteenth notes.
+* strength ranges from 0 to 1, and is the fraction of the distance to the grid line by which every note is moved.
+* swing ranges from 0 up to but not including 1, and delays every second grid line by that fraction of grid_ticks.
+* A swing of one third gives a triplet feel, and 0 gives a straight grid. Any other strength or swing, including NaN, gives
+* BLASTMIDI_INVALIDPARAM.
+* All other events keep their time. Events which end up out of order are sorted again, and events that end up at the same
+* tick keep their original order. The delta times are then rewritten, so the whole operation takes O(n log n) time.
+*/
+uint8_t blastmidi_quantize ( blastmidi* instance, uint16_t track_id, uint32_t grid_ticks, double strength, double swing );
+
+/*
+* uint8_t blastmidi_delete_range(blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end);
+* Removes and frees all the events whose absolute time lies in the range from start up to but not including end, on the given
+* track or on all the tracks if track_id is BLASTMIDI_ALL_TRACKS. The remaining events keep their absolute time, so the range
+* is left empty. End of track events are kept.
+* Every track is walked once, regardless of how many events are removed.
+*/
+uint8_t blastmidi_delete_range ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end );
+
+/*
+* uint8_t blastmidi_cut_range(blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end);
+* Works like blastmidi_delete_range, but the events from end onwards are moved back by end - start ticks, so that the range
+* is closed up. End of track events that were in the range move to start.
+*/
+uint8_t blastmidi_cut_range ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end );
+
+/*
+* uint8_t blastmidi_insert_silence(blastmidi* instance, uint16_t track_id, uint32_t tick, uint32_t length);
+* Moves all the events at or after the absolute time tick forward by length ticks, on the given track or on all the tracks
+* if track_id is BLASTMIDI_ALL_TRACKS.
+* If this would move an event past the largest representable time, nothing is changed and BLASTMIDI_INVALIDPARAM is returned.
+*/
+uint8_t blastmidi_insert_silence ( blastmidi* instance, uint16_t track_id, uint32_t tick, uint32_t length );
+
+/*
+* uint8_t blastmidi_insert_event_at_tick(blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t tick);
+* This function associates the given Midi event with a particular track in a blastmidi instance, like blastmidi_add_event.
+* Note that the blastmidi instance takes ownership of the event after this point, so the event should not be freed manually.
+* Rather than a neighbour and a delta time, tick is the absolute time of the new event, counted from the beginning of the track.
+* The event is inserted after all the events at or before that time, and the delta times of both the new event and the event
+* following it are set so that no other event changes its absolute time.
+* The track has no index by time, so finding the position takes a walk from the beginning of the track.
+* To insert many events, use blastmidi_insert_events_at_ticks instead.
+*/
+uint8_t blastmidi_insert_event_at_tick ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t tick );
+
+/*
+* uint8_t blastmidi_insert_events_at_ticks(blastmidi* instance, uint16_t track_id, blastmidi_event** events, const uint32_t* ticks, size_t count);
+* Inserts count events at once, where ticks[i] is the absolute time of events[i]. The arrays need not be sorted.
+* The events are sorted by time and then merged into the track in a single pass, so this takes O(n + m log m) time for
+* m new events on a track of n events, rather than O(n * m) for inserting them one by one.
+* Events at the same time keep their order: events that were already on the track come first, followed by the new events
+* in the order in which they appear in the array.
+* Either all the events are inserted or none of them are. BLASTMIDI_ALREADYADDED is returned if any of them already belongs
+* to a track, or appears more than once in the array.
+*/
+uint8_t blastmidi_insert_events_at_ticks ( blastmidi* instance, uint16_t track_id, blastmidi_event** events, const uint32_t* ticks, size_t count );
+
+/*
+* The blastmidi_filter_function type.
+* A stage of the streaming filter pipeline, which is invoked once for every event of the file as it passes through.
+* The parameters are the event, the index of the track that it is on, and the user_data of the stage.
+* Return nonzero to keep the event, or 0 to drop it. The event may also be changed in place before it is kept. See
+* blastmidi_filter for the details.
+*/
+typedef int blastmidi_filter_function ( blastmidi_event*, uint16_t, void* );
+
+/*
+* The blastmidi_filter_stage structure.
+* function is the stage, and user_data is passed to it with every event.
+*/
+typedef struct blastmidi_filter_stage
+{
+    blastmidi_filter_function* function;
+    void* user_data;
+} blastmidi_filter_stage;
+
+/*
+* uint8_t blastmidi_filter(blastmidi* instance, const blastmidi_filter_stage* stages, size_t stage_count);
+* Reads a Midi file through the data callback and writes a filtered copy of it through the same callback, which must thus handle
+* both BLASTMIDI_CALLBACK_READ and BLASTMIDI_CALLBACK_WRITE. Every event is passed through the stages in array order, and is
+* written only if all of them keep it. A stage that drops an event ends the pipeline for that event, so several cheap stages
+* cost no more than a single stage that does all the work.
+* The file is never parsed into an instance. The tracks are filtered one at a time, and only the track that is being filtered
+* is held in memory, once as read and once as encoded, so the memory used is bounded by the largest track rather than by the
+* size of the file. The header is written before the first track is read, and every track is written as soon as it is done.
+* If an error occurs, the output written so far is thus incomplete.
+*
+* The event that a stage is given is decoded by a blastmidi_cursor, and is only valid during the call. It is not on a track, so its previous
+* and next members are NULL. Its time is the delta time since the last event that was kept on the same track, so the time of a
+* dropped event is carried over to the next one and every kept event keeps its absolute time.
+* The members have the same meaning as for a parsed file. Meta events that the parser skips, such as the SMPTE offset, are
+* passed through with their raw payload. End of track events are not passed to the stages, and one is always written at the end
+* of every track.
+* A stage may change the time, the channel, the subtype and the data of an event. Data with storage BLASTMIDI_STORAGE_INLINE
+* may be modified in place. Data with storage BLASTMIDI_STORAGE_SHARED refers to the input and must not be modified, but a stage
+* can point data at a buffer of its own instead, which must stay valid until the stage is called with the next event.
+*
+* The limits of the instance apply: max_payload_size to every payload, max_events to the number of events passed to the stages,
+* and max_memory to the buffers that hold the tracks.
+* Whatever file the instance held is freed, and the instance is left empty when this function returns.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_filter ( blastmidi* instance, const blastmidi_filter_stage* stages, size_t stage_count );
+
+/*
+* uint8_t blastmidi_filter_memory(blastmidi* instance, const uint8_t* buffer, size_t size, const blastmidi_filter_stage* stages, size_t stage_count);
+* Works like blastmidi_filter, except that the file is read from buffer, which holds size bytes, and the data callback is only
+* used for writing. The tracks are decoded in place, so only the output of one track is held in memory.
+*/
+uint8_t blastmidi_filter_memory ( blastmidi* instance, const uint8_t* buffer, size_t size, const blastmidi_filter_stage* stages, size_t stage_count );
+
+/*
+* int blastmidi_filter_transform(blastmidi_event* event, uint16_t track_id, void* user_data);
+* A filter stage which applies the blastmidi_transform that user_data points to, in the same way as blastmidi_apply_transform.
+* It keeps every event.
+*/
+int blastmidi_filter_transform ( blastmidi_event* event, uint16_t track_id, void* user_data );
+
+/*
+* The blastmidi_cursor structure.
+* A cursor decodes the events of a single track chunk one at a time, straight from the bytes of the chunk, as an alternative to
+* parsing the whole file into an instance. It holds the event that was decoded last and the running status and system exclusive
+* state of the track, and refers to no instance, so any number of cursors may walk the same track or different tracks at the
+* same time, on any threads, as long as the bytes stay valid and unchanged. Nothing is ever allocated.
+* Set it up with blastmidi_cursor_initialize or blastmidi_cursor_find_track.
+* event is the event that was decoded last. data, size and position are the bytes of the chunk, their number and the offset of
+* the next event. tick is the absolute time of the last event in ticks, and once the end of the track has been reached, that of
+* the end of track event. max_payload_size is the largest payload that is accepted, or 0 for no limit, and may be set after
+* the cursor has been set up. running_status and sysex_continuation are the decoding state of the track, and end_of_track is
+* set once the end of track event has been decoded.
+*/
+typedef struct blastmidi_cursor
+{
+    blastmidi_event event;
+    const uint8_t* data;
+    size_t size;
+    size_t position;
+    uint64_t tick;
+    uint32_t max_payload_size;
+    uint8_t running_status;
+    uint8_t sysex_continuation;
+    uint8_t end_of_track;
+} blastmidi_cursor;
+
+/*
+*          void blastmidi_cursor_initialize(blastmidi_cursor* cursor, const uint8_t* data, size_t size);
+* Sets up a cursor at the start of a track, where data points to the contents of an MTrk chunk, just after the chunk header,
+* and size is the chunk size.
+*/
+void blastmidi_cursor_initialize ( blastmidi_cursor* cursor, const uint8_t* data, size_t size );
+
+/*
+*          uint8_t blastmidi_cursor_find_track(blastmidi_cursor* cursor, const uint8_t* buffer, size_t size, uint16_t track_id);
+* Sets up a cursor at the start of the given track of a Midi file which is in memory. buffer points to the first byte of the
+* file, and size is its size in bytes. track_id starts at 0.
+* Only the header chunk and the chunk headers before the track are looked at. BLASTMIDI_INVALIDPARAM is returned if the file
+* has no such track.
+*/
+uint8_t blastmidi_cursor_find_track ( blastmidi_cursor* cursor, const uint8_t* buffer, size_t size, uint16_t track_id );
+
+/*
+*          uint8_t blastmidi_cursor_next(blastmidi_cursor* cursor, blastmidi_event** event);
+* Decodes the next event of the track, and makes event point to it. At the end of the track, event is set to NULL.
+* The event has the same members as one on a track of a parsed file, and lives in the cursor until the next call. It is not
+* on a track, so its previous and next members are NULL. Payloads of up to the size of its small_pool are copied into the
+* event, with storage BLASTMIDI_STORAGE_INLINE. Larger ones refer to the chunk itself, with storage BLASTMIDI_STORAGE_SHARED.
+* Meta events that the parser skips, such as the SMPTE offset, are decoded with their raw payload. End of track events and
+* empty system exclusive packets are not returned, and the delta times of the packets are added to the next event.
+* If the track is malformed, an error code is returned and event is set to NULL.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_cursor_next ( blastmidi_cursor* cursor, blastmidi_event** event );
+
 /*
 *         void blastmidi_event_free(blastmidi* instance, blastmidi_event* event);
 * Frees all resources associated with the given event.
@@ -428,4 +1127,167 @@ uint8_t blastmidi_remove_event_from_track ( blastmidi* instance, uint16_t track_
 */
 void blastmidi_event_free ( blastmidi* instance, blastmidi_event* event );
 
+/*
+* The blastmidi_snapshot_event structure.
+* This structure represents a Midi event in a snapshot.
+* time is the delta time in ticks from the previous event on the track, and tick is the absolute time in ticks from the
+* beginning of the track.
+* data_offset is the position of the first data byte relative to the payload area of the snapshot, and data_size is the number
+* of data bytes. Use blastmidi_snapshot_get_event_data to get a pointer to the data.
+* type, subtype, channel and end_of_sysex have the same meaning as in the blastmidi_event structure.
+*/
+typedef struct blastmidi_snapshot_event
+{
+    uint32_t time;
+    uint32_t tick;
+    uint32_t data_offset;
+    uint32_t data_size;
+    uint8_t type;
+    uint8_t subtype;
+    int8_t channel;
+    uint8_t end_of_sysex;
+} blastmidi_snapshot_event;
+
+/*
+* The blastmidi_snapshot_track structure.
+* first_event is the index of the first event of the track in the event array of the snapshot, and event_count is the number of
+* events on the track. length is the absolute time in ticks of the last event on the track.
+*/
+typedef struct blastmidi_snapshot_track
+{
+    uint32_t first_event;
+    uint32_t event_count;
+    uint32_t length;
+} blastmidi_snapshot_track;
+
+/*
+* The blastmidi_snapshot_tempo structure.
+* An entry in the tempo map of a snapshot, which records a change of tempo.
+* microseconds is the absolute time of the change, tick is its absolute time in ticks, and tempo is the new tempo
+* in microseconds per quarter note.
+*/
+typedef struct blastmidi_snapshot_tempo
+{
+    uint64_t microseconds;
+    uint32_t tick;
+    uint32_t tempo;
+} blastmidi_snapshot_tempo;
+
+/*
+* The blastmidi_snapshot structure.
+* A snapshot is an immutable copy of the contents of a blastmidi instance, created by blastmidi_freeze.
+* It lives in a single contiguous block of memory which starts with this structure, followed by a blastmidi_snapshot_track
+* array, a blastmidi_snapshot_event array, the payload area and optionally a blastmidi_snapshot_tempo array.
+* All references inside the block are offsets from its start, so the block contains no pointers at all. It can therefore
+* be saved with blastmidi_snapshot_save as it is, and used again straight from memory with blastmidi_snapshot_load.
+* Since nothing can modify a snapshot once it has been created, any number of threads may read it at the same time without
+* synchronization. None of the snapshot functions modify it, and there are no functions to add or remove events.
+* You should never access the elements in this structure directly. Use the blastmidi_snapshot functions instead.
+* magic always holds the characters BMSS, and version is the version of the layout (BLASTMIDI_SNAPSHOT_VERSION).
+* endian_flag is the endian_flag of the instance that created the snapshot.
+* file_type, time_type, SMPTE_frames, ticks_per_frame, ticks_per_beat and track_count are copied from the instance.
+* size is the total number of bytes in the snapshot.
+* tracks_offset, events_offset and data_offset are the positions of the track array, the event array and the payload area.
+* event_count is the total number of events on all tracks, and data_size is the number of bytes in the payload area.
+* tempo_offset is the position of the tempo map, and tempo_count is the number of entries in it, or 0 if there is no tempo map.
+*/
+#define BLASTMIDI_SNAPSHOT_VERSION 2
+
+typedef struct blastmidi_snapshot
+{
+    uint8_t magic[4];
+    uint16_t version;
+    uint8_t endian_flag;
+    uint8_t file_type;
+    uint8_t time_type;
+    uint8_t SMPTE_frames;
+    uint8_t ticks_per_frame;
+    uint8_t reserved;
+    uint16_t ticks_per_beat;
+    uint16_t track_count;
+    uint32_t size;
+    uint32_t tracks_offset;
+    uint32_t events_offset;
+    uint32_t data_offset;
+    uint32_t event_count;
+    uint32_t data_size;
+    uint32_t tempo_offset;
+    uint32_t tempo_count;
+} blastmidi_snapshot;
+
+/*
+*          uint8_t blastmidi_freeze(blastmidi* instance, blastmidi_snapshot** snapshot);
+* Creates an immutable snapshot of all the tracks in the given instance.
+* The snapshot is allocated as a single block with the memory allocation functions of the instance, and is independent of the
+* instance afterwards; the instance may be modified, read into or freed without affecting the snapshot.
+* After a successful call to this function, snapshot points to the new snapshot.
+* If the file measures time in ticks per beat and is not a type 2 file, the snapshot also gets a tempo map which is built
+* from the set tempo events on all the tracks. The map always starts at tick 0, with the default tempo of 500000
+* microseconds per quarter note if the file does not set one there.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_freeze ( blastmidi* instance, blastmidi_snapshot** snapshot );
+
+/*
+*          void blastmidi_snapshot_free(blastmidi* instance, blastmidi_snapshot* snapshot);
+* Frees a snapshot created by blastmidi_freeze.
+* instance must use the same memory allocation functions as the instance that created the snapshot.
+* Do not call this function for snapshots obtained from blastmidi_snapshot_load, since those live in memory owned by the caller.
+*/
+void blastmidi_snapshot_free ( blastmidi* instance, blastmidi_snapshot* snapshot );
+
+/*
+*          uint8_t blastmidi_snapshot_save(blastmidi* instance, const blastmidi_snapshot* snapshot);
+* Writes the given snapshot through the data callback of instance, which is invoked with BLASTMIDI_CALLBACK_WRITE.
+* The snapshot is written exactly as it lies in memory, so this is a single write of snapshot->size bytes.
+* The format depends on the byte order of the platform, and blastmidi_snapshot_load refuses snapshots of the other byte order.
+*/
+uint8_t blastmidi_snapshot_save ( blastmidi* instance, const blastmidi_snapshot* snapshot );
+
+/*
+*          uint8_t blastmidi_snapshot_load(const uint8_t* buffer, size_t size, const blastmidi_snapshot** snapshot);
+* Makes a snapshot which was saved with blastmidi_snapshot_save available again, straight from the given buffer.
+* Nothing is parsed, copied or allocated; the buffer is only checked, so that a corrupt or truncated snapshot cannot cause
+* reads outside of it. This takes a single pass over the track and event arrays. A memory mapped file works just as well as
+* any other buffer, as long as it starts on an 8 byte boundary.
+* After a successful call to this function, snapshot points into buffer, and can be used with all the other snapshot
+* functions for as long as buffer remains valid and unchanged.
+* BLASTMIDI_INVALID is returned if the buffer does not hold a valid snapshot of the current version and the byte order of
+* this platform. In that case, parse the original Midi file again and save a new snapshot.
+*/
+uint8_t blastmidi_snapshot_load ( const uint8_t* buffer, size_t size, const blastmidi_snapshot** snapshot );
+
+/*
+*          uint8_t blastmidi_snapshot_get_track(const blastmidi_snapshot* snapshot, uint16_t track_id, const blastmidi_snapshot_track** track);
+* Retrieves the description of the given track. track_id starts at 0.
+*/
+uint8_t blastmidi_snapshot_get_track ( const blastmidi_snapshot* snapshot, uint16_t track_id, const blastmidi_snapshot_track** track );
+
+/*
+*          uint8_t blastmidi_snapshot_get_event(const blastmidi_snapshot* snapshot, uint16_t track_id, uint32_t index, const blastmidi_snapshot_event** event);
+* Retrieves an event from the given track. track_id starts at 0, and index is the position of the event on the track, starting at 0.
+* The events of a track are stored consecutively, so the following events can also be reached by incrementing the returned pointer.
+*/
+uint8_t blastmidi_snapshot_get_event ( const blastmidi_snapshot* snapshot, uint16_t track_id, uint32_t index, const blastmidi_snapshot_event** event );
+
+/*
+*          const uint8_t* blastmidi_snapshot_get_event_data(const blastmidi_snapshot* snapshot, const blastmidi_snapshot_event* event);
+* Returns a pointer to the first data byte of an event in the given snapshot, or NULL if the event has no data.
+*/
+const uint8_t* blastmidi_snapshot_get_event_data ( const blastmidi_snapshot* snapshot, const blastmidi_snapshot_event* event );
+
+/*
+*          uint8_t blastmidi_snapshot_get_tempo(const blastmidi_snapshot* snapshot, uint32_t index, const blastmidi_snapshot_tempo** tempo);
+* Retrieves an entry from the tempo map of the given snapshot. index starts at 0, and the entries are sorted by time.
+* The number of entries is snapshot->tempo_count.
+*/
+uint8_t blastmidi_snapshot_get_tempo ( const blastmidi_snapshot* snapshot, uint32_t index, const blastmidi_snapshot_tempo** tempo );
+
+/*
+*          uint8_t blastmidi_snapshot_get_time(const blastmidi_snapshot* snapshot, uint32_t tick, uint64_t* microseconds);
+* Converts an absolute time in ticks into microseconds, using the tempo map of the given snapshot.
+* This takes O(log n) time for a tempo map of n entries. BLASTMIDI_INVALIDPARAM is returned if the snapshot has no tempo map.
+*/
+uint8_t blastmidi_snapshot_get_time ( const blastmidi_snapshot* snapshot, uint32_t tick, uint64_t* microseconds );
+
 #endif /* BLASTMIDI_H */
@@ -0,0 +1,91 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_batch.h
+* The optional batch API, which parses large numbers of Midi files on a pool of threads, and writes files with many tracks
+* by encoding the tracks in parallel.
+* This part of the library needs the platform thread API (Win32 threads on Windows and POSIX threads elsewhere),
+* so it lives in its own file. Add blastmidi_batch.c to your project only if you need it.
+*/
+
+#ifndef BLASTMIDI_BATCH_H
+#define BLASTMIDI_BATCH_H
+
+#include "blastmidi.h"
+
+/*
+* The blastmidi_batch_handler function.
+* This function is invoked once for every file in the batch, on the worker thread that parsed it.
+* The first parameter is the blastmidi instance of the worker. If the third parameter is BLASTMIDI_OK, it holds the parsed file.
+* The instance is reused for the next file on the same worker, so do not free it and do not keep pointers to its events.
+* If you need the file after the handler returns, use blastmidi_freeze.
+* The second parameter is the path of the file.
+* The third parameter is the result of parsing the file, which is one of the defined BlastMidi error codes.
+* BLASTMIDI_FILEERROR means that the file could not be opened or read.
+* The fourth parameter is the index of the worker thread, starting at 0. Handlers can use it to keep per worker state without locking.
+* The fifth parameter is the user controlled void* pointer which was passed to blastmidi_batch_read.
+* Handlers are called concurrently from all the workers, so any state that they share must be synchronized by the handler.
+* The handler should return nonzero to continue, or 0 to stop the batch. Files that have not been started yet are then skipped.
+*/
+typedef int blastmidi_batch_handler ( blastmidi*, const char*, uint8_t, unsigned int, void* );
+
+/*
+* The blastmidi_batch_stats structure.
+* files is the number of files that were processed, and failed is how many of them could not be read or parsed.
+* bytes is the total size of the processed files.
+* seconds is the wall clock time that the batch took.
+* files_per_second and megabytes_per_second are the resulting throughput, where a megabyte is 1048576 bytes.
+*/
+typedef struct blastmidi_batch_stats
+{
+    size_t files;
+    size_t failed;
+    uint64_t bytes;
+    double seconds;
+    double files_per_second;
+    double megabytes_per_second;
+} blastmidi_batch_stats;
+
+/*
+*          unsigned int blastmidi_batch_get_cpu_count();
+* Returns the number of processors that are available, or 1 if this cannot be determined.
+*/
+unsigned int blastmidi_batch_get_cpu_count ( void );
+
+/*
+*          uint8_t blastmidi_batch_read(const char* const* paths, size_t path_count, unsigned int worker_count, blastmidi_batch_handler* handler, void* user_data, blastmidi_batch_stats* stats);
+* Parses all the given files on a pool of worker threads, and invokes handler for each of them.
+* paths is an array of path_count file paths.
+* worker_count is the number of threads to use. If it is 0, one thread per processor is used.
+* Each worker owns one blastmidi instance with recycling enabled and one file buffer, both of which are reused from file to file.
+* Every worker starts with an equal share of the files, and a worker that runs out of files steals half of the remaining files
+* of another worker, so that the load stays balanced even when file sizes vary a lot.
+* stats may be NULL. Otherwise it receives the statistics of the batch.
+* The return value is one of the defined BlastMidi error codes. Individual files that fail do not make the batch fail;
+* their results are reported to the handler and counted in stats.
+*/
+uint8_t blastmidi_batch_read ( const char* const* paths, size_t path_count, unsigned int worker_count, blastmidi_batch_handler* handler, void* user_data, blastmidi_batch_stats* stats );
+
+/*
+*          uint8_t blastmidi_batch_write(blastmidi* instance, const uint8_t* source, size_t source_size, unsigned int worker_count);
+* Writes the instance through its data callback like blastmidi_write_incremental, or like blastmidi_write if source is NULL,
+* but encodes the tracks on a pool of threads.
+* worker_count is the number of threads to use, counting the calling thread. If it is 0, one thread per processor is used.
+* With a single thread, this is the same as calling blastmidi_write or blastmidi_write_incremental.
+* Each track is encoded into a buffer of its own, so the encoded tracks take up as much memory as they do in the output until
+* the write is complete. The buffers are allocated with the allocation functions of the instance, one at a time, and if the
+* instance has a max_memory limit, they must fit within it together with the parsed file, or BLASTMIDI_LIMITEXCEEDED is returned. The calling thread then writes the header and the chunks in order, one write per chunk, so the data
+* callback is only ever invoked from the calling thread.
+* The instance must not be modified by any thread while this function runs.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_batch_write ( blastmidi* instance, const uint8_t* source, size_t source_size, unsigned int worker_count );
+
+#endif /* BLASTMIDI_BATCH_H */
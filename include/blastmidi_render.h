@@ -0,0 +1,125 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_render.h
+* The optional render API, which turns a parsed track into audio with a small built in synthesizer, for instance to make
+* previews of files on a server without any sound hardware or sound banks.
+* Add blastmidi_render.c to your project only if you need it. It needs the C math library.
+*/
+
+#ifndef BLASTMIDI_RENDER_H
+#define BLASTMIDI_RENDER_H
+
+#include <stddef.h> /* For size_t */
+#include "blastmidi.h"
+
+/*
+* The number of notes that can sound at the same time. When a note starts and all the voices are taken, the quietest voice that
+* has been released is reused, or the quietest voice of all if none has. This must be a multiple of 4.
+*/
+#define BLASTMIDI_RENDER_VOICES 64
+
+/*
+* The largest number of frames that are synthesized in one go. Events are applied between blocks, at the exact frame at which
+* they fall due.
+*/
+#define BLASTMIDI_RENDER_BLOCK 256
+
+/*
+* The blastmidi_render_channel structure.
+* This structure holds the state of one Midi channel of a renderer.
+* program, volume, expression and pan are the last values set by the corresponding channel events, and bend is the pitch bend,
+* from 0 to 16383 with 8192 in the center. sustain is nonzero while the sustain pedal is held.
+*/
+typedef struct blastmidi_render_channel
+{
+    uint16_t bend;
+    uint8_t program;
+    uint8_t volume;
+    uint8_t expression;
+    uint8_t pan;
+    uint8_t sustain;
+} blastmidi_render_channel;
+
+/*
+* The blastmidi_renderer structure.
+* A renderer plays one track of a parsed instance. It is owned by the caller, and allocates nothing, so it can be placed
+* anywhere. You should never access the elements in this structure directly.
+* The voices are stored as one array per member, so that 4 of them can be synthesized at once. Every voice sums 3 harmonics,
+* the second and third weighted by weights_2 and weights_3. The phase of the fundamental is in cycles, and advances by the step
+* of the voice every frame. amplitudes holds the current level of the envelope, which is multiplied by the decay of the voice
+* every frame, and lefts and rights hold the gains of the voice on the two sides, which take the velocity, channel volume,
+* expression and pan into account.
+* velocities, notes, voice_channels and states describe what every voice plays. A state of 0 means that the voice is free,
+* 1 that the note is held, 2 that it is only held by the sustain pedal and 3 that it has been released.
+* mix holds the output of every lane of the groups of 4 voices per frame, for the two sides, until the lanes are summed.
+* decays and releases hold the decay per frame of every family of programs while the note is held and after it has been
+* released, with the drum channel last. increments holds the step of every note without pitch bend.
+* event is the next event of the track, which falls due at frame event_frame, position is the next frame to be rendered and
+* sample_rate and channel_count describe the output. The tempo is tracked as in blastmidi_scheduler_session.
+*/
+typedef struct blastmidi_renderer
+{
+    float phases[BLASTMIDI_RENDER_VOICES];
+    float steps[BLASTMIDI_RENDER_VOICES];
+    float amplitudes[BLASTMIDI_RENDER_VOICES];
+    float voice_decays[BLASTMIDI_RENDER_VOICES];
+    float lefts[BLASTMIDI_RENDER_VOICES];
+    float rights[BLASTMIDI_RENDER_VOICES];
+    float weights_2[BLASTMIDI_RENDER_VOICES];
+    float weights_3[BLASTMIDI_RENDER_VOICES];
+    float mix[2][BLASTMIDI_RENDER_BLOCK * 4];
+    float decays[17];
+    float releases[17];
+    float increments[128];
+    uint8_t velocities[BLASTMIDI_RENDER_VOICES];
+    uint8_t notes[BLASTMIDI_RENDER_VOICES];
+    uint8_t voice_channels[BLASTMIDI_RENDER_VOICES];
+    uint8_t states[BLASTMIDI_RENDER_VOICES];
+    blastmidi_render_channel channels[16];
+    const blastmidi* instance;
+    const blastmidi_event* event;
+    uint64_t event_frame;
+    uint64_t position;
+    uint64_t tick;
+    uint64_t tempo_tick;
+    uint64_t tempo_time;
+    uint32_t tempo;
+    uint32_t sample_rate;
+    uint8_t channel_count;
+} blastmidi_renderer;
+
+/*
+*          uint8_t blastmidi_render_initialize(blastmidi_renderer* renderer, const blastmidi* instance, uint16_t track_id, uint32_t sample_rate, uint8_t channel_count);
+* Prepares renderer to play the given track of instance from the start.
+* The times of the events follow the tempo events on the track, as for blastmidi_scheduler_start. To render a type 1 file, merge
+* its tracks first with blastmidi_merge_tracks. The instance must not be modified or freed while it is being rendered.
+* sample_rate is the number of frames per second, and channel_count is 1 for mono or 2 for stereo output.
+* The synthesizer is meant for previews, not for faithful playback. Every family of 8 General Midi programs has its own
+* simple tone, made of a few harmonics with a decaying or sustained envelope, and the drum channel plays short blips.
+* Note on and note off, program changes, pitch bend with a range of 2 semitones, and the controllers for volume, pan,
+* expression, the sustain pedal, all sound off, reset all controllers and all notes off are supported. Everything else is ignored.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_render_initialize ( blastmidi_renderer* renderer, const blastmidi* instance, uint16_t track_id, uint32_t sample_rate, uint8_t channel_count );
+
+/*
+*          size_t blastmidi_render(blastmidi_renderer* renderer, float* output, size_t frames);
+* Renders up to the given number of frames into output, which must have room for frames times channel_count floats. The
+* channels of every frame are interleaved, and the samples lie between -1 and 1.
+* On processors with SSE2, the voices are synthesized 4 at a time with SSE2 instructions. Define BLASTMIDI_NO_SIMD when compiling
+* blastmidi_render.c to use the portable code everywhere, which produces the same output unless the compiler fuses
+* multiplications and additions.
+* The return value is the number of frames that were rendered. It is smaller than frames once the track has ended and the last
+* notes have died away, and 0 from then on.
+*/
+size_t blastmidi_render ( blastmidi_renderer* renderer, float* output, size_t frames );
+
+#endif /* BLASTMIDI_RENDER_H */
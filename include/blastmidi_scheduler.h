@@ -0,0 +1,138 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_scheduler.h
+* The optional scheduler API, which plays back large numbers of parsed tracks at the same time from a single thread, for
+* instance to stream Midi to many clients at once.
+* Add blastmidi_scheduler.c to your project only if you need it.
+*/
+
+#ifndef BLASTMIDI_SCHEDULER_H
+#define BLASTMIDI_SCHEDULER_H
+
+#include "blastmidi.h"
+
+/*
+* The shape of the timing wheel. Every level has BLASTMIDI_SCHEDULER_SLOTS slots, and every slot of a level spans as much time
+* as the whole level below it. With the default resolution of 1 millisecond, the wheel thus covers about 49 days. Sessions
+* that are due later than that wait in the last level until they come within range.
+*/
+#define BLASTMIDI_SCHEDULER_LEVELS 4
+#define BLASTMIDI_SCHEDULER_SLOTS 256
+
+/*
+* The blastmidi_scheduler_session structure.
+* A session plays one track of a parsed instance, and is owned by the caller, who typically embeds it in the state that is
+* kept for a client. The scheduler never allocates or frees sessions, so starting and stopping them costs no memory management.
+* You should never access the elements in this structure directly, except for user_data, which the scheduler does not use.
+* previous, next and slot link the session into the slot of the timing wheel that it waits in, and level is the level of that
+* slot. slot is NULL while it waits in none.
+* instance is the instance that is played, and event is the next event that is due, or NULL once the last event has been
+* dispatched. start is the time at which the track started.
+* due is the time at which event is due. tick is the absolute time of event in ticks.
+* tempo is the current tempo in microseconds per quarter note, which was set at tempo_tick. tempo_time is the time of
+* tempo_tick since the start, in microseconds multiplied by the ticks per beat of the instance, so that no rounding errors
+* accumulate.
+* playing is 1 from the time the session is started until it is stopped or has reached the end of its track.
+*/
+typedef struct blastmidi_scheduler_session
+{
+    struct blastmidi_scheduler_session* previous;
+    struct blastmidi_scheduler_session* next;
+    struct blastmidi_scheduler_session** slot;
+    blastmidi* instance;
+    blastmidi_event* event;
+    void* user_data;
+    uint64_t start;
+    uint64_t due;
+    uint64_t tick;
+    uint64_t tempo_tick;
+    uint64_t tempo_time;
+    uint32_t tempo;
+    uint8_t level;
+    uint8_t playing;
+} blastmidi_scheduler_session;
+
+/*
+* The blastmidi_scheduler structure.
+* You should never access the elements in this structure directly.
+* wheel holds the lists of the sessions that wait in every slot of every level, and level_counts the number of sessions that
+* wait in every level.
+* All times are in microseconds on a clock of the caller's choosing. resolution is the time that a slot of the first level
+* spans, and current is the next slot of the first level to dispatch, counted in resolution units from the start of the clock.
+* session_count is the number of sessions that are playing.
+*/
+typedef struct blastmidi_scheduler
+{
+    blastmidi_scheduler_session* wheel[BLASTMIDI_SCHEDULER_LEVELS][BLASTMIDI_SCHEDULER_SLOTS];
+    size_t level_counts[BLASTMIDI_SCHEDULER_LEVELS];
+    uint64_t current;
+    uint32_t resolution;
+    size_t session_count;
+} blastmidi_scheduler;
+
+/*
+* The blastmidi_scheduler_callback function.
+* This function is invoked by blastmidi_scheduler_advance for every event that falls due.
+* The first parameter is the session that the event belongs to.
+* The second parameter is the event. It is NULL when the session has reached the end of its track, which is reported once,
+* right after its last event. The session is no longer playing at that point.
+* The third parameter is the time at which the event was due, in microseconds.
+* The fourth parameter is the user controlled void* pointer which was passed to blastmidi_scheduler_advance.
+* The callback may stop any session, including the one that the event belongs to, and may start any session that is not
+* playing, including that one once it has reached the end of its track.
+*/
+typedef void blastmidi_scheduler_callback ( blastmidi_scheduler_session*, const blastmidi_event*, uint64_t, void* );
+
+/*
+*          void blastmidi_scheduler_initialize(blastmidi_scheduler* scheduler, uint32_t resolution, uint64_t now);
+* Sets up an empty scheduler.
+* resolution is the granularity of the timing wheel in microseconds, or 0 for the default of 1000. Events are dispatched in
+* order of time per session, but events of different sessions which fall due within the same resolution unit may be dispatched
+* in any order. now is the current time in microseconds, from which the wheel starts turning.
+*/
+void blastmidi_scheduler_initialize ( blastmidi_scheduler* scheduler, uint32_t resolution, uint64_t now );
+
+/*
+*          uint8_t blastmidi_scheduler_start(blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session, blastmidi* instance, uint16_t track_id, uint64_t start, void* user_data);
+* Starts playing the given track of instance on session, so that its first event falls due at its delta time after start.
+* start is in microseconds on the clock of the scheduler, and may lie in the past, in which case the events up to the present
+* are dispatched by the next call to blastmidi_scheduler_advance.
+* The times of the events follow the tempo events on the track, starting at 500000 microseconds per quarter note, or the frame
+* rate if the file uses SMPTE timing. Every session keeps its own position and tempo, so any number of sessions may play the
+* same instance, but the instance must not be modified while they do. To play a type 1 file, merge its tracks first with
+* blastmidi_merge_tracks, so that the tempo map and all the events are on a single track.
+* session must not be playing already. user_data is stored in the session for the caller.
+* This takes O(1) time.
+* The return value is one of the defined BlastMidi error codes.
+*/
+uint8_t blastmidi_scheduler_start ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session, blastmidi* instance, uint16_t track_id, uint64_t start, void* user_data );
+
+/*
+*          void blastmidi_scheduler_stop(blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session);
+* Stops the given session, which dispatches nothing more and may be started again or discarded. The end of the track is not
+* reported to the callback. Stopping a session that is not playing does nothing.
+* This takes O(1) time.
+*/
+void blastmidi_scheduler_stop ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session );
+
+/*
+*          size_t blastmidi_scheduler_advance(blastmidi_scheduler* scheduler, uint64_t now, blastmidi_scheduler_callback* callback, void* user_data);
+* Turns the wheel up to now, which is the current time in microseconds, and invokes callback for every event that has fallen
+* due, including those of the resolution unit that now lies in. Events may thus be dispatched up to one resolution unit early.
+* Call this function regularly from the thread that drives the scheduler, for instance once per resolution unit.
+* The cost is O(1) per resolution unit that has passed, plus O(1) amortized per session that the wheel moves from a higher level
+* to a lower one, plus the callback for every event. Stretches of time in which the lower levels of the wheel are empty are
+* skipped, so a long silence or a long pause between calls costs hardly more than a short one.
+* The return value is the number of events that were dispatched, not counting the ends of tracks.
+*/
+size_t blastmidi_scheduler_advance ( blastmidi_scheduler* scheduler, uint64_t now, blastmidi_scheduler_callback* callback, void* user_data );
+
+#endif /* BLASTMIDI_SCHEDULER_H */
@@ -0,0 +1,68 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_ump.h
+* The optional Universal Midi Packet API, which converts parsed tracks into the packet format of Midi 2.0.
+* Add blastmidi_ump.c to your project only if you need it.
+*/
+
+#ifndef BLASTMIDI_UMP_H
+#define BLASTMIDI_UMP_H
+
+#include "blastmidi.h"
+
+/*
+* Conversion flags.
+* BLASTMIDI_UMP_MIDI1 keeps channel voice messages at Midi 1.0 resolution, as 32 bit packets of message type 2.
+* By default they are upscaled to Midi 2.0 channel voice messages, which are 64 bit packets of message type 4.
+* BLASTMIDI_UMP_NO_TIMING leaves out the delta clockstamps, so that only the messages themselves are produced.
+* BLASTMIDI_UMP_CLIP wraps the track in Start of Clip and End of Clip messages, as in a Midi clip file. The time between
+* the last message and the end of the track is then kept as well.
+*/
+enum blastmidi_ump_flags
+{
+    BLASTMIDI_UMP_MIDI1 = 1,
+    BLASTMIDI_UMP_NO_TIMING = 2,
+    BLASTMIDI_UMP_CLIP = 4
+};
+
+/*
+*          uint8_t blastmidi_ump_convert_track(blastmidi* instance, uint16_t track_id, uint8_t group, uint32_t flags, uint32_t* words, size_t capacity, size_t* word_count);
+* Converts the events on the given track into Universal Midi Packets, which are written to words as 32 bit words in native
+* byte order. Packets of 64 and 128 bits take up 2 and 4 consecutive words, respectively.
+* group is the UMP group, from 0 to 15, which all the messages are sent on. flags is a combination of the values in the
+* blastmidi_ump_flags enum, or 0.
+*
+* Unless BLASTMIDI_UMP_NO_TIMING is given, the output starts with a Delta Clockstamp Ticks Per Quarter Note message if the
+* file uses ticks per beat, and every message whose delta time is not 0 is preceded by Delta Clockstamp messages.
+* Channel voice messages are upscaled with the Min-Center-Max algorithm of the UMP specification. A note on with a velocity
+* of 0 becomes a Midi 2.0 note off with a velocity of 0x8000, which is the upscaled default release velocity of 64.
+* System exclusive events become Data 64 (System Exclusive 7 bit) packets of up to 6 bytes each. Messages which are split
+* over several events are continued across them. Escape events hold raw bytes rather than a message, and are skipped.
+* Tempo and time signature meta events become Flex Data messages. Other meta events have no counterpart in the packet format
+* and are skipped, but their delta times are carried over to the next message.
+*
+* words may be NULL, in which case nothing is written. Either way, word_count receives the number of words that the
+* complete output takes up, so a first call with words set to NULL gives the exact size of the buffer to allocate.
+* If words is not NULL and capacity is smaller than that, as much as fits is written and BLASTMIDI_BUFFERTOOSMALL is returned.
+* The conversion allocates no memory and walks the track once.
+* To convert all the tracks of a type 1 file into a single stream, merge them first with blastmidi_merge_tracks.
+*/
+uint8_t blastmidi_ump_convert_track ( blastmidi* instance, uint16_t track_id, uint8_t group, uint32_t flags, uint32_t* words, size_t capacity, size_t* word_count );
+
+/*
+*          uint32_t blastmidi_ump_scale_up(uint32_t value, uint8_t source_bits, uint8_t destination_bits);
+* Upscales a value from source_bits to destination_bits of resolution with the Min-Center-Max algorithm, so that the minimum,
+* the center and the maximum of the source range map to the minimum, the center and the maximum of the destination range.
+* This is what the converter uses, and is exposed for applications that build their own packets.
+*/
+uint32_t blastmidi_ump_scale_up ( uint32_t value, uint8_t source_bits, uint8_t destination_bits );
+
+#endif /* BLASTMIDI_UMP_H */
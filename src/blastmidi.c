@@ -15,6 +15,10 @@
 * For the API reference, see blastmidi.h.
 */
 
+#if defined(BLASTMIDI_STATS) && !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+#define _POSIX_C_SOURCE 199309L /* For clock_gettime */
+#endif
+
 #include <stdlib.h> /* For malloc and free */
 #include <math.h>
 #include <string.h> /* For memcpy, memset and strcmp */
@@ -22,8 +26,143 @@
 #include "blastmidi_utility.h" /* Utility functions for bit and endian manipulation */
 #include "blastmidi.h"
 #include <stdio.h>
+#ifdef BLASTMIDI_STATS
+#ifdef _WIN32
+#include <windows.h> /* For QueryPerformanceCounter */
+#else
+#include <time.h> /* For clock_gettime */
+#endif
+#endif
 
-void reset ( blastmidi* instance )
+/*
+* Statistics bookkeeping. When BLASTMIDI_STATS is not defined, all of this compiles to nothing.
+*/
+#ifdef BLASTMIDI_STATS
+#define BLASTMIDI_STAT_ADD(instance, member, amount) ( ( instance )->stats.member += ( amount ) )
+
+double stats_get_time ( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency ( &frequency );
+    QueryPerformanceCounter ( &counter );
+    return ( double ) counter.QuadPart / ( double ) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( double ) now.tv_sec + ( double ) now.tv_nsec / 1000000000.0;
+#endif
+}
+#else
+#define BLASTMIDI_STAT_ADD(instance, member, amount)
+#endif
+
+/*
+* All memory owned by an instance is allocated through this function, so that it can be accounted for.
+*/
+void* allocate_memory ( blastmidi* instance, size_t size )
+{
+    BLASTMIDI_STAT_ADD ( instance, allocations, 1 );
+    BLASTMIDI_STAT_ADD ( instance, bytes_allocated, size );
+    return instance->malloc_function ( size );
+}
+
+/*
+* While the instance is recycling, payload blocks of up to BLASTMIDI_PAYLOAD_POOL_LARGEST bytes are allocated in power of two size
+* classes, starting at BLASTMIDI_PAYLOAD_POOL_SMALLEST bytes, and their events get the storage BLASTMIDI_STORAGE_POOLED. The size
+* class of such a block can be derived from the data_size of the event that owns it, so that the block can be handed back to
+* the right free list. All other payloads are allocated at their exact size with the storage BLASTMIDI_STORAGE_HEAP, and are
+* never pooled, even if recycling is enabled later.
+*/
+#define BLASTMIDI_PAYLOAD_POOL_SMALLEST 16
+#define BLASTMIDI_PAYLOAD_POOL_LARGEST ( BLASTMIDI_PAYLOAD_POOL_SMALLEST << ( BLASTMIDI_PAYLOAD_POOL_CLASSES - 1 ) )
+
+unsigned int payload_class ( size_t size )
+{
+    unsigned int size_class = 0;
+    size_t class_size = BLASTMIDI_PAYLOAD_POOL_SMALLEST;
+    assert ( size <= BLASTMIDI_PAYLOAD_POOL_LARGEST );
+    while ( class_size < size )
+    {
+        class_size <<= 1;
+        ++size_class;
+    }
+    return size_class;
+}
+
+uint8_t payload_is_pooled ( blastmidi* instance, size_t size )
+{
+    return instance->recycle && size <= BLASTMIDI_PAYLOAD_POOL_LARGEST;
+}
+
+uint8_t* allocate_payload ( blastmidi* instance, size_t size )
+{
+    unsigned int size_class = 0;
+    uint8_t* block = NULL;
+    if ( !payload_is_pooled ( instance, size ) )
+    {
+        return ( uint8_t* ) allocate_memory ( instance, size );
+    }
+    size_class = payload_class ( size );
+    block = instance->payload_pool[size_class];
+    if ( block )
+    {
+        /*
+        * Pooled blocks store the pointer to the next free block of the same class in their first bytes.
+        */
+        memcpy ( ( void* ) &instance->payload_pool[size_class], block, sizeof ( uint8_t* ) );
+        return block;
+    }
+    return ( uint8_t* ) allocate_memory ( instance, ( size_t ) BLASTMIDI_PAYLOAD_POOL_SMALLEST << size_class );
+}
+
+void release_payload ( blastmidi* instance, blastmidi_event* event )
+{
+    unsigned int size_class = 0;
+    uint8_t* block = event->data;
+    if ( event->storage != BLASTMIDI_STORAGE_POOLED || instance->recycle == 0 )
+    {
+        instance->free_function ( block );
+        return;
+    }
+    size_class = payload_class ( event->data_size );
+    memcpy ( block, ( void* ) &instance->payload_pool[size_class], sizeof ( uint8_t* ) );
+    instance->payload_pool[size_class] = block;
+}
+
+void drain_pools ( blastmidi* instance )
+{
+    unsigned int i;
+    while ( instance->event_pool )
+    {
+        blastmidi_event* next = instance->event_pool->next;
+        instance->free_function ( instance->event_pool );
+        instance->event_pool = next;
+    }
+    for ( i = 0; i < BLASTMIDI_PAYLOAD_POOL_CLASSES; ++i )
+    {
+        while ( instance->payload_pool[i] )
+        {
+            uint8_t* block = instance->payload_pool[i];
+            memcpy ( ( void* ) &instance->payload_pool[i], block, sizeof ( uint8_t* ) );
+            instance->free_function ( block );
+        }
+    }
+}
+
+/*
+* The reset modes.
+* BLASTMIDI_RESET_RELEASE gives all memory back to the allocator.
+* BLASTMIDI_RESET_RECYCLE keeps the track arrays, and hands all events and their payloads to the instance pools for reuse.
+*/
+enum blastmidi_reset_modes
+{
+    BLASTMIDI_RESET_RELEASE,
+    BLASTMIDI_RESET_RECYCLE
+};
+
+void reset_with_mode ( blastmidi* instance, uint8_t mode )
 {
     if ( instance->tracks )
     {
@@ -32,13 +171,26 @@ void reset ( blastmidi* instance )
         {
             blastmidi_whipe_track ( instance, i );
         }
-        instance->free_function ( instance->tracks );
-        instance->tracks = NULL;
     }
-    if ( instance->track_ends )
+    if ( mode == BLASTMIDI_RESET_RELEASE )
     {
-        instance->free_function ( instance->track_ends );
-        instance->track_ends = NULL;
+        if ( instance->tracks )
+        {
+            instance->free_function ( instance->tracks );
+            instance->tracks = NULL;
+        }
+        if ( instance->track_ends )
+        {
+            instance->free_function ( instance->track_ends );
+            instance->track_ends = NULL;
+        }
+        if ( instance->track_sources )
+        {
+            instance->free_function ( instance->track_sources );
+            instance->track_sources = NULL;
+        }
+        instance->track_capacity = 0;
+        drain_pools ( instance );
     }
     instance->track_count = 0;
     instance->file_type = 0;
@@ -50,6 +202,13 @@ void reset ( blastmidi* instance )
     instance->cursor = 0;
     instance->running_status = 0;
     instance->sysex_continuation = 0;
+    instance->event_total = 0;
+    instance->memory_total = 0;
+}
+
+void reset ( blastmidi* instance )
+{
+    reset_with_mode ( instance, instance->recycle ? BLASTMIDI_RESET_RECYCLE : BLASTMIDI_RESET_RELEASE );
 }
 
 uint8_t blastmidi_initialize ( blastmidi* instance, blastmidi_custom_malloc* user_malloc, blastmidi_custom_free* user_free )
@@ -102,433 +261,835 @@ void blastmidi_set_data_callback ( blastmidi* instance, blastmidi_data_callback*
     instance->data_callback_data = user_data;
 }
 
-/*
-* The following I/O functions return an error code.
-*/
-uint8_t read_bytes ( blastmidi* instance, uint8_t* buffer, size_t size )
+void blastmidi_set_recycling ( blastmidi* instance, uint8_t enabled )
 {
-    if ( instance->data_callback ( BLASTMIDI_CALLBACK_READ, size, buffer, instance->data_callback_data ) )
+    instance->recycle = enabled ? 1 : 0;
+    if ( instance->recycle == 0 )
     {
-        instance->cursor += size;
-        return BLASTMIDI_OK;
+        drain_pools ( instance );
     }
-    return BLASTMIDI_UNEXPECTEDEND;
 }
 
-uint8_t skip_ahead ( blastmidi* instance, size_t size )
+/*
+* Each intern table entry is a single allocation, where the shared payload bytes immediately follow this header.
+* table points back to the table that owns the entry, so that an event can hand its reference back without knowing the table.
+*/
+typedef struct blastmidi_intern_entry
 {
-    if ( instance->data_callback ( BLASTMIDI_CALLBACK_SEEK, instance->cursor + size, NULL, instance->data_callback_data ) )
+    struct blastmidi_intern_entry* next;
+    blastmidi_intern_table* table;
+    uint32_t hash;
+    uint32_t size;
+    size_t references;
+} blastmidi_intern_entry;
+
+#define BLASTMIDI_INTERN_INITIAL_BUCKETS 256
+
+/*
+* Internable payloads of up to this many bytes that are read through the data callback are looked up from a buffer on the stack.
+* Longer ones are read into a payload of their own first, which is given back if the table already holds them.
+*/
+#define BLASTMIDI_INTERN_READ_SIZE 256
+
+uint8_t blastmidi_intern_table_initialize ( blastmidi_intern_table* table, blastmidi_custom_malloc* user_malloc, blastmidi_custom_free* user_free )
+{
+    memset ( ( void* ) table, 0, sizeof ( blastmidi_intern_table ) );
+    if ( ( user_malloc || user_free ) && ( user_malloc == NULL || user_free == NULL ) )
     {
-        instance->cursor += size;
-        return BLASTMIDI_OK;
+        return BLASTMIDI_INVALIDPARAM;
     }
-    return BLASTMIDI_UNEXPECTEDEND;
+    if ( user_malloc == NULL && user_free == NULL )
+    {
+        table->malloc_function = malloc;
+        table->free_function = free;
+    }
+    else
+    {
+        table->malloc_function = user_malloc;
+        table->free_function = user_free;
+    }
+    return BLASTMIDI_OK;
 }
 
-uint8_t skip_backwards ( blastmidi* instance, size_t size )
+void blastmidi_intern_table_purge ( blastmidi_intern_table* table )
 {
-    assert ( instance->cursor >= size );
-    if ( instance->data_callback ( BLASTMIDI_CALLBACK_SEEK, instance->cursor - size, NULL, instance->data_callback_data ) )
+    uint32_t i;
+    for ( i = 0; i < table->bucket_count; ++i )
     {
-        instance->cursor -= size;
-        return BLASTMIDI_OK;
+        blastmidi_intern_entry** link = &table->buckets[i];
+        while ( *link )
+        {
+            blastmidi_intern_entry* entry = *link;
+            if ( entry->references == 0 )
+            {
+                *link = entry->next;
+                table->stats.entries--;
+                table->stats.bytes -= entry->size;
+                table->free_function ( entry );
+            }
+            else
+            {
+                link = &entry->next;
+            }
+        }
     }
-    return BLASTMIDI_UNEXPECTEDEND;
 }
 
-uint8_t write_bytes ( blastmidi* instance, uint8_t* buffer, size_t size )
+void blastmidi_intern_table_free ( blastmidi_intern_table* table )
 {
-    if ( instance->data_callback ( BLASTMIDI_CALLBACK_WRITE, size, buffer, instance->data_callback_data ) )
+    assert ( table->stats.references == 0 );
+    blastmidi_intern_table_purge ( table );
+    if ( table->buckets )
     {
-        return BLASTMIDI_OK;
+        table->free_function ( table->buckets );
+        table->buckets = NULL;
     }
-    return BLASTMIDI_UNEXPECTEDEND;
+    table->bucket_count = 0;
 }
 
-uint8_t read_byte ( blastmidi* instance, uint8_t* buffer )
+void blastmidi_intern_table_get_stats ( const blastmidi_intern_table* table, blastmidi_intern_stats* stats )
 {
-    return read_bytes ( instance, buffer, 1 );
+    *stats = table->stats;
 }
 
-/*
-* The following integer I/O functions convert to and from big endian as required.
-*/
-uint8_t read_16_bit ( blastmidi* instance, uint16_t* buffer )
+void blastmidi_set_intern_table ( blastmidi* instance, blastmidi_intern_table* table )
 {
-    if ( read_bytes ( instance, ( uint8_t* ) buffer, 2 ) == BLASTMIDI_OK )
-    {
-        *buffer = convert_endian_16 ( *buffer, instance->endian_flag );
-        return BLASTMIDI_OK;
-    }
-    return BLASTMIDI_UNEXPECTEDEND;
+    instance->intern_table = table;
 }
 
-uint8_t read_32_bit ( blastmidi* instance, uint32_t* buffer )
+uint32_t intern_hash ( const uint8_t* data, uint32_t size )
 {
-    if ( read_bytes ( instance, ( uint8_t* ) buffer, 4 ) == BLASTMIDI_OK )
+    /*
+    * 32 bit FNV-1a.
+    */
+    uint32_t hash = 2166136261u;
+    uint32_t i;
+    for ( i = 0; i < size; ++i )
     {
-        *buffer = convert_endian_32 ( *buffer, instance->endian_flag );
-        return BLASTMIDI_OK;
+        hash ^= data[i];
+        hash *= 16777619u;
     }
-    return BLASTMIDI_UNEXPECTEDEND;
+    return hash;
 }
 
-uint8_t read_24_bit ( blastmidi* instance, uint32_t* buffer )
+/*
+* The intern table is grown and filled on behalf of the instance that is being read or edited, so that its allocations show up in
+* the statistics of that instance.
+*/
+uint8_t intern_table_grow ( blastmidi* instance )
 {
-    if ( read_bytes ( instance, ( uint8_t* ) buffer, 3 ) == BLASTMIDI_OK )
+    blastmidi_intern_table* table = instance->intern_table;
+    uint32_t new_count = table->bucket_count ? table->bucket_count * 2 : BLASTMIDI_INTERN_INITIAL_BUCKETS;
+    blastmidi_intern_entry** new_buckets;
+    uint32_t i;
+    BLASTMIDI_STAT_ADD ( instance, allocations, 1 );
+    BLASTMIDI_STAT_ADD ( instance, bytes_allocated, sizeof ( blastmidi_intern_entry* ) * new_count );
+    new_buckets = ( blastmidi_intern_entry** ) table->malloc_function ( sizeof ( blastmidi_intern_entry* ) * new_count );
+    if ( new_buckets == NULL )
     {
-        *buffer = convert_endian_32 ( *buffer, instance->endian_flag );
-        *buffer = extract_bits_32 ( *buffer, 1, 24 );
-        return BLASTMIDI_OK;
+        return BLASTMIDI_OUTOFMEMORY;
     }
-    return BLASTMIDI_UNEXPECTEDEND;
+    memset ( ( void* ) new_buckets, 0, sizeof ( blastmidi_intern_entry* ) * new_count );
+    for ( i = 0; i < table->bucket_count; ++i )
+    {
+        blastmidi_intern_entry* entry = table->buckets[i];
+        while ( entry )
+        {
+            blastmidi_intern_entry* next = entry->next;
+            uint32_t bucket = entry->hash & ( new_count - 1 );
+            entry->next = new_buckets[bucket];
+            new_buckets[bucket] = entry;
+            entry = next;
+        }
+    }
+    if ( table->buckets )
+    {
+        table->free_function ( table->buckets );
+    }
+    table->buckets = new_buckets;
+    table->bucket_count = new_count;
+    return BLASTMIDI_OK;
 }
 
-uint8_t read_variable_number ( blastmidi* instance, uint32_t* buffer )
+uint8_t* intern_acquire ( blastmidi* instance, const uint8_t* data, uint32_t size )
 {
-    uint8_t i;
-
-    *buffer = 0;
 
-    for ( i = 0; i < 4; i++ )
-    {
+    /*
+    * Returns the shared copy of the given payload, creating it if necessary, or NULL if we are out of memory.
+    * The caller owns one reference to the returned buffer.
+    */
 
-        uint8_t keep_going = 0;
-        uint8_t current;
+    blastmidi_intern_table* table = instance->intern_table;
+    uint32_t hash = intern_hash ( data, size );
+    blastmidi_intern_entry* entry = NULL;
 
-        uint8_t result = read_byte ( instance, &current );
-        if ( result != BLASTMIDI_OK )
-        {
-            return result;
-        }
-        keep_going = extract_bits_8 ( current, 1, 1 );
-        if ( keep_going == 1 && i == 3 )
+    table->stats.lookups++;
+    if ( table->bucket_count )
+    {
+        entry = table->buckets[hash & ( table->bucket_count - 1 )];
+        while ( entry )
         {
-            return BLASTMIDI_INVALIDCHUNK;
+            if ( entry->hash == hash && entry->size == size && memcmp ( ( void* ) ( entry + 1 ), data, size ) == 0 )
+            {
+                table->stats.hits++;
+                table->stats.bytes_saved += size;
+                table->stats.references++;
+                entry->references++;
+                return ( uint8_t* ) ( entry + 1 );
+            }
+            entry = entry->next;
         }
-        *buffer = ( ( *buffer ) << 7 ) | ( current & 0x7f );
-        if ( !keep_going )
+    }
+
+    /*
+    * Keep the load factor at or below 1.
+    */
+    if ( table->stats.entries >= table->bucket_count )
+    {
+        if ( intern_table_grow ( instance ) != BLASTMIDI_OK )
         {
-            break;
+            return NULL;
         }
     }
-    return BLASTMIDI_OK;
-}
-
-uint8_t write_16_bit ( blastmidi* instance, uint16_t value )
-{
-    uint16_t buffer = convert_endian_16 ( value, instance->endian_flag );
-    if ( write_bytes ( instance, ( uint8_t* ) &buffer, 2 ) == BLASTMIDI_OK )
+    BLASTMIDI_STAT_ADD ( instance, allocations, 1 );
+    BLASTMIDI_STAT_ADD ( instance, bytes_allocated, sizeof ( blastmidi_intern_entry ) + size );
+    entry = ( blastmidi_intern_entry* ) table->malloc_function ( sizeof ( blastmidi_intern_entry ) + size );
+    if ( entry == NULL )
     {
-        return BLASTMIDI_OK;
+        return NULL;
     }
-    return BLASTMIDI_WRITINGFAILED;
+    entry->table = table;
+    entry->hash = hash;
+    entry->size = size;
+    entry->references = 1;
+    memcpy ( ( void* ) ( entry + 1 ), data, size );
+    entry->next = table->buckets[hash & ( table->bucket_count - 1 )];
+    table->buckets[hash & ( table->bucket_count - 1 )] = entry;
+    table->stats.entries++;
+    table->stats.bytes += size;
+    table->stats.references++;
+    return ( uint8_t* ) ( entry + 1 );
 }
 
-uint8_t write_32_bit ( blastmidi* instance, uint32_t value )
+void intern_release ( uint8_t* data )
 {
-    uint32_t buffer = convert_endian_32 ( value, instance->endian_flag );
-    if ( write_bytes ( instance, ( uint8_t* ) &buffer, 4 ) == BLASTMIDI_OK )
-    {
-        return BLASTMIDI_OK;
-    }
-    return BLASTMIDI_WRITINGFAILED;
+    blastmidi_intern_entry* entry = ( ( blastmidi_intern_entry* ) data ) - 1;
+    assert ( entry->references > 0 );
+    entry->references--;
+    entry->table->stats.references--;
 }
 
-uint8_t allocate_tracks ( blastmidi* instance )
+uint8_t is_internable ( blastmidi* instance, uint8_t type, uint8_t subtype, unsigned int data_size )
 {
-
-    assert ( instance->track_count > 0 );
-    assert ( instance->tracks == NULL );
-    assert ( instance->track_ends == NULL );
-
-    instance->tracks = ( blastmidi_event** ) instance->malloc_function ( ( sizeof ( blastmidi_event* ) * instance->track_count ) );
-    if ( instance->tracks == NULL )
+    if ( instance->intern_table == NULL || type != BLASTMIDI_META_EVENT || data_size <= BLASTMIDI_SMALL_POOL_SIZE )
     {
-        reset ( instance );
-        return BLASTMIDI_OUTOFMEMORY;
-    }
-    memset ( ( void* ) instance->tracks, 0, sizeof ( blastmidi_event* ) *instance->track_count );
-    instance->track_ends = ( blastmidi_event** ) instance->malloc_function ( ( sizeof ( blastmidi_event* ) * instance->track_count ) );
-    if ( instance->track_ends == NULL )
-    {
-        reset ( instance );
-        return BLASTMIDI_OUTOFMEMORY;
+        return 0;
     }
-    memset ( ( void* ) instance->track_ends, 0, sizeof ( blastmidi_event* ) *instance->track_count );
-    return BLASTMIDI_OK;
+    return subtype >= BLASTMIDI_META_TEXT && subtype <= BLASTMIDI_META_CUE_POINT;
 }
 
-uint8_t allocate_event ( blastmidi* instance, uint8_t type, uint8_t subtype, uint8_t* data, unsigned int data_size, blastmidi_event** event )
+void intern_event_payload ( blastmidi* instance, blastmidi_event* event )
 {
 
     /*
-    * This function allocates the memory needed for a Midi event.
-    * If data is not NULL, its content will be copied into the event's internal storage.
-    * If data is NULL, the memory to hold the event data is allocated but left uninitialized.
+    * Replaces the private payload of a freshly populated event with the shared copy from the intern table.
+    * If the table cannot take the payload, the event simply keeps its private copy.
     */
 
-    blastmidi_event* output = NULL;
-    *event = NULL;
-
-    output = ( blastmidi_event* ) instance->malloc_function ( sizeof ( blastmidi_event ) );
-    if ( output == NULL )
+    uint8_t* shared = NULL;
+    if ( ( event->storage != BLASTMIDI_STORAGE_HEAP && event->storage != BLASTMIDI_STORAGE_POOLED ) || !is_internable ( instance, event->type, event->subtype, event->data_size ) )
     {
-        return BLASTMIDI_OUTOFMEMORY;
+        return;
     }
-    memset ( ( void* ) output, 0, sizeof ( blastmidi_event ) );
-    output->track = -1;
-    output->time = 0;
-    output->type = type;
-    output->subtype = subtype;
-    output->channel = -1;
-    output->data = NULL;
-    output->data_size = data_size;
-    output->end_of_sysex = 0;
-    output->previous = NULL;
-    output->next = NULL;
-    if ( data_size > 0 && data_size <= sizeof ( output->small_pool ) )
+    shared = intern_acquire ( instance, event->data, event->data_size );
+    if ( shared == NULL )
     {
-        output->data = output->small_pool;
+        return;
     }
-    else
+    release_payload ( instance, event );
+    event->data = shared;
+    event->storage = BLASTMIDI_STORAGE_SHARED;
+}
+
+/*
+* The following I/O functions return an error code.
+* When the instance is reading from memory (see blastmidi_read_memory), they work directly on the buffer
+* and the data callback is not used.
+*/
+uint8_t read_bytes ( blastmidi* instance, uint8_t* buffer, size_t size )
+{
+    BLASTMIDI_STAT_ADD ( instance, bytes_read, size );
+    if ( instance->memory )
     {
-        uint8_t* data_block = ( uint8_t* ) instance->malloc_function ( data_size );
-        if ( data_block == NULL )
+        if ( size > instance->memory_size - instance->cursor )
         {
-            instance->free_function ( output );
-            return BLASTMIDI_OUTOFMEMORY;
+            return BLASTMIDI_UNEXPECTEDEND;
         }
-        output->data = data_block;
+        memcpy ( buffer, instance->memory + instance->cursor, size );
+        instance->cursor += size;
+        return BLASTMIDI_OK;
     }
-
-    if ( data )
+    BLASTMIDI_STAT_ADD ( instance, callbacks[BLASTMIDI_CALLBACK_READ], 1 );
+    if ( instance->data_callback ( BLASTMIDI_CALLBACK_READ, size, buffer, instance->data_callback_data ) )
     {
-        memcpy ( output->data, data, data_size );
+        instance->cursor += size;
+        return BLASTMIDI_OK;
     }
-
-    *event = output;
-    return BLASTMIDI_OK;
+    return BLASTMIDI_UNEXPECTEDEND;
 }
 
-uint8_t blastmidi_event_create_channel_event ( blastmidi* instance, uint8_t channel, uint8_t subtype, uint8_t param_1, uint8_t param_2, blastmidi_event** event )
+/*
+* Points data at the next size bytes of the buffer that is being read from memory, and moves past them without copying them.
+*/
+uint8_t read_in_place ( blastmidi* instance, const uint8_t** data, size_t size )
 {
-    blastmidi_event* output = NULL;
-    uint8_t result = 0;
-    uint8_t data[2];
-    unsigned int data_size = 0;
-    uint8_t* temp_ptr8 = NULL;
-    uint16_t temp16 = 0;
-    switch ( subtype )
-    {
-        case BLASTMIDI_CHANNEL_NOTE_OFF:
-        case BLASTMIDI_CHANNEL_NOTE_ON:
-        case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
-        case BLASTMIDI_CHANNEL_CONTROLLER:
-            data_size = 2;
-            data[0] = param_1;
-            data[1] = param_2;
-            break;
-        case BLASTMIDI_CHANNEL_PITCH_BEND:
-            /*
-            * Extract the last 7 bits of both data bytes and combine them into an unsigned 16 bit integer.
-            * The resulting integer will be in the native host endian order.
-            */
-            data_size = 2;
-            param_1 = extract_bits_8 ( param_1, 2, 8 );
-            param_2 = extract_bits_8 ( param_2, 2, 8 );
-            temp16 = param_1;
-            temp16 = temp16 << 8;
-            temp16 |= ( param_2 << 1 );
-            temp16 = temp16 >> 1;
-            temp_ptr8 = ( uint8_t* ) &temp16;
-            data[0] = temp_ptr8[0];
-            data[1] = temp_ptr8[1];
-            break;
-        case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
-        case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
-            data_size = 1;
-            data[0] = param_1;
-            break;
-        default:
-            return BLASTMIDI_INVALIDPARAM;
-    };
-
-    result = allocate_event ( instance, BLASTMIDI_CHANNEL_EVENT, subtype, data, data_size, &output );
-    if ( result != BLASTMIDI_OK )
+    assert ( instance->memory );
+    BLASTMIDI_STAT_ADD ( instance, bytes_read, size );
+    if ( size > instance->memory_size - instance->cursor )
     {
-        return result;
+        return BLASTMIDI_UNEXPECTEDEND;
     }
-    output->channel = channel;
-    *event = output;
+    *data = instance->memory + instance->cursor;
+    instance->cursor += size;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_event_create_meta_sequence_number_event ( blastmidi* instance, uint16_t sequence_number, blastmidi_event** event )
+uint8_t skip_ahead ( blastmidi* instance, size_t size )
 {
-    uint8_t result = 0;
-    blastmidi_event* output = NULL;
-
-    assert ( sizeof ( sequence_number ) == 2 );
+    BLASTMIDI_STAT_ADD ( instance, seeks_forward, 1 );
+    if ( instance->memory )
+    {
+        if ( size > instance->memory_size - instance->cursor )
+        {
+            return BLASTMIDI_UNEXPECTEDEND;
+        }
+        instance->cursor += size;
+        return BLASTMIDI_OK;
+    }
+    BLASTMIDI_STAT_ADD ( instance, callbacks[BLASTMIDI_CALLBACK_SEEK], 1 );
+    if ( instance->data_callback ( BLASTMIDI_CALLBACK_SEEK, instance->cursor + size, NULL, instance->data_callback_data ) )
+    {
+        instance->cursor += size;
+        return BLASTMIDI_OK;
+    }
+    return BLASTMIDI_UNEXPECTEDEND;
+}
 
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_SEQUENCE_NUMBER, ( uint8_t* ) &sequence_number, sizeof ( sequence_number ), &output );
-    if ( result != BLASTMIDI_OK )
+uint8_t skip_backwards ( blastmidi* instance, size_t size )
+{
+    assert ( instance->cursor >= size );
+    BLASTMIDI_STAT_ADD ( instance, seeks_backward, 1 );
+    if ( instance->memory )
     {
-        return result;
+        instance->cursor -= size;
+        return BLASTMIDI_OK;
     }
-    *event = output;
-    return BLASTMIDI_OK;
+    BLASTMIDI_STAT_ADD ( instance, callbacks[BLASTMIDI_CALLBACK_SEEK], 1 );
+    if ( instance->data_callback ( BLASTMIDI_CALLBACK_SEEK, instance->cursor - size, NULL, instance->data_callback_data ) )
+    {
+        instance->cursor -= size;
+        return BLASTMIDI_OK;
+    }
+    return BLASTMIDI_UNEXPECTEDEND;
 }
 
-uint8_t blastmidi_event_create_meta_tempo_event ( blastmidi* instance, uint32_t tempo, blastmidi_event** event )
+uint8_t write_bytes ( blastmidi* instance, uint8_t* buffer, size_t size )
 {
-    blastmidi_event* output = NULL;
-    uint8_t result = 0;
+    BLASTMIDI_STAT_ADD ( instance, callbacks[BLASTMIDI_CALLBACK_WRITE], 1 );
+    if ( instance->data_callback ( BLASTMIDI_CALLBACK_WRITE, size, buffer, instance->data_callback_data ) )
+    {
+        return BLASTMIDI_OK;
+    }
+    return BLASTMIDI_UNEXPECTEDEND;
+}
 
-    assert ( sizeof ( tempo ) == 4 );
+uint8_t read_byte ( blastmidi* instance, uint8_t* buffer )
+{
+    return read_bytes ( instance, buffer, 1 );
+}
 
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_SET_TEMPO, ( uint8_t* ) &tempo, sizeof ( tempo ), &output );
-    if ( result != BLASTMIDI_OK )
+void blastmidi_set_limits ( blastmidi* instance, const blastmidi_limits* limits )
+{
+    if ( limits )
     {
-        return result;
+        instance->limits = *limits;
+    }
+    else
+    {
+        memset ( ( void* ) &instance->limits, 0, sizeof ( blastmidi_limits ) );
     }
-    *event = output;
-    return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_event_create_meta_data_event ( blastmidi* instance, uint8_t subtype, uint8_t* data, unsigned int data_size, blastmidi_event** event )
+void blastmidi_set_read_mask ( blastmidi* instance, const blastmidi_read_mask* mask )
 {
-    blastmidi_event* output = NULL;
-    uint8_t result = 0;
-    switch ( subtype )
+    if ( mask )
     {
-        case BLASTMIDI_META_TEXT:
-        case BLASTMIDI_META_COPYRIGHT_NOTICE:
-        case BLASTMIDI_META_SEQUENCE_OR_TRACK_NAME:
-        case BLASTMIDI_META_INSTRUMENT_NAME:
-        case BLASTMIDI_META_LYRICS:
-        case BLASTMIDI_META_MARKER:
-        case BLASTMIDI_META_CUE_POINT:
-        case BLASTMIDI_META_SEQUENCER_SPECIFIC:
-            break;
-        default:
-            return BLASTMIDI_INVALIDPARAM;
-    };
-
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, subtype, data, data_size, &output );
-    if ( result != BLASTMIDI_OK )
+        instance->read_mask = *mask;
+    }
+    else
     {
-        return result;
+        memset ( ( void* ) &instance->read_mask, 0, sizeof ( blastmidi_read_mask ) );
     }
-    *event = output;
-    return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_event_create_meta_midi_channel_prefix_event ( blastmidi* instance, uint8_t channel, blastmidi_event** event )
+void blastmidi_set_read_end ( blastmidi* instance, uint32_t tick, double seconds )
 {
-    blastmidi_event* output = NULL;
-    uint8_t result = 0;
-
-    assert ( sizeof ( channel ) == 1 );
+    instance->read_end_tick = tick;
+    instance->read_end_seconds = seconds > 0 ? seconds : 0;
+}
 
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_MIDI_CHANNEL_PREFIX, ( uint8_t* ) &channel, 1, &output );
-    if ( result != BLASTMIDI_OK )
+/*
+* The following functions tell whether the read mask of the instance drops an event, given what has been read of it so far.
+*/
+uint8_t mask_drops_meta_event ( blastmidi* instance, uint8_t subtype )
+{
+    const blastmidi_read_mask* mask = &instance->read_mask;
+    if ( subtype == BLASTMIDI_META_END_OF_TRACK )
     {
-        return result;
+        return 0;
     }
-    *event = output;
-    return BLASTMIDI_OK;
+    return ( mask->event_types & ( 1 << BLASTMIDI_META_EVENT ) ) || ( mask->meta_events[subtype >> 3] & ( 1 << ( subtype & 7 ) ) );
 }
 
-uint8_t blastmidi_event_create_meta_time_signature_event ( blastmidi* instance, uint8_t numerator, uint8_t denominator, uint8_t metronome, uint8_t thirtyseconds_per_24_signals, blastmidi_event** event )
+uint8_t mask_drops_channel_event ( blastmidi* instance, uint8_t subtype, uint8_t channel, uint8_t first )
 {
-    uint8_t result = 0;
-    blastmidi_event* output = NULL;
-    uint8_t data[4];
-
-    assert ( sizeof ( numerator ) == 1 );
-
-    data[0] = numerator;
-    data[1] = denominator;
-    data[2] = metronome;
-    data[3] = thirtyseconds_per_24_signals;
+    const blastmidi_read_mask* mask = &instance->read_mask;
+    if ( ( mask->event_types & ( 1 << BLASTMIDI_CHANNEL_EVENT ) ) || ( mask->channel_events & ( 1 << ( subtype - BLASTMIDI_CHANNEL_NOTE_OFF ) ) ) || ( mask->channels & ( 1 << channel ) ) )
+    {
+        return 1;
+    }
+    return subtype == BLASTMIDI_CHANNEL_CONTROLLER && ( mask->controllers[( first & 127 ) >> 3] & ( 1 << ( first & 7 ) ) );
+}
 
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_TIME_SIGNATURE, data, 4, &output );
-    if ( result != BLASTMIDI_OK )
+/*
+* The following functions charge the file that is being read for the resources it is about to use, and fail if this would
+* exceed one of the limits. They must be called before the corresponding memory is allocated.
+*/
+uint8_t charge_memory ( blastmidi* instance, size_t size )
+{
+    if ( instance->limits.max_memory && size > instance->limits.max_memory - instance->memory_total )
     {
-        return result;
+        return BLASTMIDI_LIMITEXCEEDED;
     }
-    *event = output;
+    instance->memory_total += size;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_event_create_meta_key_signature_event ( blastmidi* instance, int8_t key, uint8_t scale, blastmidi_event** event )
+uint8_t charge_event ( blastmidi* instance )
 {
-    uint8_t result = 0;
-    blastmidi_event* output = NULL;
-    uint8_t data[2];
+    if ( instance->limits.max_events && instance->event_total >= instance->limits.max_events )
+    {
+        return BLASTMIDI_LIMITEXCEEDED;
+    }
+    instance->event_total++;
+    return charge_memory ( instance, sizeof ( blastmidi_event ) );
+}
 
-    assert ( sizeof ( key ) == 1 );
+uint8_t charge_payload ( blastmidi* instance, uint32_t size )
+{
 
-    data[0] = ( uint8_t ) key;
-    data[1] = scale;
+    /*
+    * When reading from memory we know exactly how many bytes are left, so there is no point in allocating a payload that
+    * cannot possibly be filled.
+    */
+    if ( instance->memory && size > instance->memory_size - instance->cursor )
+    {
+        return BLASTMIDI_UNEXPECTEDEND;
+    }
+    if ( instance->limits.max_payload_size && size > instance->limits.max_payload_size )
+    {
+        return BLASTMIDI_LIMITEXCEEDED;
+    }
+    if ( size <= BLASTMIDI_SMALL_POOL_SIZE )
+    {
+        return BLASTMIDI_OK;
+    }
 
-    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_KEY_SIGNATURE, data, 2, &output );
-    if ( result != BLASTMIDI_OK )
+    /*
+    * A pooled payload occupies the whole of its size class, so that is what counts against max_memory.
+    */
+    if ( payload_is_pooled ( instance, size ) )
     {
-        return result;
+        return charge_memory ( instance, ( size_t ) BLASTMIDI_PAYLOAD_POOL_SMALLEST << payload_class ( size ) );
     }
-    *event = output;
-    return BLASTMIDI_OK;
+    return charge_memory ( instance, size );
 }
 
-uint8_t blastmidi_event_create_sysex_event ( blastmidi* instance, uint8_t* data, unsigned int data_size, uint8_t end_of_sysex, blastmidi_event** event )
+/*
+* The following integer I/O functions convert to and from big endian as required.
+*/
+uint8_t read_16_bit ( blastmidi* instance, uint16_t* buffer )
 {
-    blastmidi_event* output = NULL;
-    uint8_t result = allocate_event ( instance, BLASTMIDI_SYSEX_EVENT, 0, data, data_size, &output );
-    if ( result != BLASTMIDI_OK )
+    if ( read_bytes ( instance, ( uint8_t* ) buffer, 2 ) == BLASTMIDI_OK )
     {
-        return result;
+        *buffer = convert_endian_16 ( *buffer, instance->endian_flag );
+        return BLASTMIDI_OK;
     }
-    output->end_of_sysex = end_of_sysex;
-    *event = output;
-    return BLASTMIDI_OK;
+    return BLASTMIDI_UNEXPECTEDEND;
 }
 
-uint8_t read_meta_event ( blastmidi* instance, uint8_t* end_of_track, blastmidi_event** event_ptr )
+uint8_t read_32_bit ( blastmidi* instance, uint32_t* buffer )
 {
-    uint8_t type = 0;
-    uint32_t event_size = 0;
-    uint8_t result = read_byte ( instance, &type );
-    if ( result != BLASTMIDI_OK )
+    if ( read_bytes ( instance, ( uint8_t* ) buffer, 4 ) == BLASTMIDI_OK )
     {
-        return result;
+        *buffer = convert_endian_32 ( *buffer, instance->endian_flag );
+        return BLASTMIDI_OK;
     }
-    result = read_variable_number ( instance, &event_size );
-    if ( result != BLASTMIDI_OK )
+    return BLASTMIDI_UNEXPECTEDEND;
+}
+
+uint8_t read_24_bit ( blastmidi* instance, uint32_t* buffer )
+{
+    if ( read_bytes ( instance, ( uint8_t* ) buffer, 3 ) == BLASTMIDI_OK )
     {
-        return result;
+        *buffer = convert_endian_32 ( *buffer, instance->endian_flag );
+        *buffer = extract_bits_32 ( *buffer, 1, 24 );
+        return BLASTMIDI_OK;
     }
-    switch ( type )
+    return BLASTMIDI_UNEXPECTEDEND;
+}
+
+uint8_t read_variable_number ( blastmidi* instance, uint32_t* buffer )
+{
+    uint8_t i;
+
+    *buffer = 0;
+
+    for ( i = 0; i < 4; i++ )
     {
-        case BLASTMIDI_META_SEQUENCE_NUMBER:
+
+        uint8_t keep_going = 0;
+        uint8_t current;
+
+        uint8_t result = read_byte ( instance, &current );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        keep_going = extract_bits_8 ( current, 1, 1 );
+        if ( keep_going == 1 && i == 3 )
+        {
+            return BLASTMIDI_INVALIDCHUNK;
+        }
+        *buffer = ( ( *buffer ) << 7 ) | ( current & 0x7f );
+        if ( !keep_going )
         {
-            uint16_t sequence_number = 0;
-            result = read_16_bit ( instance, &sequence_number );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Sequence number: %u\n", ( uint32_t ) sequence_number );
-#endif
-            result = blastmidi_event_create_meta_sequence_number_event ( instance, sequence_number, event_ptr );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
             break;
         }
+    }
+    return BLASTMIDI_OK;
+}
+
+uint8_t write_16_bit ( blastmidi* instance, uint16_t value )
+{
+    uint16_t buffer = convert_endian_16 ( value, instance->endian_flag );
+    if ( write_bytes ( instance, ( uint8_t* ) &buffer, 2 ) == BLASTMIDI_OK )
+    {
+        return BLASTMIDI_OK;
+    }
+    return BLASTMIDI_WRITINGFAILED;
+}
+
+uint8_t write_32_bit ( blastmidi* instance, uint32_t value )
+{
+    uint32_t buffer = convert_endian_32 ( value, instance->endian_flag );
+    if ( write_bytes ( instance, ( uint8_t* ) &buffer, 4 ) == BLASTMIDI_OK )
+    {
+        return BLASTMIDI_OK;
+    }
+    return BLASTMIDI_WRITINGFAILED;
+}
+
+/*
+* Tracks without a source chunk are dirty, since they can only be written by encoding them.
+*/
+void clear_track_sources ( blastmidi* instance, uint16_t first, uint16_t end )
+{
+    uint16_t i;
+    for ( i = first; i < end; ++i )
+    {
+        instance->track_sources[i].offset = 0;
+        instance->track_sources[i].size = 0;
+        instance->track_sources[i].dirty = 1;
+    }
+}
+
+void mark_track_dirty ( blastmidi* instance, uint16_t track_id )
+{
+    instance->track_sources[track_id].dirty = 1;
+}
+
+uint8_t allocate_tracks ( blastmidi* instance )
+{
+
+    assert ( instance->track_count > 0 );
+
+    /*
+    * If the instance has been recycled, the arrays from the previous file may already be large enough.
+    */
+    if ( instance->track_capacity < instance->track_count )
+    {
+        if ( instance->tracks )
+        {
+            instance->free_function ( instance->tracks );
+            instance->tracks = NULL;
+        }
+        if ( instance->track_ends )
+        {
+            instance->free_function ( instance->track_ends );
+            instance->track_ends = NULL;
+        }
+        if ( instance->track_sources )
+        {
+            instance->free_function ( instance->track_sources );
+            instance->track_sources = NULL;
+        }
+        instance->track_capacity = 0;
+        instance->tracks = ( blastmidi_event** ) allocate_memory ( instance, ( sizeof ( blastmidi_event* ) * instance->track_count ) );
+        if ( instance->tracks == NULL )
+        {
+            reset ( instance );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        instance->track_ends = ( blastmidi_event** ) allocate_memory ( instance, ( sizeof ( blastmidi_event* ) * instance->track_count ) );
+        if ( instance->track_ends == NULL )
+        {
+            instance->free_function ( instance->tracks );
+            instance->tracks = NULL;
+            reset ( instance );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        instance->track_sources = ( blastmidi_track_source* ) allocate_memory ( instance, ( sizeof ( blastmidi_track_source ) * instance->track_count ) );
+        if ( instance->track_sources == NULL )
+        {
+            instance->free_function ( instance->tracks );
+            instance->tracks = NULL;
+            instance->free_function ( instance->track_ends );
+            instance->track_ends = NULL;
+            reset ( instance );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        instance->track_capacity = instance->track_count;
+    }
+    memset ( ( void* ) instance->tracks, 0, sizeof ( blastmidi_event* ) *instance->track_count );
+    memset ( ( void* ) instance->track_ends, 0, sizeof ( blastmidi_event* ) *instance->track_count );
+    clear_track_sources ( instance, 0, instance->track_count );
+    return BLASTMIDI_OK;
+}
+
+uint8_t grow_tracks ( blastmidi* instance, uint16_t capacity )
+{
+    blastmidi_event** tracks = NULL;
+    blastmidi_event** track_ends = NULL;
+    blastmidi_track_source* track_sources = NULL;
+
+    /*
+    * Unlike allocate_tracks, this keeps the existing tracks. The new slots are cleared.
+    */
+    if ( instance->track_capacity >= capacity )
+    {
+        return BLASTMIDI_OK;
+    }
+    tracks = ( blastmidi_event** ) allocate_memory ( instance, sizeof ( blastmidi_event* ) * capacity );
+    if ( tracks == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    track_ends = ( blastmidi_event** ) allocate_memory ( instance, sizeof ( blastmidi_event* ) * capacity );
+    if ( track_ends == NULL )
+    {
+        instance->free_function ( tracks );
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    track_sources = ( blastmidi_track_source* ) allocate_memory ( instance, sizeof ( blastmidi_track_source ) * capacity );
+    if ( track_sources == NULL )
+    {
+        instance->free_function ( tracks );
+        instance->free_function ( track_ends );
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    memset ( ( void* ) tracks, 0, sizeof ( blastmidi_event* ) *capacity );
+    memset ( ( void* ) track_ends, 0, sizeof ( blastmidi_event* ) *capacity );
+    if ( instance->tracks )
+    {
+        memcpy ( ( void* ) tracks, ( void* ) instance->tracks, sizeof ( blastmidi_event* ) *instance->track_count );
+        instance->free_function ( instance->tracks );
+    }
+    if ( instance->track_ends )
+    {
+        memcpy ( ( void* ) track_ends, ( void* ) instance->track_ends, sizeof ( blastmidi_event* ) *instance->track_count );
+        instance->free_function ( instance->track_ends );
+    }
+    if ( instance->track_sources )
+    {
+        memcpy ( ( void* ) track_sources, ( void* ) instance->track_sources, sizeof ( blastmidi_track_source ) *instance->track_count );
+        instance->free_function ( instance->track_sources );
+    }
+    instance->tracks = tracks;
+    instance->track_ends = track_ends;
+    instance->track_sources = track_sources;
+    instance->track_capacity = capacity;
+    clear_track_sources ( instance, instance->track_count, capacity );
+    return BLASTMIDI_OK;
+}
+
+uint8_t allocate_event ( blastmidi* instance, uint8_t type, uint8_t subtype, uint8_t* data, unsigned int data_size, blastmidi_event** event )
+{
+
+    /*
+    * This function allocates the memory needed for a Midi event.
+    * If data is not NULL, its content will be copied into the event's internal storage.
+    * If data is NULL, the memory to hold the event data is allocated but left uninitialized.
+    */
+
+    blastmidi_event* output = NULL;
+    *event = NULL;
+
+    if ( instance->event_pool )
+    {
+        output = instance->event_pool;
+        instance->event_pool = output->next;
+    }
+    else
+    {
+        output = ( blastmidi_event* ) allocate_memory ( instance, sizeof ( blastmidi_event ) );
+        if ( output == NULL )
+        {
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+    }
+    memset ( ( void* ) output, 0, sizeof ( blastmidi_event ) );
+    output->track = -1;
+    output->time = 0;
+    output->type = type;
+    output->subtype = subtype;
+    output->channel = -1;
+    output->data = NULL;
+    output->data_size = data_size;
+    output->end_of_sysex = 0;
+    output->previous = NULL;
+    output->next = NULL;
+    if ( data_size == 0 )
+    {
+        output->data = NULL;
+        output->storage = BLASTMIDI_STORAGE_NONE;
+    }
+    else if ( data_size <= sizeof ( output->small_pool ) )
+    {
+        output->data = output->small_pool;
+        output->storage = BLASTMIDI_STORAGE_INLINE;
+    }
+    else
+    {
+        uint8_t* data_block = allocate_payload ( instance, data_size );
+        if ( data_block == NULL )
+        {
+            instance->free_function ( output );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        output->data = data_block;
+        output->storage = payload_is_pooled ( instance, data_size ) ? BLASTMIDI_STORAGE_POOLED : BLASTMIDI_STORAGE_HEAP;
+    }
+
+    if ( data && data_size > 0 )
+    {
+        memcpy ( output->data, data, data_size );
+    }
+
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_channel_event ( blastmidi* instance, uint8_t channel, uint8_t subtype, uint8_t param_1, uint8_t param_2, blastmidi_event** event )
+{
+    blastmidi_event* output = NULL;
+    uint8_t result = 0;
+    uint8_t data[2];
+    unsigned int data_size = 0;
+    uint8_t* temp_ptr8 = NULL;
+    uint16_t temp16 = 0;
+    switch ( subtype )
+    {
+        case BLASTMIDI_CHANNEL_NOTE_OFF:
+        case BLASTMIDI_CHANNEL_NOTE_ON:
+        case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
+        case BLASTMIDI_CHANNEL_CONTROLLER:
+            data_size = 2;
+            data[0] = param_1;
+            data[1] = param_2;
+            break;
+        case BLASTMIDI_CHANNEL_PITCH_BEND:
+            /*
+            * Extract the last 7 bits of both data bytes and combine them into an unsigned 16 bit integer.
+            * The first data byte holds the least significant bits. The resulting integer will be in the native host endian order.
+            */
+            data_size = 2;
+            param_1 = extract_bits_8 ( param_1, 2, 8 );
+            param_2 = extract_bits_8 ( param_2, 2, 8 );
+            temp16 = param_2;
+            temp16 = temp16 << 7;
+            temp16 |= param_1;
+            temp_ptr8 = ( uint8_t* ) &temp16;
+            data[0] = temp_ptr8[0];
+            data[1] = temp_ptr8[1];
+            break;
+        case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
+        case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
+            data_size = 1;
+            data[0] = param_1;
+            break;
+        default:
+            return BLASTMIDI_INVALIDPARAM;
+    };
+
+    result = allocate_event ( instance, BLASTMIDI_CHANNEL_EVENT, subtype, data, data_size, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    output->channel = channel;
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_sequence_number_event ( blastmidi* instance, uint16_t sequence_number, blastmidi_event** event )
+{
+    uint8_t result = 0;
+    blastmidi_event* output = NULL;
+
+    assert ( sizeof ( sequence_number ) == 2 );
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_SEQUENCE_NUMBER, ( uint8_t* ) &sequence_number, sizeof ( sequence_number ), &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_tempo_event ( blastmidi* instance, uint32_t tempo, blastmidi_event** event )
+{
+    blastmidi_event* output = NULL;
+    uint8_t result = 0;
+
+    assert ( sizeof ( tempo ) == 4 );
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_SET_TEMPO, ( uint8_t* ) &tempo, sizeof ( tempo ), &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_data_event ( blastmidi* instance, uint8_t subtype, uint8_t* data, unsigned int data_size, blastmidi_event** event )
+{
+    blastmidi_event* output = NULL;
+    uint8_t result = 0;
+    switch ( subtype )
+    {
         case BLASTMIDI_META_TEXT:
         case BLASTMIDI_META_COPYRIGHT_NOTICE:
         case BLASTMIDI_META_SEQUENCE_OR_TRACK_NAME:
@@ -537,21 +1098,217 @@ uint8_t read_meta_event ( blastmidi* instance, uint8_t* end_of_track, blastmidi_
         case BLASTMIDI_META_MARKER:
         case BLASTMIDI_META_CUE_POINT:
         case BLASTMIDI_META_SEQUENCER_SPECIFIC:
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Data event.\n" );
-#endif
-            result = blastmidi_event_create_meta_data_event ( instance, type, NULL, event_size, event_ptr );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-            result = read_bytes ( instance, event_ptr[0]->data, event_size );
-            if ( result != BLASTMIDI_OK )
+            break;
+        default:
+            return BLASTMIDI_INVALIDPARAM;
+    };
+
+    if ( data && is_internable ( instance, BLASTMIDI_META_EVENT, subtype, data_size ) )
+    {
+        uint8_t* shared = intern_acquire ( instance, data, data_size );
+        if ( shared )
+        {
+            result = allocate_event ( instance, BLASTMIDI_META_EVENT, subtype, NULL, 0, &output );
+            if ( result != BLASTMIDI_OK )
+            {
+                intern_release ( shared );
+                return result;
+            }
+            output->data = shared;
+            output->data_size = data_size;
+            output->storage = BLASTMIDI_STORAGE_SHARED;
+            *event = output;
+            return BLASTMIDI_OK;
+        }
+    }
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, subtype, data, data_size, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_midi_channel_prefix_event ( blastmidi* instance, uint8_t channel, blastmidi_event** event )
+{
+    blastmidi_event* output = NULL;
+    uint8_t result = 0;
+
+    assert ( sizeof ( channel ) == 1 );
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_MIDI_CHANNEL_PREFIX, ( uint8_t* ) &channel, 1, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_time_signature_event ( blastmidi* instance, uint8_t numerator, uint8_t denominator, uint8_t metronome, uint8_t thirtyseconds_per_24_signals, blastmidi_event** event )
+{
+    uint8_t result = 0;
+    blastmidi_event* output = NULL;
+    uint8_t data[4];
+
+    assert ( sizeof ( numerator ) == 1 );
+
+    data[0] = numerator;
+    data[1] = denominator;
+    data[2] = metronome;
+    data[3] = thirtyseconds_per_24_signals;
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_TIME_SIGNATURE, data, 4, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_meta_key_signature_event ( blastmidi* instance, int8_t key, uint8_t scale, blastmidi_event** event )
+{
+    uint8_t result = 0;
+    blastmidi_event* output = NULL;
+    uint8_t data[2];
+
+    assert ( sizeof ( key ) == 1 );
+
+    data[0] = ( uint8_t ) key;
+    data[1] = scale;
+
+    result = allocate_event ( instance, BLASTMIDI_META_EVENT, BLASTMIDI_META_KEY_SIGNATURE, data, 2, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_event_create_sysex_event ( blastmidi* instance, uint8_t* data, unsigned int data_size, uint8_t end_of_sysex, blastmidi_event** event )
+{
+    blastmidi_event* output = NULL;
+    uint8_t result = allocate_event ( instance, BLASTMIDI_SYSEX_EVENT, 0, data, data_size, &output );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    output->end_of_sysex = end_of_sysex;
+    *event = output;
+    return BLASTMIDI_OK;
+}
+
+uint8_t read_meta_event ( blastmidi* instance, uint8_t* end_of_track, uint8_t* dropped, uint32_t* tempo_change, blastmidi_event** event_ptr )
+{
+    uint8_t type = 0;
+    uint32_t event_size = 0;
+    uint8_t result = read_byte ( instance, &type );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    result = read_variable_number ( instance, &event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    if ( mask_drops_meta_event ( instance, type ) )
+    {
+
+        /*
+        * A dropped tempo event still changes the timing of the events that follow, so its value is read all the same.
+        */
+        *dropped = 1;
+        if ( type == BLASTMIDI_META_SET_TEMPO && event_size == 3 )
+        {
+            return read_24_bit ( instance, tempo_change );
+        }
+        return skip_ahead ( instance, event_size );
+    }
+    switch ( type )
+    {
+        case BLASTMIDI_META_SEQUENCE_NUMBER:
+        {
+            uint16_t sequence_number = 0;
+            result = read_16_bit ( instance, &sequence_number );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Sequence number: %u\n", ( uint32_t ) sequence_number );
+#endif
+            result = blastmidi_event_create_meta_sequence_number_event ( instance, sequence_number, event_ptr );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            break;
+        }
+        case BLASTMIDI_META_TEXT:
+        case BLASTMIDI_META_COPYRIGHT_NOTICE:
+        case BLASTMIDI_META_SEQUENCE_OR_TRACK_NAME:
+        case BLASTMIDI_META_INSTRUMENT_NAME:
+        case BLASTMIDI_META_LYRICS:
+        case BLASTMIDI_META_MARKER:
+        case BLASTMIDI_META_CUE_POINT:
+        case BLASTMIDI_META_SEQUENCER_SPECIFIC:
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Data event.\n" );
+#endif
+            result = charge_payload ( instance, event_size );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+
+            /*
+            * A payload that may be interned is looked up in the table straight from the input, so that a payload which the table
+            * already holds needs no allocation at all.
+            */
+            if ( is_internable ( instance, BLASTMIDI_META_EVENT, type, event_size ) && ( instance->memory || event_size <= BLASTMIDI_INTERN_READ_SIZE ) )
+            {
+                uint8_t text[BLASTMIDI_INTERN_READ_SIZE];
+                const uint8_t* source = text;
+                if ( instance->memory )
+                {
+                    result = read_in_place ( instance, &source, event_size );
+                }
+                else
+                {
+                    result = read_bytes ( instance, text, event_size );
+                }
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                result = blastmidi_event_create_meta_data_event ( instance, type, ( uint8_t* ) source, event_size, event_ptr );
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                break;
+            }
+            result = blastmidi_event_create_meta_data_event ( instance, type, NULL, event_size, event_ptr );
+            if ( result != BLASTMIDI_OK )
             {
-                blastmidi_event_free ( instance, *event_ptr );
-                *event_ptr = NULL;
                 return result;
             }
+            if ( event_size > 0 )
+            {
+                result = read_bytes ( instance, event_ptr[0]->data, event_size );
+                if ( result != BLASTMIDI_OK )
+                {
+                    blastmidi_event_free ( instance, *event_ptr );
+                    *event_ptr = NULL;
+                    return result;
+                }
+            }
+            intern_event_payload ( instance, *event_ptr );
             break;
         case BLASTMIDI_META_MIDI_CHANNEL_PREFIX:
         {
@@ -559,948 +1316,3874 @@ uint8_t read_meta_event ( blastmidi* instance, uint8_t* end_of_track, blastmidi_
             result = read_byte ( instance, &channel );
             if ( result != BLASTMIDI_OK )
             {
-                return result;
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Channel prefix event.\nChannel: %u\n", ( uint32_t ) channel );
+#endif
+            result = blastmidi_event_create_meta_midi_channel_prefix_event ( instance, channel, event_ptr );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            break;
+        }
+        case BLASTMIDI_META_END_OF_TRACK:
+            /*
+            * Set the end_of_track variable that we were given, to 1.
+            * This informs the caller that it is time to stop reading events on this particular track.
+            */
+#ifdef BLASTMIDI_DEBUG
+            printf ( "End of track.\n" );
+#endif
+            *end_of_track = 1;
+            break;
+        case BLASTMIDI_META_SET_TEMPO:
+        {
+            uint32_t tempo = 0;
+            result = read_24_bit ( instance, &tempo );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Tempo: %u\n", ( uint32_t ) tempo );
+#endif
+            *tempo_change = tempo;
+            result = blastmidi_event_create_meta_tempo_event ( instance, tempo, event_ptr );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            break;
+        }
+        case BLASTMIDI_META_SMPTE_OFFSET:
+            /*
+            * Todo: Implement support for this. Right now we just skip ahead.
+            */
+            result = skip_ahead ( instance, 5 );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "SMPTE offset.\n" );
+#endif
+            break;
+        case BLASTMIDI_META_TIME_SIGNATURE:
+        {
+            uint8_t numerator = 0;
+            uint8_t denominator = 0;
+            uint8_t metronome = 0;
+            uint8_t thirtyseconds_per_24_signals = 0;
+            result = read_byte ( instance, &numerator );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            result = read_byte ( instance, &denominator );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            result = read_byte ( instance, &metronome );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            result = read_byte ( instance, &thirtyseconds_per_24_signals );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Time signature.\nNumerator: %u\nDenominator: %u\nMetronome: %u\nThirty seconds per 24 signal: %u\n", ( uint32_t ) numerator, ( uint32_t ) denominator, ( uint32_t ) metronome, ( uint32_t ) thirtyseconds_per_24_signals );
+#endif
+            result = blastmidi_event_create_meta_time_signature_event ( instance, numerator, denominator, metronome, thirtyseconds_per_24_signals, event_ptr );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            break;
+        }
+        case BLASTMIDI_META_KEY_SIGNATURE:
+        {
+            int8_t key = 0;
+            uint8_t scale = 0;
+            result = read_byte ( instance, ( uint8_t* ) &key );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            result = read_byte ( instance, &scale );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Key signature.\nKey: %d\nScale: %u\n", ( int32_t ) key, ( uint32_t ) scale );
+#endif
+            result = blastmidi_event_create_meta_key_signature_event ( instance, key, scale, event_ptr );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            break;
+        }
+        default:
+#ifdef BLASTMIDI_DEBUG
+            printf ( "Unknown meta event type.\nType number: %u\nSize: %u\n", ( uint32_t ) type, event_size );
+#endif
+            result = skip_ahead ( instance, event_size );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+    };
+    return BLASTMIDI_OK;
+}
+
+uint8_t read_sysex_event ( blastmidi* instance, blastmidi_event** event_ptr )
+{
+    uint32_t event_size = 0;
+    uint8_t result = read_variable_number ( instance, &event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    if ( event_size == 0 )
+    {
+        /*
+        * This should never happen, but we allow for it.
+        */
+        return BLASTMIDI_OK;
+    }
+
+    result = charge_payload ( instance, event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    result = blastmidi_event_create_sysex_event ( instance, NULL, event_size, 1, event_ptr );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    result = read_bytes ( instance, event_ptr[0]->data, event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        blastmidi_event_free ( instance, *event_ptr );
+        *event_ptr = NULL;
+        return result;
+    }
+
+    /*
+    * Check the last data byte in the message, in order to find out what scenario this is (continuation or the end of the whole message).
+    */
+    if ( event_ptr[0]->data[event_size - 1] == 0xF7 )
+    {
+        /*
+        * This is the end of the entire event. The terminating F7 is not part of the data, so it is dropped.
+        * The payload block stays at least as large as the size class of the smaller data_size, so it is still handed back to a
+        * free list that it fits.
+        */
+        instance->sysex_continuation = 0;
+        event_ptr[0]->data_size--;
+        if ( event_ptr[0]->data_size == 0 )
+        {
+            event_ptr[0]->data = NULL;
+            event_ptr[0]->storage = BLASTMIDI_STORAGE_NONE;
+        }
+    }
+    else
+    {
+        /*
+        * This is not the last part of the sysex continuation event, so we remember the fact that one is ongoing.
+        * We also have to update the end_of_sysex member in our event structure, so that it indicates 0.
+        */
+        instance->sysex_continuation = 1;
+        event_ptr[0]->end_of_sysex = 0;
+    }
+    return BLASTMIDI_OK;
+}
+
+uint8_t read_authorization_sysex_event ( blastmidi* instance, blastmidi_event** event_ptr )
+{
+    uint32_t event_size = 0;
+    uint8_t result = read_variable_number ( instance, &event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    if ( event_size == 0 )
+    {
+        /*
+        * This should never happen, but we allow for it.
+        */
+        return BLASTMIDI_OK;
+    }
+
+    result = charge_payload ( instance, event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    result = blastmidi_event_create_sysex_event ( instance, NULL, event_size, 1, event_ptr );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * The subtype tells these events apart from ordinary system exclusive messages, so that they can be written back the same way.
+    */
+    event_ptr[0]->subtype = BLASTMIDI_SYSEX_ESCAPE;
+
+    result = read_bytes ( instance, event_ptr[0]->data, event_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        blastmidi_event_free ( instance, *event_ptr );
+        *event_ptr = NULL;
+        return result;
+    }
+
+    return BLASTMIDI_OK;
+}
+
+/*
+* The read_window structure describes how much of a track blastmidi_read keeps when a read end is set.
+* tick_limit is the last absolute tick that is read. If timed is nonzero, time_limit is the last time that is read, and the time
+* of every event is measured with the tempo events seen so far on the track: tempo is the tempo in effect from tempo_tick onwards,
+* and tempo_elapsed is the time at tempo_tick. Both times are in microseconds multiplied by the ticks per beat, which keeps the
+* arithmetic exact.
+*/
+typedef struct read_window
+{
+    uint64_t tick_limit;
+    uint64_t time_limit;
+    uint64_t tempo_tick;
+    uint64_t tempo_elapsed;
+    uint32_t tempo;
+    uint8_t timed;
+} read_window;
+
+uint8_t window_passed ( const read_window* window, uint64_t tick )
+{
+    if ( tick > window->tick_limit )
+    {
+        return 1;
+    }
+    return window->timed && window->tempo_elapsed + ( tick - window->tempo_tick ) * window->tempo > window->time_limit;
+}
+
+void window_change_tempo ( read_window* window, uint64_t tick, uint32_t tempo )
+{
+    window->tempo_elapsed += ( tick - window->tempo_tick ) * window->tempo;
+    window->tempo_tick = tick;
+    window->tempo = tempo;
+}
+
+uint8_t skip_sysex_event ( blastmidi* instance, uint8_t status )
+{
+
+    /*
+    * Skips a system exclusive event that the read mask drops. Whether a message is still open decides how the next F7 packet
+    * is read, so the last data byte of a packet that belongs to a message is read to keep track of that.
+    */
+    uint32_t event_size = 0;
+    uint8_t last = 0;
+    uint8_t result = read_variable_number ( instance, &event_size );
+    if ( result != BLASTMIDI_OK || event_size == 0 )
+    {
+        return result;
+    }
+    if ( status == 0xF7 && instance->sysex_continuation == 0 )
+    {
+        return skip_ahead ( instance, event_size );
+    }
+    result = skip_ahead ( instance, event_size - 1 );
+    if ( result == BLASTMIDI_OK )
+    {
+        result = read_byte ( instance, &last );
+    }
+    instance->sysex_continuation = last != 0xF7;
+    return result;
+}
+
+uint8_t read_track_events ( blastmidi* instance, uint16_t track_id, read_window* window, uint8_t* masked, uint8_t* truncated )
+{
+
+    /*
+    * Read all the events in a loop, breaking out either when an error occurs or when the end of track meta event is encountered.
+    * The delta times of events that are not stored are collected in pending_time, and added to the next event that is.
+    * If the window ends before the end of the track, truncated is set and the rest of the track is left unread.
+    */
+    uint32_t pending_time = 0;
+    uint64_t tick = 0;
+
+    while ( 1 )
+    {
+
+        blastmidi_event* event = NULL;
+        /*
+        * This is the event that we are about to create.
+        */
+
+        /*
+        * Begin by reading the delta time.
+        */
+        uint32_t delta_time = 0;
+        uint8_t event_type = 0;
+
+        uint8_t end_of_track = 0;
+        /*
+        * This variable is passed to read_meta_event, and gets set to 1 if the end of track meta event is encountered.
+        */
+
+        uint8_t dropped = 0;
+        /*
+        * This variable is set to 1 if the read mask drops the event.
+        */
+
+        uint32_t tempo_change = 0;
+        /*
+        * This variable is set to the new tempo if the event is a tempo event, whether or not it is stored.
+        */
+
+        uint8_t result = read_variable_number ( instance, &delta_time );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Delta time: %u\n", ( uint32_t ) delta_time );
+#endif
+        if ( delta_time > 0xFFFFFFFFUL - pending_time )
+        {
+            return BLASTMIDI_INVALIDCHUNK;
+        }
+        pending_time += delta_time;
+        tick += delta_time;
+        if ( window_passed ( window, tick ) )
+        {
+            *truncated = 1;
+            break;
+        }
+
+        /*
+        * Read the event type specifier.
+        */
+        result = read_byte ( instance, &event_type );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+
+        result = charge_event ( instance );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+
+        switch ( event_type )
+        {
+            case 0xFF:
+                result = read_meta_event ( instance, &end_of_track, &dropped, &tempo_change, &event );
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                break;
+            case 0xF0:
+#ifdef BLASTMIDI_DEBUG
+                printf ( "SysEx event.\n" );
+#endif
+                if ( instance->read_mask.event_types & ( 1 << BLASTMIDI_SYSEX_EVENT ) )
+                {
+                    dropped = 1;
+                    result = skip_sysex_event ( instance, event_type );
+                }
+                else
+                {
+                    result = read_sysex_event ( instance, &event );
+                }
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                break;
+            case 0xF7:
+                /*
+                * This is either a part of a continuation sysex event, or a single authorization sysex event.
+                * We determine this by checking the sysex_continuation flag in the blastmidi structure.
+                */
+                if ( instance->read_mask.event_types & ( 1 << BLASTMIDI_SYSEX_EVENT ) )
+                {
+                    dropped = 1;
+                    result = skip_sysex_event ( instance, event_type );
+                }
+                else if ( instance->sysex_continuation == 1 )
+                {
+#ifdef BLASTMIDI_DEBUG
+                    printf ( "Continued SysEx event.\n" );
+#endif
+                    result = read_sysex_event ( instance, &event );
+                }
+                else
+                {
+#ifdef BLASTMIDI_DEBUG
+                    printf ( "Authorization SysEx event.\n" );
+#endif
+                    result = read_authorization_sysex_event ( instance, &event );
+                }
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                break;
+            default:
+            {
+                uint8_t midi_event_type = 0;
+                uint8_t channel = 0;
+                uint8_t new_status_bit = extract_bits_8 ( event_type, 1, 1 );
+                if ( new_status_bit == 0 )
+                {
+                    /*
+                    * This is a so called running status event, which means that the status byte is the same as for our last event.
+                    * Therefore, we reuse that status byte and treat this byte as the first data byte of the event.
+                    */
+                    event_type = instance->running_status;
+                    skip_backwards ( instance, 1 );
+                }
+                instance->running_status = event_type;
+                midi_event_type = extract_bits_8 ( event_type, 1, 4 );
+                channel = extract_bits_8 ( event_type, 5, 8 );
+#ifdef BLASTMIDI_DEBUG
+                printf ( "Midi event type: %u\nChannel: %u\n", ( uint32_t ) midi_event_type, ( uint32_t ) channel );
+#endif
+
+                switch ( midi_event_type )
+                {
+                    case BLASTMIDI_CHANNEL_NOTE_OFF:
+                    case BLASTMIDI_CHANNEL_NOTE_ON:
+                    case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
+                    case BLASTMIDI_CHANNEL_CONTROLLER:
+                    case BLASTMIDI_CHANNEL_PITCH_BEND:
+                    {
+                        uint8_t first = 0;
+                        uint8_t second = 0;
+                        result = read_byte ( instance, &first );
+                        if ( result != BLASTMIDI_OK )
+                        {
+                            return result;
+                        }
+                        result = read_byte ( instance, &second );
+                        if ( result != BLASTMIDI_OK )
+                        {
+                            return result;
+                        }
+                        if ( mask_drops_channel_event ( instance, midi_event_type, channel, first ) )
+                        {
+                            dropped = 1;
+                            break;
+                        }
+                        result = blastmidi_event_create_channel_event ( instance, channel, midi_event_type, first, second, &event );
+                        if ( result != BLASTMIDI_OK )
+                        {
+#ifdef BLASTMIDI_DEBUG
+                            printf ( "Event creation error with two arguments.\n" );
+#endif
+                            return result;
+                        }
+                        break;
+                    }
+                    case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
+                    case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
+                    {
+                        uint8_t first = 0;
+                        result = read_byte ( instance, &first );
+                        if ( result != BLASTMIDI_OK )
+                        {
+                            return result;
+                        }
+                        if ( mask_drops_channel_event ( instance, midi_event_type, channel, first ) )
+                        {
+                            dropped = 1;
+                            break;
+                        }
+                        result = blastmidi_event_create_channel_event ( instance, channel, midi_event_type, first, 0, &event );
+                        if ( result != BLASTMIDI_OK )
+                        {
+                            return result;
+                        }
+                        break;
+                    }
+                    default:
+#ifdef BLASTMIDI_DEBUG
+                        printf ( "This is an unknown Midi channel event.\n" );
+#endif
+                        if ( event )
+                        {
+                            blastmidi_event_free ( instance, event );
+                        }
+                        return BLASTMIDI_INVALIDCHUNK;
+                };
+            }
+        };
+
+        /*
+        * If event is not NULL, we add it to the end of the track.
+        */
+        if ( event )
+        {
+            result = blastmidi_add_event_to_end_of_track ( instance, track_id, event, pending_time );
+            if ( result != BLASTMIDI_OK )
+            {
+                blastmidi_event_free ( instance, event );
+                return result;
+            }
+            BLASTMIDI_STAT_ADD ( instance, events[event->type], 1 );
+            pending_time = 0;
+        }
+        if ( dropped )
+        {
+            *masked = 1;
+        }
+        if ( tempo_change > 0 )
+        {
+            window_change_tempo ( window, tick, tempo_change );
+        }
+
+        if ( end_of_track )
+        {
+
+            /*
+            * The end of track meta event was encountered, so we break out of the loop and return.
+            */
+            break;
+        }
+
+    }
+
+    return BLASTMIDI_OK;
+}
+
+uint8_t read_track ( blastmidi* instance, uint16_t track_id, read_window* window )
+{
+
+    /*
+    * Begin by reading and verifying the header.
+    * A track chunk should have a type of MTrk. We make a temporary storage of 5 bytes, and NULL terminate the string.
+    */
+    uint8_t temp[5];
+    uint32_t chunk_size = 0;
+    size_t chunk_start = instance->cursor;
+    uint8_t masked = 0;
+    uint8_t truncated = 0;
+
+    uint8_t result = read_bytes ( instance, temp, 4 );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    temp[4] = 0;
+    if ( strcmp ( ( const char* ) temp, "MTrk" ) != 0 )
+    {
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Invalid chunk.\n" );
+#endif
+        return BLASTMIDI_INVALIDCHUNK;
+    }
+
+    result = read_32_bit ( instance, &chunk_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    if ( chunk_size == 0 )
+    {
+        return BLASTMIDI_INVALIDCHUNK;
+    }
+
+    instance->running_status = 0;
+    instance->sysex_continuation = 0;
+
+    result = read_track_events ( instance, track_id, window, &masked, &truncated );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * A track that ends at the read end is left unread from there on, so the reading continues at the end of its chunk.
+    */
+    if ( truncated )
+    {
+        size_t chunk_end = chunk_start + 8 + ( size_t ) chunk_size;
+        if ( instance->cursor > chunk_end )
+        {
+            return BLASTMIDI_INVALIDCHUNK;
+        }
+        result = skip_ahead ( instance, chunk_end - instance->cursor );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+    }
+
+    /*
+    * Remember where the chunk was, so that it can be copied as it is when the file is saved. Adding the events has marked the
+    * track as dirty, so this is the point where it becomes clean. A chunk whose size does not match the events in it cannot be
+    * copied safely, so such a track stays dirty, and so does a track from which the read mask has dropped events or which has
+    * only been read up to the read end.
+    */
+    instance->track_sources[track_id].offset = chunk_start;
+    instance->track_sources[track_id].size = ( size_t ) chunk_size + 8;
+    instance->track_sources[track_id].dirty = masked || truncated || instance->cursor - chunk_start != ( size_t ) chunk_size + 8;
+    return BLASTMIDI_OK;
+}
+
+uint8_t read_header ( blastmidi* instance )
+{
+
+    /*
+    * Read the header chunk.
+    * This header chunk should have a type of MThd. We make a temporary storage of 5 bytes, and NULL terminate the string.
+    */
+    uint8_t temp[5];
+    uint32_t header_size = 0;
+    uint16_t file_type = 0;
+    uint16_t tracks = 0;
+    uint16_t time_division = 0;
+    uint8_t time_type = 0;
+
+    uint8_t result = read_bytes ( instance, temp, 4 );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+    temp[4] = 0;
+    if ( strcmp ( ( const char* ) temp, "MThd" ) != 0 )
+    {
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Invalid chunk.\n" );
+#endif
+        return BLASTMIDI_INVALID;
+    }
+
+    result = read_32_bit ( instance, &header_size );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * The header chunk should always have a size of 6.
+    */
+    if ( header_size != 6 )
+    {
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Invalid chunk header size.\nReported: %u\n", ( uint32_t ) header_size );
+#endif
+        return BLASTMIDI_INVALID;
+    }
+
+    /*
+    * First, we read the type of the Midi file. It is stored in the first 2 bytes of the header data.
+    */
+    result = read_16_bit ( instance, &file_type );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * The type must be either 0, 1 or 2. Verify this.
+    */
+    if ( file_type != 0 && file_type != 1 && file_type != 2 )
+    {
+        return BLASTMIDI_INVALID;
+    }
+#ifdef BLASTMIDI_DEBUG
+    printf ( "File type: %u\n", ( uint32_t ) file_type );
+#endif
+    instance->file_type = ( uint8_t ) file_type;
+
+    /*
+    * Read the number of track chunks that are supposed to be in the file.
+    */
+    result = read_16_bit ( instance, &tracks );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * There must always be at least one track. Verify this.
+    */
+    if ( tracks == 0 )
+    {
+        return BLASTMIDI_INVALID;
+    }
+
+    instance->track_count = tracks;
+
+#ifdef BLASTMIDI_DEBUG
+    printf ( "Tracks: %u\n", ( uint32_t ) tracks );
+#endif
+
+    /*
+    * Read the time division.
+    */
+    result = read_16_bit ( instance, &time_division );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * Figure out what the time measurement is, by reading the most significant bit.
+    */
+    time_type = ( uint8_t ) extract_bits_16 ( time_division, 1, 1 );
+#ifdef BLASTMIDI_DEBUG
+    printf ( "Time type: %u\n", ( uint32_t ) time_type );
+#endif
+    /*
+    * Not really necessary, but we verify anyway just to be pedantic.
+    */
+    if ( time_type != 0 && time_type != 1 )
+    {
+#ifdef BLASTMIDI_DEBUG
+        printf ( "This should never happen.\nTime type is %u.\n", ( uint32_t ) time_type );
+#endif
+        return BLASTMIDI_INVALID;
+    }
+
+    /*
+    * Handle the time type possibilities.
+    */
+    if ( time_type == 0 )
+    {
+
+        /*
+        * The time type specifies ticks per beat. Extract the following 15 bits to get the correct value.
+        */
+        uint16_t ticks_per_beat = extract_bits_16 ( time_division, 2, 16 );
+
+        /*
+        * This value must be greater than 0. Verify that.
+        */
+        if ( ticks_per_beat == 0 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        instance->ticks_per_beat = ticks_per_beat;
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Ticks per beat: %u\n", ( uint32_t ) ticks_per_beat );
+#endif
+    }
+    else
+    {
+
+        /*
+        * The time type specifies frames per second. First figure out the number of SMPTE frames.
+        */
+        int8_t SMPTE_frames = 0;
+        uint8_t ticks_per_frame = 0;
+
+        SMPTE_frames = ( int8_t ) extract_bits_16 ( time_division, 1, 8 );
+        SMPTE_frames = abs ( SMPTE_frames );
+#ifdef BLASTMIDI_DEBUG
+        printf ( "SMPTE frames: %d\n", ( int32_t ) SMPTE_frames );
+#endif
+        /*
+        * This value must be either 24, 25, 29 or 30. Verify that it is.
+        */
+        if ( SMPTE_frames != 24 && SMPTE_frames != 25 && SMPTE_frames != 29 && SMPTE_frames != 30 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+
+        /*
+        * Now extract the ticks per frame.
+        */
+        ticks_per_frame = ( uint8_t ) extract_bits_16 ( time_division, 9, 16 );
+
+        /*
+        * This value must be greater than 0. Verify that.
+        */
+        if ( ticks_per_frame == 0 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+#ifdef BLASTMIDI_DEBUG
+        printf ( "Ticks per frame: %u\n", ( uint32_t ) ticks_per_frame );
+#endif
+        instance->SMPTE_frames = ( uint8_t ) SMPTE_frames;
+        instance->ticks_per_frame = ticks_per_frame;
+    }
+    instance->time_type = time_type;
+    return BLASTMIDI_OK;
+}
+
+#ifdef BLASTMIDI_STATS
+void reset_stats ( blastmidi* instance )
+{
+    double* track_times = instance->stats.track_times;
+    uint16_t track_time_capacity = instance->stats.track_time_capacity;
+    memset ( ( void* ) &instance->stats, 0, sizeof ( blastmidi_stats ) );
+    instance->stats.track_times = track_times;
+    instance->stats.track_time_capacity = track_time_capacity;
+}
+
+void reserve_track_times ( blastmidi* instance )
+{
+
+    /*
+    * The per track timings are instrumentation rather than parser state, so they are neither counted as allocations nor treated
+    * as an error if they cannot be allocated. In that case they are simply not recorded.
+    */
+
+    if ( instance->stats.track_time_capacity < instance->track_count )
+    {
+        if ( instance->stats.track_times )
+        {
+            instance->free_function ( instance->stats.track_times );
+        }
+        instance->stats.track_times = ( double* ) instance->malloc_function ( sizeof ( double ) * instance->track_count );
+        instance->stats.track_time_capacity = instance->stats.track_times ? instance->track_count : 0;
+    }
+    instance->stats.track_time_count = instance->stats.track_times ? instance->track_count : 0;
+    if ( instance->stats.track_times )
+    {
+        memset ( ( void* ) instance->stats.track_times, 0, sizeof ( double ) * instance->track_count );
+    }
+}
+
+void blastmidi_get_stats ( blastmidi* instance, blastmidi_stats* stats )
+{
+    *stats = instance->stats;
+}
+#endif
+
+uint8_t read_file ( blastmidi* instance )
+{
+
+    uint8_t result = 0;
+    uint16_t i;
+    read_window window;
+    uint64_t tick_limit = 0;
+#ifdef BLASTMIDI_STATS
+    double phase_start = 0;
+#endif
+
+    /*
+    * First of all, we reset the instance.
+    */
+    reset ( instance );
+#ifdef BLASTMIDI_STATS
+    reset_stats ( instance );
+    phase_start = stats_get_time();
+#endif
+
+    /*
+    * Now it is time to read the header.
+    */
+    result = read_header ( instance );
+#ifdef BLASTMIDI_STATS
+    instance->stats.header_time = stats_get_time() - phase_start;
+#endif
+    if ( result != BLASTMIDI_OK )
+    {
+        reset ( instance );
+        return result;
+    }
+
+    /*
+    * Allocate memory for all the tracks. The number of tracks to allocate has already been stored in instance->track_count.
+    */
+    result = charge_memory ( instance, ( 2 * sizeof ( blastmidi_event* ) + sizeof ( blastmidi_track_source ) ) * instance->track_count );
+    if ( result != BLASTMIDI_OK )
+    {
+        reset ( instance );
+        return result;
+    }
+    result = allocate_tracks ( instance );
+    if ( result != BLASTMIDI_OK )
+    {
+        reset ( instance );
+        return result;
+    }
+
+    /*
+    * Work out the read end. With SMPTE timing every tick stands for a fixed time, so a time limit is simply a tick limit.
+    * Otherwise the time depends on the tempo, which every track measures with its own tempo events, except that the tracks of a
+    * type 1 file after the first take their tempo map from the first track. For them, the time limit becomes the tick at which
+    * it is reached on the first track.
+    */
+    tick_limit = instance->read_end_tick ? instance->read_end_tick : UINT64_MAX;
+    if ( instance->read_end_seconds > 0 && instance->time_type == 1 )
+    {
+        double frames = instance->SMPTE_frames == 29 ? 30000.0 / 1001.0 : ( double ) instance->SMPTE_frames;
+        double ticks = instance->read_end_seconds * frames * instance->ticks_per_frame;
+        if ( ticks < ( double ) tick_limit )
+        {
+            tick_limit = ( uint64_t ) ticks;
+        }
+    }
+
+    /*
+    * Read the tracks.
+    */
+#ifdef BLASTMIDI_STATS
+    reserve_track_times ( instance );
+#endif
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+#ifdef BLASTMIDI_STATS
+        phase_start = stats_get_time();
+#endif
+        memset ( ( void* ) &window, 0, sizeof ( read_window ) );
+        window.tick_limit = tick_limit;
+        window.tempo = 500000;
+        window.timed = instance->read_end_seconds > 0 && instance->time_type == 0 && ( instance->file_type != 1 || i == 0 );
+        if ( window.timed )
+        {
+            double time_limit = instance->read_end_seconds * 1000000.0 * instance->ticks_per_beat;
+            window.time_limit = time_limit < ( double ) UINT64_MAX ? ( uint64_t ) time_limit : UINT64_MAX;
+        }
+        result = read_track ( instance, i, &window );
+        if ( result == BLASTMIDI_OK && window.timed && instance->file_type == 1 )
+        {
+            uint64_t end = window.tempo_tick + ( window.time_limit - window.tempo_elapsed ) / window.tempo;
+            if ( end < tick_limit )
+            {
+                tick_limit = end;
+            }
+        }
+#ifdef BLASTMIDI_STATS
+        if ( i < instance->stats.track_time_count )
+        {
+            instance->stats.track_times[i] = stats_get_time() - phase_start;
+        }
+#endif
+        if ( result != BLASTMIDI_OK )
+        {
+            reset ( instance );
+            return result;
+        }
+    }
+    instance->valid = 1;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_read ( blastmidi* instance )
+{
+
+    /*
+    * Did the user forget to give us an I/O callback?
+    */
+    if ( instance->data_callback == NULL )
+    {
+        return BLASTMIDI_NOCALLBACK;
+    }
+    instance->memory = NULL;
+    instance->memory_size = 0;
+    return read_file ( instance );
+}
+
+uint8_t blastmidi_read_memory ( blastmidi* instance, const uint8_t* buffer, size_t size )
+{
+    uint8_t result = 0;
+    if ( buffer == NULL || size == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    instance->memory = buffer;
+    instance->memory_size = size;
+    result = read_file ( instance );
+    instance->memory = NULL;
+    instance->memory_size = 0;
+    return result;
+}
+
+/*
+* The largest delta time or payload size that a variable length quantity can hold.
+*/
+#define BLASTMIDI_VARIABLE_NUMBER_MAX 0x0FFFFFFF
+
+/*
+* The encoder writes to output only if it is not NULL, so that a first pass can compute the size of the chunk with exactly the
+* same code that later fills it in.
+*/
+#define ENCODE_BYTE(value) \
+    do \
+    { \
+        if ( output ) \
+        { \
+            output[position] = ( uint8_t ) ( value ); \
+        } \
+        ++position; \
+    } \
+    while ( 0 )
+
+size_t encode_variable_number ( uint8_t* output, uint32_t value )
+{
+    uint8_t bytes[4];
+    size_t count = 0;
+    size_t i;
+    assert ( value <= BLASTMIDI_VARIABLE_NUMBER_MAX );
+    do
+    {
+        bytes[count++] = ( uint8_t ) ( value & 0x7F );
+        value >>= 7;
+    }
+    while ( value );
+    if ( output )
+    {
+        for ( i = 0; i < count; ++i )
+        {
+            output[i] = bytes[count - 1 - i] | ( i + 1 < count ? 0x80 : 0 );
+        }
+    }
+    return count;
+}
+
+void encode_32_bit ( uint8_t* output, uint32_t value )
+{
+    output[0] = ( uint8_t ) ( value >> 24 );
+    output[1] = ( uint8_t ) ( value >> 16 );
+    output[2] = ( uint8_t ) ( value >> 8 );
+    output[3] = ( uint8_t ) value;
+}
+
+/*
+* The running status and whether a system exclusive message is still open carry over from one event to the next, so they are
+* kept here for the encoder.
+*/
+typedef struct encoder_state
+{
+    uint8_t running_status;
+    uint8_t in_sysex;
+} encoder_state;
+
+size_t encode_event ( uint8_t* output, const blastmidi_event* event, uint32_t delta_time, encoder_state* state )
+{
+
+    /*
+    * Encodes a single event, preceded by its delta time, and returns the number of bytes it takes up.
+    * The caller must have checked that the delta time and the payload size can be stored as variable length quantities.
+    */
+    size_t position = encode_variable_number ( output, delta_time );
+
+    if ( event->type == BLASTMIDI_CHANNEL_EVENT )
+    {
+        uint8_t status = ( uint8_t ) ( ( event->subtype << 4 ) | ( event->channel & 15 ) );
+        if ( status != state->running_status )
+        {
+            ENCODE_BYTE ( status );
+            state->running_status = status;
+        }
+        if ( event->subtype == BLASTMIDI_CHANNEL_PITCH_BEND )
+        {
+            uint16_t bend = 8192;
+            if ( event->data_size >= sizeof ( uint16_t ) )
+            {
+                memcpy ( ( void* ) &bend, ( void* ) event->data, sizeof ( uint16_t ) );
+            }
+            ENCODE_BYTE ( bend & 0x7F );
+            ENCODE_BYTE ( ( bend >> 7 ) & 0x7F );
+        }
+        else
+        {
+            ENCODE_BYTE ( event->data_size > 0 ? event->data[0] & 0x7F : 0 );
+            if ( event->subtype != BLASTMIDI_CHANNEL_PROGRAM_CHANGE && event->subtype != BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH )
+            {
+                ENCODE_BYTE ( event->data_size > 1 ? event->data[1] & 0x7F : 0 );
+            }
+        }
+        return position;
+    }
+
+    /*
+    * Meta and system exclusive events cancel running status.
+    */
+    state->running_status = 0;
+
+    if ( event->type == BLASTMIDI_META_EVENT )
+    {
+        ENCODE_BYTE ( 0xFF );
+        ENCODE_BYTE ( event->subtype );
+        if ( event->subtype == BLASTMIDI_META_SEQUENCE_NUMBER && event->data_size == 2 )
+        {
+            uint16_t sequence_number = 0;
+            memcpy ( ( void* ) &sequence_number, ( void* ) event->data, 2 );
+            ENCODE_BYTE ( 2 );
+            ENCODE_BYTE ( sequence_number >> 8 );
+            ENCODE_BYTE ( sequence_number );
+        }
+        else if ( event->subtype == BLASTMIDI_META_SET_TEMPO && event->data_size == 4 )
+        {
+            uint32_t tempo = 0;
+            memcpy ( ( void* ) &tempo, ( void* ) event->data, 4 );
+            ENCODE_BYTE ( 3 );
+            ENCODE_BYTE ( tempo >> 16 );
+            ENCODE_BYTE ( tempo >> 8 );
+            ENCODE_BYTE ( tempo );
+        }
+        else
+        {
+            position += encode_variable_number ( output ? output + position : NULL, event->data_size );
+            if ( output && event->data_size > 0 )
+            {
+                memcpy ( ( void* ) ( output + position ), ( void* ) event->data, event->data_size );
+            }
+            position += event->data_size;
+        }
+        return position;
+    }
+
+    /*
+    * A system exclusive message starts with F0, and the packets that continue it as well as escape events start with F7.
+    * The terminating F7 is counted in the length of the final packet.
+    */
+    if ( event->subtype == BLASTMIDI_SYSEX_ESCAPE )
+    {
+        ENCODE_BYTE ( 0xF7 );
+        position += encode_variable_number ( output ? output + position : NULL, event->data_size );
+    }
+    else
+    {
+        ENCODE_BYTE ( state->in_sysex ? 0xF7 : 0xF0 );
+        position += encode_variable_number ( output ? output + position : NULL, event->data_size + ( event->end_of_sysex ? 1 : 0 ) );
+        state->in_sysex = event->end_of_sysex == 0;
+    }
+    if ( output && event->data_size > 0 )
+    {
+        memcpy ( ( void* ) ( output + position ), ( void* ) event->data, event->data_size );
+    }
+    position += event->data_size;
+    if ( event->subtype != BLASTMIDI_SYSEX_ESCAPE && event->end_of_sysex )
+    {
+        ENCODE_BYTE ( 0xF7 );
+    }
+    return position;
+}
+
+size_t encode_end_of_track ( uint8_t* output, uint32_t delta_time )
+{
+    size_t position = encode_variable_number ( output, delta_time );
+    ENCODE_BYTE ( 0xFF );
+    ENCODE_BYTE ( BLASTMIDI_META_END_OF_TRACK );
+    ENCODE_BYTE ( 0 );
+    return position;
+}
+
+void encode_chunk_header ( uint8_t* output, size_t size )
+{
+    memcpy ( ( void* ) output, "MTrk", 4 );
+    encode_32_bit ( output + 4, ( uint32_t ) ( size - 8 ) );
+}
+
+uint8_t encode_track ( blastmidi* instance, uint16_t track_id, uint8_t* output, size_t* size )
+{
+
+    /*
+    * Encodes the given track as a complete MTrk chunk, including its 8 byte header, and stores the size of the chunk in size.
+    * If output is NULL, only the size is computed.
+    * End of track events are only written at the very end of the track. The parser does not keep them, so one is added if the
+    * track does not have one, and the delta times of any that sit in the middle of the track are carried over to the next event.
+    */
+    const blastmidi_event* event = NULL;
+    size_t position = 8;
+    uint32_t delta_time = 0;
+    encoder_state state;
+    uint8_t end_of_track = 0;
+
+    memset ( ( void* ) &state, 0, sizeof ( encoder_state ) );
+    for ( event = instance->tracks[track_id]; event; event = event->next )
+    {
+        if ( event->time > BLASTMIDI_VARIABLE_NUMBER_MAX - delta_time )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        delta_time += event->time;
+        if ( event->type == BLASTMIDI_META_EVENT && event->subtype == BLASTMIDI_META_END_OF_TRACK )
+        {
+            if ( event->next )
+            {
+                continue;
+            }
+            end_of_track = 1;
+        }
+        if ( event->type != BLASTMIDI_CHANNEL_EVENT && event->data_size > BLASTMIDI_VARIABLE_NUMBER_MAX - 1 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        position += encode_event ( output ? output + position : NULL, event, delta_time, &state );
+        delta_time = 0;
+    }
+
+    if ( !end_of_track )
+    {
+        position += encode_end_of_track ( output ? output + position : NULL, delta_time );
+    }
+    if ( position - 8 > 0xFFFFFFFFUL )
+    {
+        return BLASTMIDI_INVALID;
+    }
+    if ( output )
+    {
+        encode_chunk_header ( output, position );
+    }
+    *size = position;
+    return BLASTMIDI_OK;
+}
+
+#undef ENCODE_BYTE
+
+void encode_header ( blastmidi* instance, uint8_t* output )
+{
+
+    /*
+    * Encodes the 14 byte header chunk. For SMPTE timing, the upper byte of the division holds the negated number of frames per second.
+    */
+    memcpy ( ( void* ) output, "MThd", 4 );
+    encode_32_bit ( output + 4, 6 );
+    output[8] = 0;
+    output[9] = instance->file_type;
+    output[10] = ( uint8_t ) ( instance->track_count >> 8 );
+    output[11] = ( uint8_t ) instance->track_count;
+    if ( instance->time_type == 0 )
+    {
+        output[12] = ( uint8_t ) ( ( instance->ticks_per_beat >> 8 ) & 0x7F );
+        output[13] = ( uint8_t ) instance->ticks_per_beat;
+    }
+    else
+    {
+        output[12] = ( uint8_t ) ( 256 - instance->SMPTE_frames );
+        output[13] = instance->ticks_per_frame;
+    }
+}
+
+uint8_t track_source_is_usable ( blastmidi* instance, uint16_t track_id, const uint8_t* source, size_t source_size )
+{
+    const blastmidi_track_source* track_source = &instance->track_sources[track_id];
+    uint8_t size[4];
+    if ( track_source->offset > source_size || track_source->size < 8 || track_source->size > source_size - track_source->offset )
+    {
+        return 0;
+    }
+    encode_32_bit ( size, ( uint32_t ) ( track_source->size - 8 ) );
+    return memcmp ( ( void* ) ( source + track_source->offset ), "MTrk", 4 ) == 0 && memcmp ( ( void* ) ( source + track_source->offset + 4 ), ( void* ) size, 4 ) == 0;
+}
+
+uint8_t write_file ( blastmidi* instance, const uint8_t* source, size_t source_size, const uint8_t* const* chunks, const size_t* chunk_sizes )
+{
+    uint8_t header[14];
+    size_t* sizes = NULL;
+    uint8_t* buffer = NULL;
+    size_t buffer_size = 0;
+    size_t offset = 0;
+    uint8_t result = BLASTMIDI_OK;
+    uint16_t i;
+
+    if ( instance == NULL || instance->tracks == NULL || instance->track_count == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( instance->data_callback == NULL )
+    {
+        return BLASTMIDI_NOCALLBACK;
+    }
+
+    /*
+    * Work out the size of every chunk before anything is written, so that a track which cannot be encoded or a source which does
+    * not match the instance is reported without leaving a partial file behind. Tracks that are neither copied nor already encoded
+    * by the caller are encoded here, one at a time, in a buffer the size of the largest of them.
+    */
+    sizes = ( size_t* ) allocate_memory ( instance, sizeof ( size_t ) * instance->track_count );
+    if ( sizes == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        if ( source && !instance->track_sources[i].dirty )
+        {
+            if ( !track_source_is_usable ( instance, i, source, source_size ) )
+            {
+                instance->free_function ( sizes );
+                return BLASTMIDI_INVALIDPARAM;
+            }
+            sizes[i] = instance->track_sources[i].size;
+            continue;
+        }
+        if ( chunks )
+        {
+            if ( chunks[i] == NULL || chunk_sizes[i] < 8 )
+            {
+                instance->free_function ( sizes );
+                return BLASTMIDI_INVALIDPARAM;
+            }
+            sizes[i] = chunk_sizes[i];
+            continue;
+        }
+        result = encode_track ( instance, i, NULL, &sizes[i] );
+        if ( result != BLASTMIDI_OK )
+        {
+            instance->free_function ( sizes );
+            return result;
+        }
+        if ( sizes[i] > buffer_size )
+        {
+            buffer_size = sizes[i];
+        }
+    }
+    if ( buffer_size > 0 )
+    {
+        buffer = ( uint8_t* ) allocate_memory ( instance, buffer_size );
+        if ( buffer == NULL )
+        {
+            instance->free_function ( sizes );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+    }
+
+    encode_header ( instance, header );
+    if ( write_bytes ( instance, header, 14 ) != BLASTMIDI_OK )
+    {
+        result = BLASTMIDI_WRITINGFAILED;
+    }
+
+    for ( i = 0; i < instance->track_count && result == BLASTMIDI_OK; ++i )
+    {
+        if ( source && !instance->track_sources[i].dirty )
+        {
+            if ( write_bytes ( instance, ( uint8_t* ) ( source + instance->track_sources[i].offset ), sizes[i] ) != BLASTMIDI_OK )
+            {
+                result = BLASTMIDI_WRITINGFAILED;
+            }
+            continue;
+        }
+        if ( chunks )
+        {
+            if ( write_bytes ( instance, ( uint8_t* ) chunks[i], sizes[i] ) != BLASTMIDI_OK )
+            {
+                result = BLASTMIDI_WRITINGFAILED;
+            }
+            continue;
+        }
+        result = encode_track ( instance, i, buffer, &sizes[i] );
+        if ( result == BLASTMIDI_OK && write_bytes ( instance, buffer, sizes[i] ) != BLASTMIDI_OK )
+        {
+            result = BLASTMIDI_WRITINGFAILED;
+        }
+    }
+
+    /*
+    * The bytes that were just written are now the source of every track.
+    */
+    if ( result == BLASTMIDI_OK )
+    {
+        offset = 14;
+        for ( i = 0; i < instance->track_count; ++i )
+        {
+            instance->track_sources[i].offset = offset;
+            instance->track_sources[i].size = sizes[i];
+            instance->track_sources[i].dirty = 0;
+            offset += sizes[i];
+        }
+    }
+    if ( buffer )
+    {
+        instance->free_function ( buffer );
+    }
+    instance->free_function ( sizes );
+    return result;
+}
+
+uint8_t blastmidi_write ( blastmidi* instance )
+{
+    return write_file ( instance, NULL, 0, NULL, NULL );
+}
+
+uint8_t blastmidi_write_incremental ( blastmidi* instance, const uint8_t* source, size_t source_size )
+{
+    if ( source == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return write_file ( instance, source, source_size, NULL, NULL );
+}
+
+uint8_t blastmidi_encode_track ( blastmidi* instance, uint16_t track_id, uint8_t* buffer, size_t capacity, size_t* size )
+{
+    uint8_t result = 0;
+    if ( instance == NULL || size == NULL || instance->tracks == NULL || track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    result = encode_track ( instance, track_id, NULL, size );
+    if ( result != BLASTMIDI_OK || buffer == NULL )
+    {
+        return result;
+    }
+    if ( capacity < *size )
+    {
+        return BLASTMIDI_BUFFERTOOSMALL;
+    }
+    return encode_track ( instance, track_id, buffer, size );
+}
+
+uint8_t blastmidi_write_encoded ( blastmidi* instance, const uint8_t* source, size_t source_size, const uint8_t* const* chunks, const size_t* chunk_sizes )
+{
+    if ( chunks == NULL || chunk_sizes == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return write_file ( instance, source, source_size, chunks, chunk_sizes );
+}
+
+void blastmidi_whipe_track ( blastmidi* instance, unsigned int track )
+{
+    blastmidi_event* current = NULL;
+    assert ( instance );
+    if ( instance == NULL )
+    {
+        return;
+    }
+    if ( track >= instance->track_count )
+    {
+        return;
+    }
+    current = instance->tracks[track];
+    if ( current )
+    {
+        mark_track_dirty ( instance, ( uint16_t ) track );
+    }
+    while ( current )
+    {
+        blastmidi_event* next = current->next;
+        blastmidi_event_free ( instance, current );
+        current = next;
+    }
+    instance->tracks[track] = NULL;
+    instance->track_ends[track] = NULL;
+}
+
+uint8_t blastmidi_mark_track_dirty ( blastmidi* instance, uint16_t track_id )
+{
+    if ( instance == NULL || track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    mark_track_dirty ( instance, track_id );
+    return BLASTMIDI_OK;
+}
+
+void blastmidi_event_free ( blastmidi* instance, blastmidi_event* event )
+{
+    /*
+    * Note: This function does not take the linked list into consideration. Pointer bookkeeping has to have been done before
+    * this function is invoked.
+    */
+    assert ( event );
+    if ( event->storage == BLASTMIDI_STORAGE_HEAP || event->storage == BLASTMIDI_STORAGE_POOLED )
+    {
+        release_payload ( instance, event );
+    }
+    else if ( event->storage == BLASTMIDI_STORAGE_SHARED )
+    {
+        intern_release ( event->data );
+    }
+    if ( instance->recycle )
+    {
+        event->next = instance->event_pool;
+        instance->event_pool = event;
+        return;
+    }
+    instance->free_function ( event );
+}
+
+uint8_t blastmidi_add_event ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time, blastmidi_event* add_after )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event->track != -1 )
+    {
+        return BLASTMIDI_ALREADYADDED;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    event->track = track_id;
+    event->time = delta_time;
+    mark_track_dirty ( instance, track_id );
+    if ( add_after )
+    {
+        blastmidi_event* old_next = add_after->next;
+        add_after->next = event;
+        event->previous = add_after;
+        event->next = old_next;
+        if ( old_next )
+        {
+            old_next->previous = event;
+        }
+        if ( instance->track_ends[track_id] == add_after )
+        {
+            instance->track_ends[track_id] = event;
+        }
+    }
+    else
+    {
+        blastmidi_event* old_beginning = instance->tracks[track_id];
+        event->previous = NULL;
+        event->next = old_beginning;
+        if ( old_beginning )
+        {
+            old_beginning->previous = event;
+        }
+        instance->tracks[track_id] = event;
+        if ( instance->track_ends[track_id] == NULL )
+        {
+            instance->track_ends[track_id] = event;
+        }
+    }
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_add_event_to_beginning_of_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event->track != -1 )
+    {
+        return BLASTMIDI_ALREADYADDED;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return blastmidi_add_event ( instance, track_id, event, delta_time, NULL );
+}
+
+uint8_t blastmidi_add_event_to_end_of_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event->track != -1 )
+    {
+        return BLASTMIDI_ALREADYADDED;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return blastmidi_add_event ( instance, track_id, event, delta_time, instance->track_ends[track_id] );
+}
+
+uint8_t blastmidi_get_first_event_on_track ( blastmidi* instance, uint16_t track_id, blastmidi_event** event )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    *event = instance->tracks[track_id];
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_get_last_event_on_track ( blastmidi* instance, uint16_t track_id, blastmidi_event** event )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    *event = instance->track_ends[track_id];
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_get_next_event_on_track ( blastmidi* instance, blastmidi_event** event )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( *event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    *event = event[0]->next;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_get_previous_event_on_track ( blastmidi* instance, blastmidi_event** event )
+{
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( *event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    *event = event[0]->previous;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_remove_event_from_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event )
+{
+
+    blastmidi_event* previous = NULL;
+    blastmidi_event* next = NULL;
+
+    if ( instance == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( event->track == -1 )
+    {
+        return BLASTMIDI_NOTADDED;
+    }
+    if ( event->track != track_id )
+    {
+        return BLASTMIDI_NOTPARTOFTRACK;
+    }
+    previous = event->previous;
+    next = event->next;
+    if ( previous )
+    {
+        previous->next = next;
+    }
+    if ( next )
+    {
+        next->previous = previous;
+    }
+    if ( instance->tracks[track_id] == event )
+    {
+        instance->tracks[track_id] = next;
+    }
+    if ( instance->track_ends[track_id] == event )
+    {
+        instance->track_ends[track_id] = previous;
+    }
+    mark_track_dirty ( instance, track_id );
+    blastmidi_event_free ( instance, event );
+    return BLASTMIDI_OK;
+}
+
+/*
+* A cursor into one track, used while merging tracks. tick is the absolute time of event.
+*/
+typedef struct merge_cursor
+{
+    blastmidi_event* event;
+    uint32_t tick;
+    uint16_t track;
+} merge_cursor;
+
+uint8_t merge_cursor_less ( const merge_cursor* a, const merge_cursor* b )
+{
+
+    /*
+    * Events at the same tick are taken in track order, so that for instance the tempo map on track 0 precedes the notes.
+    */
+    if ( a->tick != b->tick )
+    {
+        return a->tick < b->tick;
+    }
+    return a->track < b->track;
+}
+
+void merge_heap_sift_down ( merge_cursor* heap, size_t count, size_t position )
+{
+    merge_cursor item = heap[position];
+    while ( 1 )
+    {
+        size_t child = position * 2 + 1;
+        if ( child >= count )
+        {
+            break;
+        }
+        if ( child + 1 < count && merge_cursor_less ( &heap[child + 1], &heap[child] ) )
+        {
+            ++child;
+        }
+        if ( !merge_cursor_less ( &heap[child], &item ) )
+        {
+            break;
+        }
+        heap[position] = heap[child];
+        position = child;
+    }
+    heap[position] = item;
+}
+
+uint8_t blastmidi_merge_tracks ( blastmidi* instance )
+{
+    merge_cursor* heap = NULL;
+    size_t heap_size = 0;
+    blastmidi_event* head = NULL;
+    blastmidi_event* tail = NULL;
+    blastmidi_event* end_of_track = NULL;
+    uint32_t end_of_track_tick = 0;
+    uint32_t last_tick = 0;
+    uint16_t i;
+
+    if ( instance == NULL || instance->tracks == NULL || instance->track_count == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( instance->file_type == 2 )
+    {
+        /*
+        * The tracks of a type 2 file are independent sequences, which must not be played at the same time.
+        */
+        return BLASTMIDI_INVALIDPARAM;
+    }
+
+    heap = ( merge_cursor* ) allocate_memory ( instance, sizeof ( merge_cursor ) * instance->track_count );
+    if ( heap == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        if ( instance->tracks[i] )
+        {
+            heap[heap_size].event = instance->tracks[i];
+            heap[heap_size].tick = instance->tracks[i]->time;
+            heap[heap_size].track = i;
+            ++heap_size;
+        }
+        instance->tracks[i] = NULL;
+        instance->track_ends[i] = NULL;
+    }
+    if ( heap_size > 1 )
+    {
+        size_t position = heap_size / 2;
+        while ( position-- > 0 )
+        {
+            merge_heap_sift_down ( heap, heap_size, position );
+        }
+    }
+
+    /*
+    * Repeatedly take the earliest event, append it to the merged list and advance the cursor it came from.
+    */
+    while ( heap_size > 0 )
+    {
+        blastmidi_event* event = heap[0].event;
+        uint32_t tick = heap[0].tick;
+        if ( event->next )
+        {
+            heap[0].event = event->next;
+            heap[0].tick = tick + event->next->time;
+        }
+        else
+        {
+            heap[0] = heap[--heap_size];
+        }
+        if ( heap_size > 1 )
+        {
+            merge_heap_sift_down ( heap, heap_size, 0 );
+        }
+
+        if ( event->type == BLASTMIDI_META_EVENT && event->subtype == BLASTMIDI_META_END_OF_TRACK )
+        {
+            /*
+            * Only one end of track event survives, and it is placed at the end of the merged track.
+            */
+            if ( end_of_track == NULL || tick >= end_of_track_tick )
+            {
+                if ( end_of_track )
+                {
+                    blastmidi_event_free ( instance, end_of_track );
+                }
+                end_of_track = event;
+                end_of_track_tick = tick;
+            }
+            else
+            {
+                blastmidi_event_free ( instance, event );
+            }
+            continue;
+        }
+
+        event->track = 0;
+        event->time = tick - last_tick;
+        event->previous = tail;
+        event->next = NULL;
+        if ( tail )
+        {
+            tail->next = event;
+        }
+        else
+        {
+            head = event;
+        }
+        tail = event;
+        last_tick = tick;
+    }
+    instance->free_function ( heap );
+
+    if ( end_of_track )
+    {
+        end_of_track->track = 0;
+        end_of_track->time = end_of_track_tick > last_tick ? end_of_track_tick - last_tick : 0;
+        end_of_track->previous = tail;
+        end_of_track->next = NULL;
+        if ( tail )
+        {
+            tail->next = end_of_track;
+        }
+        else
+        {
+            head = end_of_track;
+        }
+        tail = end_of_track;
+    }
+
+    instance->tracks[0] = head;
+    instance->track_ends[0] = tail;
+    instance->track_count = 1;
+    instance->file_type = 0;
+    mark_track_dirty ( instance, 0 );
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_split_by_channel ( blastmidi* instance, uint16_t track_id )
+{
+    uint16_t destinations[16];
+    uint32_t last_ticks[17];
+    blastmidi_event* heads[17];
+    blastmidi_event* tails[17];
+    blastmidi_event* event = NULL;
+    uint32_t tick = 0;
+    uint16_t channels_used = 0;
+    uint16_t base = 0;
+    uint8_t result = 0;
+    int i;
+
+    if ( instance == NULL || instance->tracks == NULL || track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( instance->file_type == 2 )
+    {
+        /*
+        * Splitting a track of a type 2 file would make parts of one sequence look like independent sequences.
+        */
+        return BLASTMIDI_INVALIDPARAM;
+    }
+
+    /*
+    * Find out which channels are used, so that only those get a track. Channel tracks are appended in channel order.
+    */
+    for ( event = instance->tracks[track_id]; event; event = event->next )
+    {
+        if ( event->type == BLASTMIDI_CHANNEL_EVENT )
+        {
+            channels_used |= ( uint16_t ) ( 1 << ( event->channel & 15 ) );
+        }
+    }
+    base = instance->track_count;
+    for ( i = 0; i < 16; ++i )
+    {
+        destinations[i] = 0;
+        if ( channels_used & ( 1 << i ) )
+        {
+            if ( base == 65535 )
+            {
+                return BLASTMIDI_INVALIDPARAM;
+            }
+            destinations[i] = base++;
+        }
+    }
+    if ( base == instance->track_count )
+    {
+        instance->file_type = 1;
+        return BLASTMIDI_OK;
+    }
+    result = grow_tracks ( instance, base );
+    if ( result != BLASTMIDI_OK )
+    {
+        return result;
+    }
+
+    /*
+    * Slot 16 is the conductor track, which keeps the meta and sysex events and stays at track_id.
+    * The existing events are relinked in a single pass, and their delta times are made relative to their new neighbours.
+    */
+    for ( i = 0; i < 17; ++i )
+    {
+        last_ticks[i] = 0;
+        heads[i] = NULL;
+        tails[i] = NULL;
+    }
+    event = instance->tracks[track_id];
+    while ( event )
+    {
+        blastmidi_event* next = event->next;
+        int slot = event->type == BLASTMIDI_CHANNEL_EVENT ? ( event->channel & 15 ) : 16;
+        tick += event->time;
+        event->time = tick - last_ticks[slot];
+        event->track = ( int16_t ) ( slot == 16 ? track_id : destinations[slot] );
+        event->previous = tails[slot];
+        event->next = NULL;
+        if ( tails[slot] )
+        {
+            tails[slot]->next = event;
+        }
+        else
+        {
+            heads[slot] = event;
+        }
+        tails[slot] = event;
+        last_ticks[slot] = tick;
+        event = next;
+    }
+
+    instance->tracks[track_id] = heads[16];
+    instance->track_ends[track_id] = tails[16];
+    mark_track_dirty ( instance, track_id );
+    for ( i = 0; i < 16; ++i )
+    {
+        if ( channels_used & ( 1 << i ) )
+        {
+            instance->tracks[destinations[i]] = heads[i];
+            instance->track_ends[destinations[i]] = tails[i];
+        }
+    }
+    clear_track_sources ( instance, instance->track_count, base );
+    instance->track_count = base;
+    instance->file_type = 1;
+    return BLASTMIDI_OK;
+}
+
+void blastmidi_transform_initialize ( blastmidi_transform* transform )
+{
+    int i;
+    if ( transform == NULL )
+    {
+        return;
+    }
+    for ( i = 0; i < 128; ++i )
+    {
+        transform->note_map[i] = ( uint8_t ) i;
+        transform->velocity_map[i] = ( uint8_t ) i;
+        transform->controller_map[i] = ( uint8_t ) i;
+    }
+    for ( i = 0; i < 16; ++i )
+    {
+        transform->channel_map[i] = ( uint8_t ) i;
+    }
+    transform->note_channels = 0xFFFF;
+}
+
+void blastmidi_transform_set_transpose ( blastmidi_transform* transform, int semitones )
+{
+    int i;
+    if ( transform == NULL )
+    {
+        return;
+    }
+    for ( i = 0; i < 128; ++i )
+    {
+        int note = i + semitones;
+        transform->note_map[i] = ( uint8_t ) ( note < 0 ? 0 : ( note > 127 ? 127 : note ) );
+    }
+}
+
+void blastmidi_transform_set_velocity_scale ( blastmidi_transform* transform, double scale )
+{
+    int i;
+    if ( transform == NULL )
+    {
+        return;
+    }
+    transform->velocity_map[0] = 0;
+    for ( i = 1; i < 128; ++i )
+    {
+        double velocity = ( double ) i * scale + 0.5;
+        transform->velocity_map[i] = ( uint8_t ) ( velocity < 1.0 ? 1 : ( velocity > 127.0 ? 127 : ( int ) velocity ) );
+    }
+}
+
+void transform_event ( blastmidi_event* event, const blastmidi_transform* transform )
+{
+
+    /*
+    * Channel events always keep their payload inline, so the tables can be applied to the data in place.
+    */
+    uint8_t channel = 0;
+    if ( event->type != BLASTMIDI_CHANNEL_EVENT || event->data_size == 0 )
+    {
+        return;
+    }
+    channel = ( uint8_t ) ( event->channel & 15 );
+    switch ( event->subtype )
+    {
+        case BLASTMIDI_CHANNEL_NOTE_ON:
+            if ( event->data_size > 1 && event->data[1] > 0 )
+            {
+                event->data[1] = transform->velocity_map[event->data[1] & 127];
             }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Channel prefix event.\nChannel: %u\n", ( uint32_t ) channel );
-#endif
-            result = blastmidi_event_create_meta_midi_channel_prefix_event ( instance, channel, event_ptr );
-            if ( result != BLASTMIDI_OK )
+            /* Fall through */
+        case BLASTMIDI_CHANNEL_NOTE_OFF:
+        case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
+            if ( transform->note_channels & ( 1 << channel ) )
             {
-                return result;
+                event->data[0] = transform->note_map[event->data[0] & 127];
             }
             break;
-        }
-        case BLASTMIDI_META_END_OF_TRACK:
-            /*
-            * Set the end_of_track variable that we were given, to 1.
-            * This informs the caller that it is time to stop reading events on this particular track.
-            */
-#ifdef BLASTMIDI_DEBUG
-            printf ( "End of track.\n" );
-#endif
-            *end_of_track = 1;
+        case BLASTMIDI_CHANNEL_CONTROLLER:
+            event->data[0] = transform->controller_map[event->data[0] & 127];
             break;
-        case BLASTMIDI_META_SET_TEMPO:
-        {
-            uint32_t tempo = 0;
-            result = read_24_bit ( instance, &tempo );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Tempo: %u\n", ( uint32_t ) tempo );
-#endif
-            result = blastmidi_event_create_meta_tempo_event ( instance, tempo, event_ptr );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
+        default:
             break;
+    }
+    event->channel = ( int8_t ) ( transform->channel_map[channel] & 15 );
+}
+
+void transform_track ( blastmidi_event* event, const blastmidi_transform* transform )
+{
+    for ( ; event; event = event->next )
+    {
+        transform_event ( event, transform );
+    }
+}
+
+uint8_t blastmidi_apply_transform ( blastmidi* instance, uint16_t track_id, const blastmidi_transform* transform )
+{
+    uint16_t i;
+    if ( instance == NULL || transform == NULL || instance->tracks == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id == BLASTMIDI_ALL_TRACKS )
+    {
+        for ( i = 0; i < instance->track_count; ++i )
+        {
+            transform_track ( instance->tracks[i], transform );
+            mark_track_dirty ( instance, i );
         }
-        case BLASTMIDI_META_SMPTE_OFFSET:
-            /*
-            * Todo: Implement support for this. Right now we just skip ahead.
-            */
-            result = skip_ahead ( instance, 5 );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "SMPTE offset.\n" );
-#endif
+        return BLASTMIDI_OK;
+    }
+    if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    transform_track ( instance->tracks[track_id], transform );
+    mark_track_dirty ( instance, track_id );
+    return BLASTMIDI_OK;
+}
+
+/*
+* An event together with its absolute time, used by the operations which need to reorder events.
+*/
+typedef struct tick_entry
+{
+    blastmidi_event* event;
+    uint32_t tick;
+} tick_entry;
+
+void sort_tick_entries ( tick_entry* entries, tick_entry* scratch, size_t count )
+{
+    size_t width;
+
+    /*
+    * A bottom up merge sort, which is stable so that events at the same tick keep their order.
+    * Input that is already sorted is detected up front, since that is by far the most common case.
+    */
+    for ( width = 1; width < count; ++width )
+    {
+        if ( entries[width].tick < entries[width - 1].tick )
+        {
             break;
-        case BLASTMIDI_META_TIME_SIGNATURE:
+        }
+    }
+    if ( width >= count )
+    {
+        return;
+    }
+    for ( width = 1; width < count; width *= 2 )
+    {
+        size_t begin;
+        for ( begin = 0; begin < count; begin += width * 2 )
         {
-            uint8_t numerator = 0;
-            uint8_t denominator = 0;
-            uint8_t metronome = 0;
-            uint8_t thirtyseconds_per_24_signals = 0;
-            result = read_byte ( instance, &numerator );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-            result = read_byte ( instance, &denominator );
-            if ( result != BLASTMIDI_OK )
+            size_t middle = begin + width < count ? begin + width : count;
+            size_t end = begin + width * 2 < count ? begin + width * 2 : count;
+            size_t left = begin;
+            size_t right = middle;
+            size_t position = begin;
+            while ( left < middle && right < end )
             {
-                return result;
+                scratch[position++] = entries[right].tick < entries[left].tick ? entries[right++] : entries[left++];
             }
-            result = read_byte ( instance, &metronome );
-            if ( result != BLASTMIDI_OK )
+            while ( left < middle )
             {
-                return result;
+                scratch[position++] = entries[left++];
             }
-            result = read_byte ( instance, &thirtyseconds_per_24_signals );
-            if ( result != BLASTMIDI_OK )
+            while ( right < end )
             {
-                return result;
+                scratch[position++] = entries[right++];
             }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Time signature.\nNumerator: %u\nDenominator: %u\nMetronome: %u\nThirty seconds per 24 signal: %u\n", ( uint32_t ) numerator, ( uint32_t ) denominator, ( uint32_t ) metronome, ( uint32_t ) thirtyseconds_per_24_signals );
-#endif
-            result = blastmidi_event_create_meta_time_signature_event ( instance, numerator, denominator, metronome, thirtyseconds_per_24_signals, event_ptr );
-            if ( result != BLASTMIDI_OK )
+        }
+        memcpy ( ( void* ) entries, ( void* ) scratch, sizeof ( tick_entry ) * count );
+    }
+}
+
+void relink_tick_entries ( blastmidi* instance, uint16_t track_id, const tick_entry* entries, size_t count )
+{
+    uint32_t last_tick = 0;
+    size_t i;
+    for ( i = 0; i < count; ++i )
+    {
+        blastmidi_event* event = entries[i].event;
+        event->previous = i > 0 ? entries[i - 1].event : NULL;
+        event->next = i + 1 < count ? entries[i + 1].event : NULL;
+        event->time = entries[i].tick - last_tick;
+        last_tick = entries[i].tick;
+    }
+    instance->tracks[track_id] = count > 0 ? entries[0].event : NULL;
+    instance->track_ends[track_id] = count > 0 ? entries[count - 1].event : NULL;
+    mark_track_dirty ( instance, track_id );
+}
+
+uint32_t quantize_tick ( uint32_t tick, uint32_t grid_ticks, uint32_t swing_ticks, double strength )
+{
+    uint64_t pair = ( uint64_t ) grid_ticks * 2;
+    uint64_t base = ( uint64_t ) tick / pair * pair;
+    uint64_t candidates[3];
+    uint64_t target = base;
+    uint64_t best = ( uint64_t ) - 1;
+    double result = 0;
+    int i;
+
+    /*
+    * Grid lines come in pairs, and the second line of every pair is delayed by the swing.
+    */
+    candidates[0] = base;
+    candidates[1] = base + grid_ticks + swing_ticks;
+    candidates[2] = base + pair;
+    for ( i = 0; i < 3; ++i )
+    {
+        uint64_t distance = candidates[i] > tick ? candidates[i] - tick : tick - candidates[i];
+        if ( distance < best )
+        {
+            best = distance;
+            target = candidates[i];
+        }
+    }
+    result = ( double ) tick + strength * ( ( double ) target - ( double ) tick ) + 0.5;
+    if ( result >= 4294967295.0 )
+    {
+        return 0xFFFFFFFF;
+    }
+    return ( uint32_t ) result;
+}
+
+uint8_t blastmidi_quantize ( blastmidi* instance, uint16_t track_id, uint32_t grid_ticks, double strength, double swing )
+{
+    tick_entry* entries = NULL;
+    uint32_t swing_ticks = 0;
+    size_t capacity = 0;
+    uint16_t first = track_id;
+    uint16_t last = track_id;
+    uint16_t t;
+
+    if ( instance == NULL || instance->tracks == NULL || grid_ticks == 0 || ! ( strength >= 0.0 && strength <= 1.0 ) || ! ( swing >= 0.0 && swing < 1.0 ) )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id == BLASTMIDI_ALL_TRACKS )
+    {
+
+        /*
+        * A recycled instance keeps its track array while it holds no tracks, and there is nothing to do for it.
+        */
+        if ( instance->track_count == 0 )
+        {
+            return BLASTMIDI_OK;
+        }
+        first = 0;
+        last = instance->track_count - 1;
+    }
+    else if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    swing_ticks = ( uint32_t ) ( ( double ) grid_ticks * swing );
+
+    /*
+    * The arrays hold the longest track, plus the same amount of scratch space for sorting, and are shared by all the tracks.
+    */
+    for ( t = first; t <= last; ++t )
+    {
+        size_t count = 0;
+        blastmidi_event* event;
+        for ( event = instance->tracks[t]; event; event = event->next )
+        {
+            ++count;
+        }
+        if ( count > capacity )
+        {
+            capacity = count;
+        }
+    }
+    if ( capacity == 0 )
+    {
+        return BLASTMIDI_OK;
+    }
+    entries = ( tick_entry* ) allocate_memory ( instance, sizeof ( tick_entry ) * capacity * 2 );
+    if ( entries == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+
+    for ( t = first; t <= last; ++t )
+    {
+        blastmidi_event* event = instance->tracks[t];
+        uint32_t tick = 0;
+        size_t count = 0;
+        if ( event == NULL )
+        {
+            continue;
+        }
+        for ( ; event; event = event->next )
+        {
+            tick += event->time;
+            entries[count].event = event;
+            entries[count].tick = tick;
+            if ( event->type == BLASTMIDI_CHANNEL_EVENT && ( event->subtype == BLASTMIDI_CHANNEL_NOTE_ON || event->subtype == BLASTMIDI_CHANNEL_NOTE_OFF ) )
             {
-                return result;
+                entries[count].tick = quantize_tick ( tick, grid_ticks, swing_ticks, strength );
             }
-            break;
+            ++count;
         }
-        case BLASTMIDI_META_KEY_SIGNATURE:
+        sort_tick_entries ( entries, entries + capacity, count );
+        relink_tick_entries ( instance, t, entries, count );
+    }
+    instance->free_function ( entries );
+    return BLASTMIDI_OK;
+}
+
+/*
+* Rewrites the times on one track in a single pass.
+* Events at ticks in the range [start, end) are freed if remove is set, and events at or after end are moved by shift ticks.
+* End of track events are never removed. If they fall within a range that is cut out, they move to start.
+*/
+void retime_track ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end, uint8_t remove, int64_t shift )
+{
+    blastmidi_event* event = instance->tracks[track_id];
+    blastmidi_event* previous = NULL;
+    uint32_t tick = 0;
+    uint32_t last_tick = 0;
+
+    instance->tracks[track_id] = NULL;
+    instance->track_ends[track_id] = NULL;
+    mark_track_dirty ( instance, track_id );
+    while ( event )
+    {
+        blastmidi_event* next = event->next;
+        uint32_t new_tick = 0;
+        tick += event->time;
+        if ( tick >= start && tick < end )
         {
-            int8_t key = 0;
-            uint8_t scale = 0;
-            result = read_byte ( instance, ( uint8_t* ) &key );
-            if ( result != BLASTMIDI_OK )
+            if ( remove && ! ( event->type == BLASTMIDI_META_EVENT && event->subtype == BLASTMIDI_META_END_OF_TRACK ) )
             {
-                return result;
+                event->previous = NULL;
+                event->next = NULL;
+                blastmidi_event_free ( instance, event );
+                event = next;
+                continue;
             }
-            result = read_byte ( instance, &scale );
-            if ( result != BLASTMIDI_OK )
+            new_tick = shift < 0 ? start : tick;
+        }
+        else if ( tick >= end )
+        {
+            new_tick = ( uint32_t ) ( ( int64_t ) tick + shift );
+        }
+        else
+        {
+            new_tick = tick;
+        }
+        event->time = new_tick - last_tick;
+        last_tick = new_tick;
+        event->previous = previous;
+        event->next = NULL;
+        if ( previous )
+        {
+            previous->next = event;
+        }
+        else
+        {
+            instance->tracks[track_id] = event;
+        }
+        previous = event;
+        event = next;
+    }
+    instance->track_ends[track_id] = previous;
+}
+
+uint8_t edit_range ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end, uint8_t remove, int64_t shift )
+{
+    uint16_t first = track_id;
+    uint16_t last = track_id;
+    uint16_t t;
+
+    if ( instance == NULL || instance->tracks == NULL || end < start )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( track_id == BLASTMIDI_ALL_TRACKS )
+    {
+        if ( instance->track_count == 0 )
+        {
+            return BLASTMIDI_OK;
+        }
+        first = 0;
+        last = instance->track_count - 1;
+    }
+    else if ( track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( shift > 0 )
+    {
+
+        /*
+        * Make sure that no track would run past the largest time that can be represented, before anything is changed.
+        */
+        for ( t = first; t <= last; ++t )
+        {
+            uint64_t length = 0;
+            blastmidi_event* event;
+            for ( event = instance->tracks[t]; event; event = event->next )
             {
-                return result;
+                length += event->time;
             }
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Key signature.\nKey: %d\nScale: %u\n", ( int32_t ) key, ( uint32_t ) scale );
-#endif
-            result = blastmidi_event_create_meta_key_signature_event ( instance, key, scale, event_ptr );
-            if ( result != BLASTMIDI_OK )
+            if ( instance->tracks[t] && length >= end && length + ( uint64_t ) shift > 0xFFFFFFFF )
             {
-                return result;
+                return BLASTMIDI_INVALIDPARAM;
             }
-            break;
         }
-        default:
-#ifdef BLASTMIDI_DEBUG
-            printf ( "Unknown meta event type.\nType number: %u\nSize: %u\n", ( uint32_t ) type, event_size );
-#endif
-            result = skip_ahead ( instance, event_size );
-            if ( result != BLASTMIDI_OK )
-            {
-                return result;
-            }
-    };
+    }
+    for ( t = first; t <= last; ++t )
+    {
+        retime_track ( instance, t, start, end, remove, shift );
+    }
     return BLASTMIDI_OK;
 }
 
-uint8_t read_sysex_event ( blastmidi* instance, blastmidi_event** event_ptr )
-{
-    uint32_t event_size = 0;
-    uint8_t final_byte = 0;
-    uint8_t result = read_variable_number ( instance, &event_size );
-    if ( result != BLASTMIDI_OK )
+uint8_t blastmidi_delete_range ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end )
+{
+    return edit_range ( instance, track_id, start, end, 1, 0 );
+}
+
+uint8_t blastmidi_cut_range ( blastmidi* instance, uint16_t track_id, uint32_t start, uint32_t end )
+{
+    return edit_range ( instance, track_id, start, end, 1, - ( int64_t ) ( end - start ) );
+}
+
+uint8_t blastmidi_insert_silence ( blastmidi* instance, uint16_t track_id, uint32_t tick, uint32_t length )
+{
+    return edit_range ( instance, track_id, tick, tick, 0, ( int64_t ) length );
+}
+
+uint8_t blastmidi_insert_event_at_tick ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t tick )
+{
+    blastmidi_event* previous = NULL;
+    blastmidi_event* next = NULL;
+    uint32_t previous_tick = 0;
+
+    if ( instance == NULL || event == NULL )
     {
-        return result;
+        return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event_size == 0 )
+    if ( event->track != -1 )
     {
-        /*
-        * This should never happen, but we allow for it.
-        */
-        return BLASTMIDI_OK;
+        return BLASTMIDI_ALREADYADDED;
     }
-
-    result = blastmidi_event_create_sysex_event ( instance, NULL, event_size - 1, 1, event_ptr );
-    if ( result != BLASTMIDI_OK )
+    if ( track_id >= instance->track_count )
     {
-        return result;
+        return BLASTMIDI_INVALIDPARAM;
     }
 
-    if ( event_size > 1 )
+    /*
+    * Find the last event at or before tick, so that events at the same time keep the order in which they were inserted.
+    */
+    for ( next = instance->tracks[track_id]; next; next = next->next )
     {
-        result = read_bytes ( instance, event_ptr[0]->data, event_size - 1 );
-        if ( result != BLASTMIDI_OK )
+        if ( previous_tick + next->time > tick )
         {
-            blastmidi_event_free ( instance, *event_ptr );
-            *event_ptr = NULL;
-            return result;
+            break;
         }
+        previous_tick += next->time;
+        previous = next;
     }
-
-    /*
-    * Read the last data byte in the message, in order to check what scenario this is (continuation or the end of the whole message).
-    */
-    result = read_byte ( instance, &final_byte );
-    if ( result != BLASTMIDI_OK )
+    event->track = track_id;
+    event->time = tick - previous_tick;
+    mark_track_dirty ( instance, track_id );
+    event->previous = previous;
+    event->next = next;
+    if ( previous )
     {
-        blastmidi_event_free ( instance, *event_ptr );
-        *event_ptr = NULL;
-        return result;
+        previous->next = event;
     }
-    if ( final_byte == 0xF7 )
+    else
     {
-        /*
-        * This is the end of the entire event. The event structure is set up for this by default.
-        */
-        instance->sysex_continuation = 0;
+        instance->tracks[track_id] = event;
+    }
+    if ( next )
+    {
+        next->time -= event->time;
+        next->previous = event;
     }
     else
     {
-        /*
-        * This is not the last part of the sysex continuation event, so we remember the fact that one is ongoing.
-        * We also have to update the end_of_sysex member in our event structure, so that it indicates 0.
-        */
-        instance->sysex_continuation = 1;
-        event_ptr[0]->end_of_sysex = 0;
+        instance->track_ends[track_id] = event;
     }
     return BLASTMIDI_OK;
 }
 
-uint8_t read_authorization_sysex_event ( blastmidi* instance, blastmidi_event** event_ptr )
+/*
+* While blastmidi_insert_events_at_ticks checks its events, it marks every one it has seen by setting its track to -2, so that
+* an event which appears twice in the array is refused rather than linked into the track twice. On an error the marks are
+* taken off again, and on success the merge gives every event its real track.
+*/
+void unmark_events ( blastmidi_event** events, size_t count )
 {
-    uint32_t event_size = 0;
-    uint8_t result = read_variable_number ( instance, &event_size );
-    if ( result != BLASTMIDI_OK )
+    size_t i;
+    for ( i = 0; i < count; ++i )
     {
-        return result;
+        events[i]->track = -1;
     }
-    if ( event_size == 0 )
+}
+
+uint8_t blastmidi_insert_events_at_ticks ( blastmidi* instance, uint16_t track_id, blastmidi_event** events, const uint32_t* ticks, size_t count )
+{
+    tick_entry* entries = NULL;
+    blastmidi_event* current = NULL;
+    blastmidi_event* previous = NULL;
+    uint32_t current_tick = 0;
+    uint32_t last_tick = 0;
+    size_t i;
+
+    if ( instance == NULL || ( count > 0 && ( events == NULL || ticks == NULL ) ) || track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    for ( i = 0; i < count; ++i )
+    {
+        if ( events[i] == NULL )
+        {
+            unmark_events ( events, i );
+            return BLASTMIDI_INVALIDPARAM;
+        }
+        if ( events[i]->track != -1 )
+        {
+            unmark_events ( events, i );
+            return BLASTMIDI_ALREADYADDED;
+        }
+        events[i]->track = -2;
+    }
+    if ( count == 0 )
     {
-        /*
-        * This should never happen, but we allow for it.
-        */
         return BLASTMIDI_OK;
     }
-
-    /*
-    * Todo: Figure out whether we need a flag in the event structure to indicate that this is a sysex authorization event.
-    */
-
-    result = blastmidi_event_create_sysex_event ( instance, NULL, event_size, 1, event_ptr );
-    if ( result != BLASTMIDI_OK )
+    entries = ( tick_entry* ) allocate_memory ( instance, sizeof ( tick_entry ) * count * 2 );
+    if ( entries == NULL )
     {
-        return result;
+        unmark_events ( events, count );
+        return BLASTMIDI_OUTOFMEMORY;
     }
-
-    result = read_bytes ( instance, event_ptr[0]->data, event_size );
-    if ( result != BLASTMIDI_OK )
+    for ( i = 0; i < count; ++i )
     {
-        blastmidi_event_free ( instance, *event_ptr );
-        *event_ptr = NULL;
-        return result;
+        entries[i].event = events[i];
+        entries[i].tick = ticks[i];
     }
-
-    return BLASTMIDI_OK;
-}
-
-uint8_t read_track_events ( blastmidi* instance, uint16_t track_id )
-{
+    sort_tick_entries ( entries, entries + count, count );
 
     /*
-    * Read all the events in a loop, breaking out either when an error occurs or when the end of track meta event is encountered.
+    * Merge the sorted new events into the track in a single pass. At equal times, the events already on the track come first.
     */
-
-    while ( 1 )
+    current = instance->tracks[track_id];
+    if ( current )
     {
-
-        blastmidi_event* event = NULL;
-        /*
-        * This is the event that we are about to create.
-        */
-
-        /*
-        * Begin by reading the delta time.
-        */
-        uint32_t delta_time = 0;
-        uint8_t event_type = 0;
-
-        uint8_t end_of_track = 0;
-        /*
-        * This variable is passed to read_meta_event, and gets set to 1 if the end of track meta event is encountered.
-        */
-
-        uint8_t result = read_variable_number ( instance, &delta_time );
-        if ( result != BLASTMIDI_OK )
-        {
-            return result;
-        }
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Delta time: %u\n", ( uint32_t ) delta_time );
-#endif
-
-        /*
-        * Read the event type specifier.
-        */
-        result = read_byte ( instance, &event_type );
-        if ( result != BLASTMIDI_OK )
-        {
-            return result;
-        }
-
-        switch ( event_type )
-        {
-            case 0xFF:
-                result = read_meta_event ( instance, &end_of_track, &event );
-                if ( result != BLASTMIDI_OK )
-                {
-                    return result;
-                }
-                break;
-            case 0xF0:
-#ifdef BLASTMIDI_DEBUG
-                printf ( "SysEx event.\n" );
-#endif
-                result = read_sysex_event ( instance, &event );
-                if ( result != BLASTMIDI_OK )
-                {
-                    return result;
-                }
-                break;
-            case 0xF7:
-                /*
-                * This is either a part of a continuation sysex event, or a single authorization sysex event.
-                * We determine this by checking the sysex_continuation flag in the blastmidi structure.
-                */
-                if ( instance->sysex_continuation == 1 )
-                {
-#ifdef BLASTMIDI_DEBUG
-                    printf ( "Continued SysEx event.\n" );
-#endif
-                    result = read_sysex_event ( instance, &event );
-                }
-                else
-                {
-#ifdef BLASTMIDI_DEBUG
-                    printf ( "Authorization SysEx event.\n" );
-#endif
-                    result = read_authorization_sysex_event ( instance, &event );
-                }
-                if ( result != BLASTMIDI_OK )
-                {
-                    return result;
-                }
-                break;
-            default:
-            {
-                uint8_t midi_event_type = 0;
-                uint8_t channel = 0;
-                uint8_t new_status_bit = extract_bits_8 ( event_type, 1, 1 );
-                if ( new_status_bit == 0 )
-                {
-                    /*
-                    * This is a so called running status event, which means that the status byte is the same as for our last event.
-                    * Therefore, we reuse that status byte and treat this byte as the first data byte of the event.
-                    */
-                    event_type = instance->running_status;
-                    skip_backwards ( instance, 1 );
-                }
-                instance->running_status = event_type;
-                midi_event_type = extract_bits_8 ( event_type, 1, 4 );
-                channel = extract_bits_8 ( event_type, 5, 8 );
-#ifdef BLASTMIDI_DEBUG
-                printf ( "Midi event type: %u\nChannel: %u\n", ( uint32_t ) midi_event_type, ( uint32_t ) channel );
-#endif
-
-                switch ( midi_event_type )
-                {
-                    case BLASTMIDI_CHANNEL_NOTE_OFF:
-                    case BLASTMIDI_CHANNEL_NOTE_ON:
-                    case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
-                    case BLASTMIDI_CHANNEL_CONTROLLER:
-                    case BLASTMIDI_CHANNEL_PITCH_BEND:
-                    {
-                        uint8_t first = 0;
-                        uint8_t second = 0;
-                        result = read_byte ( instance, &first );
-                        if ( result != BLASTMIDI_OK )
-                        {
-                            return result;
-                        }
-                        result = read_byte ( instance, &second );
-                        if ( result != BLASTMIDI_OK )
-                        {
-                            return result;
-                        }
-                        result = blastmidi_event_create_channel_event ( instance, channel, midi_event_type, first, second, &event );
-                        if ( result != BLASTMIDI_OK )
-                        {
-#ifdef BLASTMIDI_DEBUG
-                            printf ( "Event creation error with two arguments.\n" );
-#endif
-                            return result;
-                        }
-                        break;
-                    }
-                    case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
-                    case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
-                    {
-                        uint8_t first = 0;
-                        result = read_byte ( instance, &first );
-                        if ( result != BLASTMIDI_OK )
-                        {
-                            return result;
-                        }
-                        result = blastmidi_event_create_channel_event ( instance, channel, midi_event_type, first, 0, &event );
-                        if ( result != BLASTMIDI_OK )
-                        {
-                            return result;
-                        }
-                        break;
-                    }
-                    default:
-#ifdef BLASTMIDI_DEBUG
-                        printf ( "This is an unknown Midi channel event.\n" );
-#endif
-                        if ( event )
-                        {
-                            blastmidi_event_free ( instance, event );
-                        }
-                        return BLASTMIDI_INVALIDCHUNK;
-                };
-            }
-        };
-
-        /*
-        * If event is not NULL, we add it to the end of the track.
-        */
-        if ( event )
+        current_tick = current->time;
+    }
+    instance->tracks[track_id] = NULL;
+    i = 0;
+    while ( current || i < count )
+    {
+        blastmidi_event* event = NULL;
+        uint32_t tick = 0;
+        if ( i < count && ( current == NULL || entries[i].tick < current_tick ) )
         {
-            result = blastmidi_add_event_to_end_of_track ( instance, track_id, event, delta_time );
-            if ( result != BLASTMIDI_OK )
+            event = entries[i].event;
+            tick = entries[i].tick;
+            event->track = track_id;
+            ++i;
+        }
+        else
+        {
+            event = current;
+            tick = current_tick;
+            current = current->next;
+            if ( current )
             {
-                blastmidi_event_free ( instance, event );
-                return result;
+                current_tick += current->time;
             }
         }
-
-        if ( end_of_track )
+        event->time = tick - last_tick;
+        last_tick = tick;
+        event->previous = previous;
+        event->next = NULL;
+        if ( previous )
         {
-
-            /*
-            * The end of track meta event was encountered, so we break out of the loop and return.
-            */
-            break;
+            previous->next = event;
+        }
+        else
+        {
+            instance->tracks[track_id] = event;
         }
+        previous = event;
+    }
+    instance->track_ends[track_id] = previous;
+    mark_track_dirty ( instance, track_id );
+    instance->free_function ( entries );
+    return BLASTMIDI_OK;
+}
+
+/*
+* The streaming filter pipeline and the probe decode one track chunk at a time with a cursor, which holds a single event and
+* the decoding state of the track. Payloads that do not fit in the small_pool of the event are not copied, but refer to the
+* chunk itself. The cursor never touches an instance, so any number of them may be used at the same time.
+*/
+void set_decoded_payload ( blastmidi_event* event, const uint8_t* data, uint32_t data_size )
+{
+    event->data_size = data_size;
+    if ( data_size == 0 )
+    {
+        event->data = NULL;
+        event->storage = BLASTMIDI_STORAGE_NONE;
+    }
+    else if ( data_size <= sizeof ( event->small_pool ) )
+    {
+        memcpy ( ( void* ) event->small_pool, ( void* ) data, data_size );
+        event->data = event->small_pool;
+        event->storage = BLASTMIDI_STORAGE_INLINE;
+    }
+    else
+    {
+        event->data = ( uint8_t* ) data;
+        event->storage = BLASTMIDI_STORAGE_SHARED;
+    }
+}
+
+uint8_t cursor_read_byte ( blastmidi_cursor* cursor, uint8_t* value )
+{
+    if ( cursor->position >= cursor->size )
+    {
+        return BLASTMIDI_UNEXPECTEDEND;
+    }
+    *value = cursor->data[cursor->position++];
+    return BLASTMIDI_OK;
+}
 
+uint8_t cursor_read_variable_number ( blastmidi_cursor* cursor, uint32_t* value )
+{
+    uint8_t i;
+    *value = 0;
+    for ( i = 0; i < 4; ++i )
+    {
+        uint8_t current = 0;
+        uint8_t result = cursor_read_byte ( cursor, &current );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        *value = ( *value << 7 ) | ( current & 0x7F );
+        if ( ( current & 0x80 ) == 0 )
+        {
+            return BLASTMIDI_OK;
+        }
     }
+    return BLASTMIDI_INVALIDCHUNK;
+}
 
+uint8_t cursor_read_payload ( blastmidi_cursor* cursor, uint32_t size, const uint8_t** payload )
+{
+    if ( size > cursor->size - cursor->position )
+    {
+        return BLASTMIDI_UNEXPECTEDEND;
+    }
+    if ( cursor->max_payload_size && size > cursor->max_payload_size )
+    {
+        return BLASTMIDI_LIMITEXCEEDED;
+    }
+    *payload = cursor->data + cursor->position;
+    cursor->position += size;
     return BLASTMIDI_OK;
 }
 
-uint8_t read_track ( blastmidi* instance, uint16_t track_id )
+uint8_t decode_event ( blastmidi_cursor* cursor, uint8_t* keep )
 {
 
     /*
-    * Begin by reading and verifying the header.
-    * A track chunk should have a type of MTrk. We make a temporary storage of 5 bytes, and NULL terminate the string.
+    * Decodes the next event of the chunk into the event of the cursor, with the same representation that the parser gives it.
+    * keep is set to 0 for events that are not handed on: the end of track event, which also sets the end_of_track member of the
+    * cursor, and empty system exclusive packets, which the parser drops as well.
+    * Unlike the parser, meta events that the parser skips are decoded with their raw payload, so that they survive the pipeline.
     */
-    uint8_t temp[5];
-    uint32_t chunk_size = 0;
-
-    uint8_t result = read_bytes ( instance, temp, 4 );
+    blastmidi_event* event = &cursor->event;
+    uint32_t delta_time = 0;
+    uint32_t size = 0;
+    uint8_t status = 0;
+    const uint8_t* payload = NULL;
+    uint8_t result = cursor_read_variable_number ( cursor, &delta_time );
     if ( result != BLASTMIDI_OK )
     {
         return result;
     }
-    temp[4] = 0;
-    if ( strcmp ( ( const char* ) temp, "MTrk" ) != 0 )
+    result = cursor_read_byte ( cursor, &status );
+    if ( result != BLASTMIDI_OK )
     {
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Invalid chunk.\n" );
-#endif
-        return BLASTMIDI_INVALIDCHUNK;
+        return result;
     }
+    cursor->tick += delta_time;
+    event->previous = NULL;
+    event->next = NULL;
+    event->time = delta_time;
+    event->track = -1;
+    event->channel = -1;
+    event->end_of_sysex = 0;
+    *keep = 1;
 
-    result = read_32_bit ( instance, &chunk_size );
-    if ( result != BLASTMIDI_OK )
+    if ( status == 0xFF )
     {
-        return result;
+        result = cursor_read_byte ( cursor, &event->subtype );
+        if ( result == BLASTMIDI_OK )
+        {
+            result = cursor_read_variable_number ( cursor, &size );
+        }
+        if ( result == BLASTMIDI_OK )
+        {
+            result = cursor_read_payload ( cursor, size, &payload );
+        }
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        event->type = BLASTMIDI_META_EVENT;
+        if ( event->subtype == BLASTMIDI_META_END_OF_TRACK )
+        {
+            *keep = 0;
+            cursor->end_of_track = 1;
+        }
+        else if ( event->subtype == BLASTMIDI_META_SEQUENCE_NUMBER && size == 2 )
+        {
+            uint16_t sequence_number = ( uint16_t ) ( ( payload[0] << 8 ) | payload[1] );
+            set_decoded_payload ( event, ( const uint8_t* ) &sequence_number, sizeof ( sequence_number ) );
+        }
+        else if ( event->subtype == BLASTMIDI_META_SET_TEMPO && size == 3 )
+        {
+            uint32_t tempo = ( ( uint32_t ) payload[0] << 16 ) | ( ( uint32_t ) payload[1] << 8 ) | payload[2];
+            set_decoded_payload ( event, ( const uint8_t* ) &tempo, sizeof ( tempo ) );
+        }
+        else
+        {
+            set_decoded_payload ( event, payload, size );
+        }
+        return BLASTMIDI_OK;
     }
 
-    if ( chunk_size == 0 )
+    if ( status == 0xF0 || status == 0xF7 )
     {
-        return BLASTMIDI_INVALIDCHUNK;
+        result = cursor_read_variable_number ( cursor, &size );
+        if ( result == BLASTMIDI_OK )
+        {
+            result = cursor_read_payload ( cursor, size, &payload );
+        }
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        event->type = BLASTMIDI_SYSEX_EVENT;
+        event->subtype = BLASTMIDI_SYSEX_NORMAL;
+        event->end_of_sysex = 1;
+        if ( size == 0 )
+        {
+            *keep = 0;
+        }
+        else if ( status == 0xF7 && cursor->sysex_continuation == 0 )
+        {
+            event->subtype = BLASTMIDI_SYSEX_ESCAPE;
+        }
+        else if ( payload[size - 1] == 0xF7 )
+        {
+            cursor->sysex_continuation = 0;
+            --size;
+        }
+        else
+        {
+            cursor->sysex_continuation = 1;
+            event->end_of_sysex = 0;
+        }
+        set_decoded_payload ( event, payload, size );
+        return BLASTMIDI_OK;
     }
 
-    instance->running_status = 0;
-    instance->sysex_continuation = 0;
+    /*
+    * A channel event, possibly in running status, in which case the byte that was just read is the first data byte.
+    */
+    if ( ( status & 0x80 ) == 0 )
+    {
+        status = cursor->running_status;
+        --cursor->position;
+    }
+    cursor->running_status = status;
+    event->type = BLASTMIDI_CHANNEL_EVENT;
+    event->subtype = ( uint8_t ) ( status >> 4 );
+    event->channel = ( int8_t ) ( status & 15 );
+    switch ( event->subtype )
+    {
+        case BLASTMIDI_CHANNEL_NOTE_OFF:
+        case BLASTMIDI_CHANNEL_NOTE_ON:
+        case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
+        case BLASTMIDI_CHANNEL_CONTROLLER:
+        case BLASTMIDI_CHANNEL_PITCH_BEND:
+            result = cursor_read_payload ( cursor, 2, &payload );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            if ( event->subtype == BLASTMIDI_CHANNEL_PITCH_BEND )
+            {
+                uint16_t bend = ( uint16_t ) ( ( ( payload[1] & 0x7F ) << 7 ) | ( payload[0] & 0x7F ) );
+                set_decoded_payload ( event, ( const uint8_t* ) &bend, sizeof ( bend ) );
+            }
+            else
+            {
+                set_decoded_payload ( event, payload, 2 );
+            }
+            return BLASTMIDI_OK;
+        case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
+        case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
+            result = cursor_read_payload ( cursor, 1, &payload );
+            if ( result != BLASTMIDI_OK )
+            {
+                return result;
+            }
+            set_decoded_payload ( event, payload, 1 );
+            return BLASTMIDI_OK;
+        default:
+            return BLASTMIDI_INVALIDCHUNK;
+    };
+}
 
-    return read_track_events ( instance, track_id );
+void blastmidi_cursor_initialize ( blastmidi_cursor* cursor, const uint8_t* data, size_t size )
+{
+    memset ( ( void* ) cursor, 0, sizeof ( blastmidi_cursor ) );
+    cursor->data = data;
+    cursor->size = data ? size : 0;
 }
 
-uint8_t read_header ( blastmidi* instance )
+uint8_t blastmidi_cursor_find_track ( blastmidi_cursor* cursor, const uint8_t* buffer, size_t size, uint16_t track_id )
 {
 
     /*
-    * Read the header chunk.
-    * This header chunk should have a type of MThd. We make a temporary storage of 5 bytes, and NULL terminate the string.
+    * Walks the chunk headers from the start of the file, just as the parser does, without looking at any events.
     */
-    uint8_t temp[5];
-    uint32_t header_size = 0;
-    uint16_t file_type = 0;
-    uint16_t tracks = 0;
-    uint16_t time_division = 0;
-    uint8_t time_type = 0;
-
-    uint8_t result = read_bytes ( instance, temp, 4 );
-    if ( result != BLASTMIDI_OK )
+    size_t position = 14;
+    uint16_t track_count = 0;
+    uint16_t i;
+    if ( cursor == NULL || buffer == NULL )
     {
-        return result;
+        return BLASTMIDI_INVALIDPARAM;
     }
-    temp[4] = 0;
-    if ( strcmp ( ( const char* ) temp, "MThd" ) != 0 )
+    if ( size < 14 || memcmp ( ( void* ) buffer, "MThd\0\0\0\6", 8 ) != 0 )
     {
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Invalid chunk.\n" );
-#endif
         return BLASTMIDI_INVALID;
     }
-
-    result = read_32_bit ( instance, &header_size );
-    if ( result != BLASTMIDI_OK )
+    track_count = ( uint16_t ) ( ( buffer[10] << 8 ) | buffer[11] );
+    if ( track_id >= track_count )
     {
-        return result;
+        return BLASTMIDI_INVALIDPARAM;
     }
+    for ( i = 0; ; ++i )
+    {
+        size_t chunk_size = 0;
+        if ( size - position < 8 )
+        {
+            return BLASTMIDI_UNEXPECTEDEND;
+        }
+        chunk_size = ( ( size_t ) buffer[position + 4] << 24 ) | ( ( size_t ) buffer[position + 5] << 16 ) | ( ( size_t ) buffer[position + 6] << 8 ) | buffer[position + 7];
+        if ( memcmp ( ( void* ) ( buffer + position ), "MTrk", 4 ) != 0 || chunk_size == 0 )
+        {
+            return BLASTMIDI_INVALIDCHUNK;
+        }
+        position += 8;
+        if ( chunk_size > size - position )
+        {
+            return BLASTMIDI_UNEXPECTEDEND;
+        }
+        if ( i == track_id )
+        {
+            blastmidi_cursor_initialize ( cursor, buffer + position, chunk_size );
+            return BLASTMIDI_OK;
+        }
+        position += chunk_size;
+    }
+}
+
+uint8_t blastmidi_cursor_next ( blastmidi_cursor* cursor, blastmidi_event** event )
+{
 
     /*
-    * The header chunk should always have a size of 6.
+    * Empty system exclusive packets are skipped, and their delta times are added to the next event, as the parser does.
     */
-    if ( header_size != 6 )
+    uint32_t pending_time = 0;
+    if ( cursor == NULL || event == NULL )
     {
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Invalid chunk header size.\nReported: %u\n", ( uint32_t ) header_size );
-#endif
-        return BLASTMIDI_INVALID;
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    *event = NULL;
+    while ( !cursor->end_of_track )
+    {
+        uint8_t keep = 0;
+        uint8_t result = decode_event ( cursor, &keep );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        if ( cursor->event.time > 0xFFFFFFFFUL - pending_time )
+        {
+            return BLASTMIDI_INVALIDCHUNK;
+        }
+        pending_time += cursor->event.time;
+        if ( keep )
+        {
+            cursor->event.time = pending_time;
+            *event = &cursor->event;
+            return BLASTMIDI_OK;
+        }
     }
+    return BLASTMIDI_OK;
+}
+
+uint8_t reserve_buffer ( blastmidi* instance, uint8_t** buffer, size_t* capacity, size_t size, size_t used )
+{
 
     /*
-    * First, we read the type of the Midi file. It is stored in the first 2 bytes of the header data.
+    * Grows a buffer of the pipeline to hold at least size bytes, keeping the first used bytes. The buffers are charged against
+    * the memory limit of the instance, so that a chunk which claims to be huge cannot make the pipeline allocate without bound.
     */
-    result = read_16_bit ( instance, &file_type );
+    size_t new_capacity = *capacity ? *capacity : 4096;
+    uint8_t* new_buffer = NULL;
+    uint8_t result = 0;
+    if ( size <= *capacity )
+    {
+        return BLASTMIDI_OK;
+    }
+    while ( new_capacity < size )
+    {
+        new_capacity = new_capacity > ( ( size_t ) -1 ) / 2 ? size : new_capacity * 2;
+    }
+    result = charge_memory ( instance, new_capacity - *capacity );
     if ( result != BLASTMIDI_OK )
     {
         return result;
     }
+    new_buffer = ( uint8_t* ) allocate_memory ( instance, new_capacity );
+    if ( new_buffer == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    if ( *buffer )
+    {
+        if ( used > 0 )
+        {
+            memcpy ( ( void* ) new_buffer, ( void* ) *buffer, used );
+        }
+        instance->free_function ( *buffer );
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return BLASTMIDI_OK;
+}
+
+uint8_t filter_track ( blastmidi* instance, blastmidi_cursor* cursor, uint16_t track_id, const blastmidi_filter_stage* stages, size_t stage_count, uint8_t** output, size_t* capacity, size_t* size )
+{
 
     /*
-    * The type must be either 0, 1 or 2. Verify this.
+    * Runs every event of the chunk that the cursor refers to through the stages, and encodes the events that are kept
+    * as a complete MTrk chunk in output. The delta time of a dropped event is added to that of the next event, so every kept
+    * event keeps its absolute time.
     */
-    if ( file_type != 0 && file_type != 1 && file_type != 2 )
+    blastmidi_event* event = &cursor->event;
+    encoder_state state;
+    size_t position = 8;
+    uint32_t pending_time = 0;
+    uint8_t result = 0;
+
+    memset ( ( void* ) &state, 0, sizeof ( encoder_state ) );
+    while ( !cursor->end_of_track )
     {
-        return BLASTMIDI_INVALID;
+        uint8_t keep = 0;
+        size_t i;
+        result = decode_event ( cursor, &keep );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        if ( event->time > BLASTMIDI_VARIABLE_NUMBER_MAX - pending_time )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        event->time += pending_time;
+        pending_time = event->time;
+        if ( !keep )
+        {
+            continue;
+        }
+        if ( instance->limits.max_events && instance->event_total >= instance->limits.max_events )
+        {
+            return BLASTMIDI_LIMITEXCEEDED;
+        }
+        instance->event_total++;
+
+        for ( i = 0; i < stage_count && keep; ++i )
+        {
+            keep = stages[i].function ( event, track_id, stages[i].user_data ) != 0;
+        }
+        if ( event->time > BLASTMIDI_VARIABLE_NUMBER_MAX )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        pending_time = event->time;
+        if ( !keep )
+        {
+            continue;
+        }
+        if ( event->type != BLASTMIDI_CHANNEL_EVENT && event->data_size > BLASTMIDI_VARIABLE_NUMBER_MAX - 1 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        result = reserve_buffer ( instance, output, capacity, position + event->data_size + 16, position );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        position += encode_event ( *output + position, event, event->time, &state );
+        pending_time = 0;
     }
-#ifdef BLASTMIDI_DEBUG
-    printf ( "File type: %u\n", ( uint32_t ) file_type );
-#endif
-    instance->file_type = ( uint8_t ) file_type;
 
-    /*
-    * Read the number of track chunks that are supposed to be in the file.
-    */
-    result = read_16_bit ( instance, &tracks );
+    result = reserve_buffer ( instance, output, capacity, position + 8, position );
     if ( result != BLASTMIDI_OK )
     {
         return result;
     }
-
-    /*
-    * There must always be at least one track. Verify this.
-    */
-    if ( tracks == 0 )
+    position += encode_end_of_track ( *output + position, pending_time );
+    if ( position - 8 > 0xFFFFFFFFUL )
     {
         return BLASTMIDI_INVALID;
     }
+    encode_chunk_header ( *output, position );
+    *size = position;
+    return BLASTMIDI_OK;
+}
 
-    instance->track_count = tracks;
-
-#ifdef BLASTMIDI_DEBUG
-    printf ( "Tracks: %u\n", ( uint32_t ) tracks );
-#endif
+uint8_t load_track_chunk ( blastmidi* instance, const uint8_t* buffer, size_t size, uint8_t** input, size_t* input_capacity, const uint8_t** chunk, uint32_t* chunk_size )
+{
 
     /*
-    * Read the time division.
+    * Reads the header of the next track chunk, and makes chunk point to its contents. When the file is in buffer, the contents
+    * are used where they are. Otherwise they are read through the data callback into input, which grows as needed.
     */
-    result = read_16_bit ( instance, &time_division );
+    uint8_t type[4];
+    uint8_t result = read_bytes ( instance, type, 4 );
+    if ( result == BLASTMIDI_OK )
+    {
+        result = read_32_bit ( instance, chunk_size );
+    }
     if ( result != BLASTMIDI_OK )
     {
         return result;
     }
+    if ( memcmp ( ( void* ) type, "MTrk", 4 ) != 0 || *chunk_size == 0 )
+    {
+        return BLASTMIDI_INVALIDCHUNK;
+    }
+    if ( buffer )
+    {
+        if ( *chunk_size > size - instance->cursor )
+        {
+            return BLASTMIDI_UNEXPECTEDEND;
+        }
+        *chunk = buffer + instance->cursor;
+        instance->cursor += *chunk_size;
+        return BLASTMIDI_OK;
+    }
+    result = reserve_buffer ( instance, input, input_capacity, *chunk_size, 0 );
+    if ( result == BLASTMIDI_OK )
+    {
+        result = read_bytes ( instance, *input, *chunk_size );
+    }
+    *chunk = *input;
+    return result;
+}
 
-    /*
-    * Figure out what the time measurement is, by reading the most significant bit.
-    */
-    time_type = ( uint8_t ) extract_bits_16 ( time_division, 1, 1 );
-#ifdef BLASTMIDI_DEBUG
-    printf ( "Time type: %u\n", ( uint32_t ) time_type );
-#endif
-    /*
-    * Not really necessary, but we verify anyway just to be pedantic.
-    */
-    if ( time_type != 0 && time_type != 1 )
+uint8_t filter_file ( blastmidi* instance, const uint8_t* buffer, size_t size, const blastmidi_filter_stage* stages, size_t stage_count )
+{
+    uint8_t header[14];
+    uint8_t* input = NULL;
+    size_t input_capacity = 0;
+    uint8_t* output = NULL;
+    size_t output_capacity = 0;
+    size_t output_size = 0;
+    uint8_t result = 0;
+    uint16_t i;
+
+    if ( instance->data_callback == NULL )
     {
-#ifdef BLASTMIDI_DEBUG
-        printf ( "This should never happen.\nTime type is %u.\n", ( uint32_t ) time_type );
-#endif
-        return BLASTMIDI_INVALID;
+        return BLASTMIDI_NOCALLBACK;
+    }
+    if ( stages == NULL && stage_count > 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
     }
+    reset ( instance );
+    instance->memory = buffer;
+    instance->memory_size = size;
 
     /*
-    * Handle the time type possibilities.
+    * The header is passed on as soon as it has been read, and every track as soon as it has been filtered, so nothing but the
+    * chunk that is being filtered is ever held in memory.
     */
-    if ( time_type == 0 )
+    result = read_header ( instance );
+    if ( result == BLASTMIDI_OK )
     {
-
-        /*
-        * The time type specifies ticks per beat. Extract the following 15 bits to get the correct value.
-        */
-        uint16_t ticks_per_beat = extract_bits_16 ( time_division, 2, 16 );
-
-        /*
-        * This value must be greater than 0. Verify that.
-        */
-        if ( ticks_per_beat == 0 )
+        encode_header ( instance, header );
+        if ( write_bytes ( instance, header, 14 ) != BLASTMIDI_OK )
         {
-            return BLASTMIDI_INVALID;
+            result = BLASTMIDI_WRITINGFAILED;
         }
-        instance->ticks_per_beat = ticks_per_beat;
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Ticks per beat: %u\n", ( uint32_t ) ticks_per_beat );
-#endif
     }
-    else
+    for ( i = 0; i < instance->track_count && result == BLASTMIDI_OK; ++i )
     {
+        const uint8_t* chunk = NULL;
+        uint32_t chunk_size = 0;
+        blastmidi_cursor cursor;
 
-        /*
-        * The time type specifies frames per second. First figure out the number of SMPTE frames.
-        */
-        int8_t SMPTE_frames = 0;
-        uint8_t ticks_per_frame = 0;
-
-        SMPTE_frames = ( int8_t ) extract_bits_16 ( time_division, 1, 8 );
-        SMPTE_frames = abs ( SMPTE_frames );
-#ifdef BLASTMIDI_DEBUG
-        printf ( "SMPTE frames: %d\n", ( int32_t ) SMPTE_frames );
-#endif
-        /*
-        * This value must be either 24, 25, 29 or 30. Verify that it is.
-        */
-        if ( SMPTE_frames != 24 && SMPTE_frames != 25 && SMPTE_frames != 29 && SMPTE_frames != 30 )
+        result = load_track_chunk ( instance, buffer, size, &input, &input_capacity, &chunk, &chunk_size );
+        if ( result != BLASTMIDI_OK )
         {
-            return BLASTMIDI_INVALID;
+            break;
         }
 
         /*
-        * Now extract the ticks per frame.
-        */
-        ticks_per_frame = ( uint8_t ) extract_bits_16 ( time_division, 9, 16 );
-
-        /*
-        * This value must be greater than 0. Verify that.
+        * The chunk is decoded as if it were a file in memory of its own, so that no event can reach past its end.
         */
-        if ( ticks_per_frame == 0 )
+        blastmidi_cursor_initialize ( &cursor, chunk, chunk_size );
+        cursor.max_payload_size = instance->limits.max_payload_size;
+        result = filter_track ( instance, &cursor, i, stages, stage_count, &output, &output_capacity, &output_size );
+        if ( result == BLASTMIDI_OK && write_bytes ( instance, output, output_size ) != BLASTMIDI_OK )
         {
-            return BLASTMIDI_INVALID;
+            result = BLASTMIDI_WRITINGFAILED;
         }
-#ifdef BLASTMIDI_DEBUG
-        printf ( "Ticks per frame: %u\n", ( uint32_t ) ticks_per_frame );
-#endif
-        instance->SMPTE_frames = ( uint8_t ) SMPTE_frames;
-        instance->ticks_per_frame = ticks_per_frame;
     }
-    instance->time_type = time_type;
-    return BLASTMIDI_OK;
+
+    if ( input )
+    {
+        instance->free_function ( input );
+    }
+    if ( output )
+    {
+        instance->free_function ( output );
+    }
+    instance->memory = NULL;
+    instance->memory_size = 0;
+    reset ( instance );
+    return result;
 }
 
-uint8_t blastmidi_read ( blastmidi* instance )
+uint8_t blastmidi_filter ( blastmidi* instance, const blastmidi_filter_stage* stages, size_t stage_count )
 {
+    return filter_file ( instance, NULL, 0, stages, stage_count );
+}
 
-    uint8_t result = 0;
-    uint16_t i;
+uint8_t blastmidi_filter_memory ( blastmidi* instance, const uint8_t* buffer, size_t size, const blastmidi_filter_stage* stages, size_t stage_count )
+{
+    if ( buffer == NULL || size == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return filter_file ( instance, buffer, size, stages, stage_count );
+}
+
+int blastmidi_filter_transform ( blastmidi_event* event, uint16_t track_id, void* user_data )
+{
+    ( void ) track_id;
+    transform_event ( event, ( const blastmidi_transform* ) user_data );
+    return 1;
+}
+
+/*
+* A tempo change seen by the probe, at an absolute tick of its track.
+*/
+typedef struct probe_tempo
+{
+    uint64_t tick;
+    uint32_t tempo;
+} probe_tempo;
+
+/*
+* The state of a probe which is carried from one track to the next.
+* tempos holds tempo_count probe_tempo entries, of which the first sorted_count are in order of time. best_tempo,
+* best_time_signature and best_key_signature are the ticks at which the values in the summary were found, or UINT64_MAX.
+*/
+typedef struct probe_state
+{
+    uint8_t* tempos;
+    size_t tempo_capacity;
+    size_t tempo_count;
+    size_t sorted_count;
+    uint8_t* scratch;
+    size_t scratch_capacity;
+    uint64_t best_tempo;
+    uint64_t best_time_signature;
+    uint64_t best_key_signature;
+} probe_state;
+
+int probe_is_first ( blastmidi* instance, uint64_t* best, uint64_t tick, uint8_t last_wins )
+{
 
     /*
-    * Did the user forget to give us an I/O callback?
+    * The first value is the one with the earliest absolute tick. Of several on the same tick, it is the one on the earliest track,
+    * or with last_wins the last one in track order, which is how the tempo map resolves tempo changes on the same tick.
+    * The tracks of a type 2 file are played one after the other, so there it is simply the first one found.
     */
-    if ( instance->data_callback == NULL )
+    if ( *best == UINT64_MAX || ( instance->file_type != 2 && ( tick < *best || ( last_wins && tick == *best ) ) ) )
     {
-        return BLASTMIDI_NOCALLBACK;
+        *best = tick;
+        return 1;
     }
+    return 0;
+}
+
+double probe_duration ( const probe_tempo* tempos, size_t count, uint64_t end, uint16_t ticks_per_beat )
+{
 
     /*
-    * First of all, we reset the instance.
+    * Works out the time of the given tick from tempo changes that are sorted by tick. Of several changes on the same tick the
+    * last one wins, as in the tempo map of a snapshot.
     */
-    reset ( instance );
+    double elapsed = 0;
+    uint64_t tick = 0;
+    uint32_t tempo = 500000;
+    size_t i;
+    for ( i = 0; i < count && tempos[i].tick <= end; ++i )
+    {
+        elapsed += ( double ) ( tempos[i].tick - tick ) * tempo;
+        tick = tempos[i].tick;
+        tempo = tempos[i].tempo;
+    }
+    elapsed += ( double ) ( end - tick ) * tempo;
+    return ticks_per_beat ? elapsed / ticks_per_beat / 1000000.0 : 0;
+}
+
+uint8_t probe_merge_tempos ( blastmidi* instance, probe_state* state )
+{
 
     /*
-    * Now it is time to read the header.
+    * The tempo changes of every track are in order already, so the changes of the track that was just probed are merged into
+    * those of the earlier tracks. Typically only the first track has any, and nothing needs to be moved.
     */
-    result = read_header ( instance );
+    probe_tempo* tempos = ( probe_tempo* ) state->tempos;
+    probe_tempo* merged = NULL;
+    size_t left = 0;
+    size_t right = state->sorted_count;
+    size_t i = 0;
+    uint8_t result = 0;
+    if ( state->sorted_count == 0 || state->sorted_count == state->tempo_count || tempos[right].tick >= tempos[right - 1].tick )
+    {
+        state->sorted_count = state->tempo_count;
+        return BLASTMIDI_OK;
+    }
+    result = reserve_buffer ( instance, &state->scratch, &state->scratch_capacity, state->tempo_count * sizeof ( probe_tempo ), 0 );
     if ( result != BLASTMIDI_OK )
     {
-        reset ( instance );
         return result;
     }
+    merged = ( probe_tempo* ) state->scratch;
+    while ( left < state->sorted_count && right < state->tempo_count )
+    {
+        merged[i++] = tempos[right].tick < tempos[left].tick ? tempos[right++] : tempos[left++];
+    }
+    while ( left < state->sorted_count )
+    {
+        merged[i++] = tempos[left++];
+    }
+    while ( right < state->tempo_count )
+    {
+        merged[i++] = tempos[right++];
+    }
+    memcpy ( ( void* ) tempos, ( void* ) merged, state->tempo_count * sizeof ( probe_tempo ) );
+    state->sorted_count = state->tempo_count;
+    return BLASTMIDI_OK;
+}
+
+uint8_t probe_track ( blastmidi* instance, blastmidi_cursor* cursor, probe_state* state, blastmidi_summary* summary )
+{
 
     /*
-    * Allocate memory for all the tracks. The number of tracks to allocate has already been stored in instance->track_count.
+    * Decodes every event of the chunk that the cursor refers to, and adds what it finds to the summary. The events are
+    * decoded one at a time into the event of the cursor, so nothing is allocated for them.
     */
-    result = allocate_tracks ( instance );
-    if ( result != BLASTMIDI_OK )
+    blastmidi_event* event = &cursor->event;
+    size_t first_tempo = state->tempo_count;
+    uint8_t result = 0;
+
+    while ( !cursor->end_of_track )
     {
-        reset ( instance );
-        return result;
+        uint8_t keep = 0;
+        result = decode_event ( cursor, &keep );
+        if ( result != BLASTMIDI_OK )
+        {
+            return result;
+        }
+        if ( !keep )
+        {
+            continue;
+        }
+        if ( instance->limits.max_events && instance->event_total >= instance->limits.max_events )
+        {
+            return BLASTMIDI_LIMITEXCEEDED;
+        }
+        instance->event_total++;
+        summary->event_count++;
+
+        if ( event->type == BLASTMIDI_CHANNEL_EVENT )
+        {
+            summary->channels |= ( uint16_t ) ( 1 << event->channel );
+            if ( event->subtype == BLASTMIDI_CHANNEL_NOTE_ON && event->data[1] > 0 )
+            {
+                summary->note_count++;
+            }
+            else if ( event->subtype == BLASTMIDI_CHANNEL_PROGRAM_CHANGE )
+            {
+                uint8_t program = event->data[0] & 0x7F;
+                summary->programs[program >> 3] |= ( uint8_t ) ( 1 << ( program & 7 ) );
+            }
+        }
+        else if ( event->type == BLASTMIDI_META_EVENT )
+        {
+            if ( event->subtype == BLASTMIDI_META_SET_TEMPO && event->data_size == sizeof ( uint32_t ) )
+            {
+                probe_tempo* entry = NULL;
+                result = reserve_buffer ( instance, &state->tempos, &state->tempo_capacity, ( state->tempo_count + 1 ) * sizeof ( probe_tempo ), state->tempo_count * sizeof ( probe_tempo ) );
+                if ( result != BLASTMIDI_OK )
+                {
+                    return result;
+                }
+                entry = ( probe_tempo* ) state->tempos + state->tempo_count++;
+                entry->tick = cursor->tick;
+                memcpy ( ( void* ) &entry->tempo, ( void* ) event->data, sizeof ( uint32_t ) );
+                if ( probe_is_first ( instance, &state->best_tempo, cursor->tick, 1 ) )
+                {
+                    summary->tempo = entry->tempo;
+                }
+            }
+            else if ( event->subtype == BLASTMIDI_META_TIME_SIGNATURE && event->data_size >= 2 )
+            {
+                if ( probe_is_first ( instance, &state->best_time_signature, cursor->tick, 0 ) )
+                {
+                    summary->numerator = event->data[0];
+                    summary->denominator = event->data[1];
+                }
+            }
+            else if ( event->subtype == BLASTMIDI_META_KEY_SIGNATURE && event->data_size >= 2 )
+            {
+                if ( probe_is_first ( instance, &state->best_key_signature, cursor->tick, 0 ) )
+                {
+                    summary->key = ( int8_t ) event->data[0];
+                    summary->scale = event->data[1];
+                }
+            }
+        }
     }
 
     /*
-    * Read the tracks.
+    * The tracks of a type 2 file are independent sequences, each timed by its own tempo changes, which are played one after the
+    * other. Otherwise all the tracks play at once, and share the tempo map that the changes on all of them make up.
     */
-    for ( i = 0; i < instance->track_count; ++i )
+    if ( instance->file_type == 2 )
+    {
+        if ( instance->time_type == 0 )
+        {
+            summary->duration += probe_duration ( ( probe_tempo* ) state->tempos + first_tempo, state->tempo_count - first_tempo, cursor->tick, instance->ticks_per_beat );
+        }
+        summary->length += cursor->tick;
+        state->tempo_count = 0;
+        return BLASTMIDI_OK;
+    }
+    if ( cursor->tick > summary->length )
+    {
+        summary->length = cursor->tick;
+    }
+    return probe_merge_tempos ( instance, state );
+}
+
+uint8_t probe_file ( blastmidi* instance, const uint8_t* buffer, size_t size, blastmidi_summary* summary )
+{
+    uint8_t* input = NULL;
+    size_t input_capacity = 0;
+    probe_state state;
+    uint8_t result = 0;
+    uint16_t i;
+
+    if ( summary == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    memset ( ( void* ) summary, 0, sizeof ( blastmidi_summary ) );
+    summary->tempo = 500000;
+    summary->numerator = 4;
+    summary->denominator = 2;
+    memset ( ( void* ) &state, 0, sizeof ( probe_state ) );
+    state.best_tempo = UINT64_MAX;
+    state.best_time_signature = UINT64_MAX;
+    state.best_key_signature = UINT64_MAX;
+    reset ( instance );
+    instance->memory = buffer;
+    instance->memory_size = size;
+
+    result = read_header ( instance );
+    summary->file_type = instance->file_type;
+    summary->track_count = instance->track_count;
+    for ( i = 0; i < instance->track_count && result == BLASTMIDI_OK; ++i )
     {
-        result = read_track ( instance, i );
+        const uint8_t* chunk = NULL;
+        uint32_t chunk_size = 0;
+        blastmidi_cursor cursor;
+
+        result = load_track_chunk ( instance, buffer, size, &input, &input_capacity, &chunk, &chunk_size );
         if ( result != BLASTMIDI_OK )
         {
-            reset ( instance );
-            return result;
+            break;
+        }
+        blastmidi_cursor_initialize ( &cursor, chunk, chunk_size );
+        cursor.max_payload_size = instance->limits.max_payload_size;
+        result = probe_track ( instance, &cursor, &state, summary );
+    }
+
+    if ( result == BLASTMIDI_OK )
+    {
+        if ( instance->time_type == 1 )
+        {
+            double frames = instance->SMPTE_frames == 29 ? 30000.0 / 1001.0 : ( double ) instance->SMPTE_frames;
+            summary->duration = frames * instance->ticks_per_frame > 0 ? ( double ) summary->length / ( frames * instance->ticks_per_frame ) : 0;
+        }
+        else if ( instance->file_type != 2 )
+        {
+            summary->duration = probe_duration ( ( probe_tempo* ) state.tempos, state.tempo_count, summary->length, instance->ticks_per_beat );
         }
     }
-    instance->valid = 1;
-    return BLASTMIDI_OK;
+
+    if ( input )
+    {
+        instance->free_function ( input );
+    }
+    if ( state.tempos )
+    {
+        instance->free_function ( state.tempos );
+    }
+    if ( state.scratch )
+    {
+        instance->free_function ( state.scratch );
+    }
+    instance->memory = NULL;
+    instance->memory_size = 0;
+    reset ( instance );
+    return result;
+}
+
+uint8_t blastmidi_probe ( blastmidi* instance, blastmidi_summary* summary )
+{
+    if ( instance->data_callback == NULL )
+    {
+        return BLASTMIDI_NOCALLBACK;
+    }
+    return probe_file ( instance, NULL, 0, summary );
+}
+
+uint8_t blastmidi_probe_memory ( blastmidi* instance, const uint8_t* buffer, size_t size, blastmidi_summary* summary )
+{
+    if ( buffer == NULL || size == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    return probe_file ( instance, buffer, size, summary );
 }
 
-void blastmidi_whipe_track ( blastmidi* instance, unsigned int track )
+void blastmidi_free ( blastmidi* instance )
 {
-    blastmidi_event* current = NULL;
-    assert ( instance );
-    if ( instance == NULL )
+    reset_with_mode ( instance, BLASTMIDI_RESET_RELEASE );
+#ifdef BLASTMIDI_STATS
+    if ( instance->stats.track_times )
     {
-        return;
+        instance->free_function ( instance->stats.track_times );
     }
-    if ( track >= instance->track_count )
+    memset ( ( void* ) &instance->stats, 0, sizeof ( blastmidi_stats ) );
+#endif
+}
+
+uint8_t blastmidi_freeze ( blastmidi* instance, blastmidi_snapshot** snapshot )
+{
+    blastmidi_snapshot* output = NULL;
+    blastmidi_snapshot_track* tracks = NULL;
+    blastmidi_snapshot_event* events = NULL;
+    blastmidi_snapshot_tempo* tempos = NULL;
+    tick_entry* tempo_events = NULL;
+    uint8_t* data = NULL;
+    size_t event_count = 0;
+    size_t data_size = 0;
+    size_t tempo_event_count = 0;
+    size_t tempo_offset = 0;
+    size_t total_size = 0;
+    uint32_t index = 0;
+    uint32_t data_position = 0;
+    uint8_t tempo_map = 0;
+    size_t t;
+    uint16_t i;
+
+    if ( instance == NULL || snapshot == NULL )
     {
-        return;
+        return BLASTMIDI_INVALIDPARAM;
     }
-    current = instance->tracks[track];
-    while ( current )
+    *snapshot = NULL;
+    if ( instance->tracks == NULL || instance->track_count == 0 )
     {
-        blastmidi_event* next = current->next;
-        blastmidi_event_free ( instance, current );
-        current = next;
+        return BLASTMIDI_INVALIDPARAM;
     }
-}
 
-void blastmidi_event_free ( blastmidi* instance, blastmidi_event* event )
-{
     /*
-    * Note: This function does not take the linked list into consideration. Pointer bookkeeping has to have been done before
-    * this function is invoked.
+    * Tempo changes apply to all the tracks of a file, except in type 2 files where every track is a separate sequence.
+    * Without ticks per beat, the tempo does not affect timing at all.
     */
-    assert ( event );
-    if ( event->data && event->data_size > sizeof ( event->small_pool ) )
+    tempo_map = instance->time_type == 0 && instance->file_type != 2 && instance->ticks_per_beat > 0;
+
+    /*
+    * The first pass measures the snapshot.
+    */
+    for ( i = 0; i < instance->track_count; ++i )
     {
-        instance->free_function ( event->data );
+        blastmidi_event* current = instance->tracks[i];
+        while ( current )
+        {
+            ++event_count;
+            data_size += current->data_size;
+            if ( current->type == BLASTMIDI_META_EVENT && current->subtype == BLASTMIDI_META_SET_TEMPO && current->data_size >= sizeof ( uint32_t ) )
+            {
+                ++tempo_event_count;
+            }
+            current = current->next;
+        }
     }
-    instance->free_function ( event );
-}
-
-uint8_t blastmidi_add_event ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time, blastmidi_event* add_after )
-{
-    if ( instance == NULL )
+    total_size = sizeof ( blastmidi_snapshot ) + sizeof ( blastmidi_snapshot_track ) * instance->track_count;
+    if ( event_count > ( UINT32_MAX - total_size ) / sizeof ( blastmidi_snapshot_event ) )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_OUTOFMEMORY;
     }
-    if ( event == NULL )
+    total_size += sizeof ( blastmidi_snapshot_event ) * event_count;
+    if ( data_size > UINT32_MAX - total_size )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_OUTOFMEMORY;
     }
-    if ( event->track != -1 )
+    total_size += data_size;
+    if ( tempo_map )
     {
-        return BLASTMIDI_ALREADYADDED;
+
+        /*
+        * The tempo map goes last, aligned for its 64 bit members. It has room for an extra entry at tick 0.
+        */
+        tempo_offset = ( total_size + 7 ) & ~( size_t ) 7;
+        if ( tempo_event_count + 1 > ( UINT32_MAX - tempo_offset ) / sizeof ( blastmidi_snapshot_tempo ) )
+        {
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        total_size = tempo_offset + sizeof ( blastmidi_snapshot_tempo ) * ( tempo_event_count + 1 );
+        if ( tempo_event_count > 0 )
+        {
+            tempo_events = ( tick_entry* ) allocate_memory ( instance, sizeof ( tick_entry ) * tempo_event_count * 2 );
+            if ( tempo_events == NULL )
+            {
+                return BLASTMIDI_OUTOFMEMORY;
+            }
+        }
     }
-    if ( track_id >= instance->track_count )
+
+    output = ( blastmidi_snapshot* ) allocate_memory ( instance, total_size );
+    if ( output == NULL )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        if ( tempo_events )
+        {
+            instance->free_function ( tempo_events );
+        }
+        return BLASTMIDI_OUTOFMEMORY;
     }
-    event->track = track_id;
-    event->time = delta_time;
-    if ( add_after )
+    memset ( ( void* ) output, 0, sizeof ( blastmidi_snapshot ) );
+    memcpy ( output->magic, "BMSS", 4 );
+    output->version = BLASTMIDI_SNAPSHOT_VERSION;
+    output->endian_flag = instance->endian_flag;
+    output->file_type = instance->file_type;
+    output->time_type = instance->time_type;
+    output->SMPTE_frames = instance->SMPTE_frames;
+    output->ticks_per_frame = instance->ticks_per_frame;
+    output->ticks_per_beat = instance->ticks_per_beat;
+    output->track_count = instance->track_count;
+    output->size = ( uint32_t ) total_size;
+    output->tracks_offset = sizeof ( blastmidi_snapshot );
+    output->events_offset = output->tracks_offset + sizeof ( blastmidi_snapshot_track ) * instance->track_count;
+    output->data_offset = output->events_offset + ( uint32_t ) ( sizeof ( blastmidi_snapshot_event ) * event_count );
+    output->event_count = ( uint32_t ) event_count;
+    output->data_size = ( uint32_t ) data_size;
+
+    tracks = ( blastmidi_snapshot_track* ) ( ( uint8_t* ) output + output->tracks_offset );
+    events = ( blastmidi_snapshot_event* ) ( ( uint8_t* ) output + output->events_offset );
+    data = ( uint8_t* ) output + output->data_offset;
+
+    /*
+    * The second pass copies the events and their payloads, and collects the tempo changes.
+    */
+    tempo_event_count = 0;
+    for ( i = 0; i < instance->track_count; ++i )
     {
-        blastmidi_event* old_next = add_after->next;
-        add_after->next = event;
-        event->previous = add_after;
-        event->next = old_next;
-        if ( instance->track_ends[track_id] == add_after )
+        blastmidi_event* current = instance->tracks[i];
+        uint32_t tick = 0;
+        tracks[i].first_event = index;
+        while ( current )
         {
-            instance->track_ends[track_id] = event;
+            blastmidi_snapshot_event* target = &events[index++];
+            tick += current->time;
+            target->time = current->time;
+            target->tick = tick;
+            target->data_offset = data_position;
+            target->data_size = current->data_size;
+            target->type = current->type;
+            target->subtype = current->subtype;
+            target->channel = current->channel;
+            target->end_of_sysex = current->end_of_sysex;
+            if ( current->data_size > 0 )
+            {
+                memcpy ( data + data_position, current->data, current->data_size );
+                data_position += current->data_size;
+            }
+            if ( tempo_events && current->type == BLASTMIDI_META_EVENT && current->subtype == BLASTMIDI_META_SET_TEMPO && current->data_size >= sizeof ( uint32_t ) )
+            {
+                tempo_events[tempo_event_count].event = current;
+                tempo_events[tempo_event_count].tick = tick;
+                ++tempo_event_count;
+            }
+            current = current->next;
         }
+        tracks[i].event_count = index - tracks[i].first_event;
+        tracks[i].length = tick;
     }
-    else
+
+    if ( tempo_map )
     {
-        blastmidi_event* old_beginning = instance->tracks[track_id];
-        event->previous = NULL;
-        event->next = old_beginning;
-        instance->tracks[track_id] = event;
-        if ( instance->track_ends[track_id] == NULL )
+        uint64_t elapsed = 0;
+        uint32_t count = 1;
+
+        /*
+        * When several tempo changes fall on the same tick, the last one in track order wins.
+        * elapsed is kept in microseconds times ticks per beat, so that no rounding errors accumulate.
+        */
+        sort_tick_entries ( tempo_events, tempo_events + tempo_event_count, tempo_event_count );
+        tempos = ( blastmidi_snapshot_tempo* ) ( ( uint8_t* ) output + tempo_offset );
+        tempos[0].microseconds = 0;
+        tempos[0].tick = 0;
+        tempos[0].tempo = 500000;
+        for ( t = 0; t < tempo_event_count; ++t )
         {
-            instance->track_ends[track_id] = event;
+            blastmidi_snapshot_tempo* previous = &tempos[count - 1];
+            uint32_t tempo = 0;
+            memcpy ( ( void* ) &tempo, ( void* ) tempo_events[t].event->data, sizeof ( uint32_t ) );
+            if ( tempo_events[t].tick == previous->tick )
+            {
+                previous->tempo = tempo;
+                continue;
+            }
+            elapsed += ( uint64_t ) ( tempo_events[t].tick - previous->tick ) * previous->tempo;
+            tempos[count].microseconds = elapsed / instance->ticks_per_beat;
+            tempos[count].tick = tempo_events[t].tick;
+            tempos[count].tempo = tempo;
+            ++count;
+        }
+        output->tempo_offset = ( uint32_t ) tempo_offset;
+        output->tempo_count = count;
+        output->size = ( uint32_t ) ( tempo_offset + sizeof ( blastmidi_snapshot_tempo ) * count );
+        if ( tempo_events )
+        {
+            instance->free_function ( tempo_events );
         }
     }
+    *snapshot = output;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_add_event_to_beginning_of_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time )
+void blastmidi_snapshot_free ( blastmidi* instance, blastmidi_snapshot* snapshot )
 {
-    if ( instance == NULL )
-    {
-        return BLASTMIDI_INVALIDPARAM;
-    }
-    if ( event == NULL )
+    assert ( snapshot );
+    instance->free_function ( snapshot );
+}
+
+uint8_t blastmidi_snapshot_save ( blastmidi* instance, const blastmidi_snapshot* snapshot )
+{
+    if ( instance == NULL || snapshot == NULL )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event->track != -1 )
+    if ( instance->data_callback == NULL )
     {
-        return BLASTMIDI_ALREADYADDED;
+        return BLASTMIDI_NOCALLBACK;
     }
-    if ( track_id >= instance->track_count )
+    if ( write_bytes ( instance, ( uint8_t* ) snapshot, snapshot->size ) != BLASTMIDI_OK )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_WRITINGFAILED;
     }
-    return blastmidi_add_event ( instance, track_id, event, delta_time, NULL );
+    return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_add_event_to_end_of_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event, uint32_t delta_time )
+uint8_t blastmidi_snapshot_load ( const uint8_t* buffer, size_t size, const blastmidi_snapshot** snapshot )
 {
-    if ( instance == NULL )
+    const blastmidi_snapshot* header = ( const blastmidi_snapshot* ) buffer;
+    const blastmidi_snapshot_track* tracks = NULL;
+    const blastmidi_snapshot_event* events = NULL;
+    const blastmidi_snapshot_tempo* tempos = NULL;
+    uint32_t i;
+
+    if ( snapshot == NULL )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event == NULL )
+    *snapshot = NULL;
+    if ( buffer == NULL || ( ( size_t ) buffer & 7 ) != 0 )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event->track != -1 )
+
+    /*
+    * Check the header, and then that every array lies within the snapshot, in the order in which blastmidi_freeze lays them out.
+    * All the arithmetic is done in 64 bits, so that hostile values cannot wrap around.
+    */
+    if ( size < sizeof ( blastmidi_snapshot ) || memcmp ( header->magic, "BMSS", 4 ) != 0 || header->version != BLASTMIDI_SNAPSHOT_VERSION )
     {
-        return BLASTMIDI_ALREADYADDED;
+        return BLASTMIDI_INVALID;
     }
-    if ( track_id >= instance->track_count )
+    if ( header->endian_flag != ( is_little_endian() ? 1 : 2 ) || header->size > size || header->size < sizeof ( blastmidi_snapshot ) )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_INVALID;
     }
-    return blastmidi_add_event ( instance, track_id, event, delta_time, instance->track_ends[track_id] );
-}
-
-uint8_t blastmidi_get_first_event_on_track ( blastmidi* instance, uint16_t track_id, blastmidi_event** event )
-{
-    if ( instance == NULL )
+    if ( header->tracks_offset != sizeof ( blastmidi_snapshot ) || header->track_count == 0 )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_INVALID;
     }
-    if ( event == NULL )
+    if ( header->events_offset != ( uint64_t ) header->tracks_offset + ( uint64_t ) sizeof ( blastmidi_snapshot_track ) * header->track_count )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_INVALID;
     }
-    if ( track_id >= instance->track_count )
+    if ( header->data_offset != ( uint64_t ) header->events_offset + ( uint64_t ) sizeof ( blastmidi_snapshot_event ) * header->event_count )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return BLASTMIDI_INVALID;
+    }
+    if ( ( uint64_t ) header->data_offset + header->data_size > header->size )
+    {
+        return BLASTMIDI_INVALID;
+    }
+    if ( header->tempo_count > 0 )
+    {
+        if ( ( header->tempo_offset & 7 ) != 0 || header->tempo_offset < ( uint64_t ) header->data_offset + header->data_size )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        if ( ( uint64_t ) header->tempo_offset + ( uint64_t ) sizeof ( blastmidi_snapshot_tempo ) * header->tempo_count > header->size )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        if ( header->time_type != 0 || header->ticks_per_beat == 0 )
+        {
+            return BLASTMIDI_INVALID;
+        }
     }
-    *event = instance->tracks[track_id];
-    return BLASTMIDI_OK;
-}
 
-uint8_t blastmidi_get_last_event_on_track ( blastmidi* instance, uint16_t track_id, blastmidi_event** event )
-{
-    if ( instance == NULL )
+    tracks = ( const blastmidi_snapshot_track* ) ( buffer + header->tracks_offset );
+    events = ( const blastmidi_snapshot_event* ) ( buffer + header->events_offset );
+    for ( i = 0; i < header->track_count; ++i )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        if ( ( uint64_t ) tracks[i].first_event + tracks[i].event_count > header->event_count )
+        {
+            return BLASTMIDI_INVALID;
+        }
     }
-    if ( event == NULL )
+    for ( i = 0; i < header->event_count; ++i )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        if ( ( uint64_t ) events[i].data_offset + events[i].data_size > header->data_size )
+        {
+            return BLASTMIDI_INVALID;
+        }
     }
-    if ( track_id >= instance->track_count )
+    if ( header->tempo_count > 0 )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        tempos = ( const blastmidi_snapshot_tempo* ) ( buffer + header->tempo_offset );
+        if ( tempos[0].tick != 0 )
+        {
+            return BLASTMIDI_INVALID;
+        }
+        for ( i = 1; i < header->tempo_count; ++i )
+        {
+            if ( tempos[i].tick <= tempos[i - 1].tick )
+            {
+                return BLASTMIDI_INVALID;
+            }
+        }
     }
-    *event = instance->track_ends[track_id];
+    *snapshot = header;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_get_next_event_on_track ( blastmidi* instance, blastmidi_event** event )
+uint8_t blastmidi_snapshot_get_track ( const blastmidi_snapshot* snapshot, uint16_t track_id, const blastmidi_snapshot_track** track )
 {
-    if ( instance == NULL )
-    {
-        return BLASTMIDI_INVALIDPARAM;
-    }
-    if ( event == NULL )
+    if ( snapshot == NULL || track == NULL )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( *event == NULL )
+    if ( track_id >= snapshot->track_count )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    *event = event[0]->next;
+    *track = ( const blastmidi_snapshot_track* ) ( ( const uint8_t* ) snapshot + snapshot->tracks_offset ) + track_id;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_get_previous_event_on_track ( blastmidi* instance, blastmidi_event** event )
+uint8_t blastmidi_snapshot_get_event ( const blastmidi_snapshot* snapshot, uint16_t track_id, uint32_t index, const blastmidi_snapshot_event** event )
 {
-    if ( instance == NULL )
-    {
-        return BLASTMIDI_INVALIDPARAM;
-    }
-    if ( event == NULL )
+    const blastmidi_snapshot_track* track = NULL;
+    uint8_t result = blastmidi_snapshot_get_track ( snapshot, track_id, &track );
+    if ( result != BLASTMIDI_OK )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return result;
     }
-    if ( *event == NULL )
+    if ( event == NULL || index >= track->event_count )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    *event = event[0]->previous;
+    *event = ( const blastmidi_snapshot_event* ) ( ( const uint8_t* ) snapshot + snapshot->events_offset ) + track->first_event + index;
     return BLASTMIDI_OK;
 }
 
-uint8_t blastmidi_remove_event_from_track ( blastmidi* instance, uint16_t track_id, blastmidi_event* event )
+const uint8_t* blastmidi_snapshot_get_event_data ( const blastmidi_snapshot* snapshot, const blastmidi_snapshot_event* event )
 {
-
-    blastmidi_event* previous = NULL;
-    blastmidi_event* next = NULL;
-
-    if ( instance == NULL )
+    if ( snapshot == NULL || event == NULL || event->data_size == 0 )
     {
-        return BLASTMIDI_INVALIDPARAM;
+        return NULL;
     }
-    if ( track_id >= instance->track_count )
+    return ( const uint8_t* ) snapshot + snapshot->data_offset + event->data_offset;
+}
+
+uint8_t blastmidi_snapshot_get_tempo ( const blastmidi_snapshot* snapshot, uint32_t index, const blastmidi_snapshot_tempo** tempo )
+{
+    if ( snapshot == NULL || tempo == NULL || index >= snapshot->tempo_count )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event == NULL )
+    *tempo = ( const blastmidi_snapshot_tempo* ) ( ( const uint8_t* ) snapshot + snapshot->tempo_offset ) + index;
+    return BLASTMIDI_OK;
+}
+
+uint8_t blastmidi_snapshot_get_time ( const blastmidi_snapshot* snapshot, uint32_t tick, uint64_t* microseconds )
+{
+    const blastmidi_snapshot_tempo* tempos = NULL;
+    uint32_t low = 0;
+    uint32_t high = 0;
+    if ( snapshot == NULL || microseconds == NULL || snapshot->tempo_count == 0 )
     {
         return BLASTMIDI_INVALIDPARAM;
     }
-    if ( event->track == -1 )
-    {
-        return BLASTMIDI_NOTADDED;
-    }
-    if ( event->track != track_id )
-    {
-        return BLASTMIDI_NOTPARTOFTRACK;
-    }
-    previous = event->previous;
-    next = event->next;
-    if ( previous )
-    {
-        previous->next = next;
-    }
-    if ( next )
-    {
-        next->previous = previous;
-    }
-    if ( instance->tracks[track_id] == event )
-    {
-        instance->tracks[track_id] = next;
-    }
-    if ( instance->track_ends[track_id] == event )
+
+    /*
+    * Find the last tempo change at or before tick. The first entry is always at tick 0.
+    */
+    tempos = ( const blastmidi_snapshot_tempo* ) ( ( const uint8_t* ) snapshot + snapshot->tempo_offset );
+    high = snapshot->tempo_count - 1;
+    while ( low < high )
     {
-        instance->track_ends[track_id] = previous;
+        uint32_t middle = low + ( high - low + 1 ) / 2;
+        if ( tempos[middle].tick <= tick )
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
     }
-    blastmidi_event_free ( instance, event );
+    *microseconds = tempos[low].microseconds + ( uint64_t ) ( tick - tempos[low].tick ) * tempos[low].tempo / snapshot->ticks_per_beat;
     return BLASTMIDI_OK;
 }
-
-void blastmidi_free ( blastmidi* instance )
-{
-    reset ( instance );
-}
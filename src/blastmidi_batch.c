@@ -0,0 +1,596 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_batch.c
+* The implementation of the optional batch API.
+*
+* For the API reference, see blastmidi_batch.h.
+*/
+
+#ifndef _WIN32
+#ifndef _POSIX_C_SOURCE
+#define _POSIX_C_SOURCE 200112L /* For clock_gettime and sysconf */
+#endif
+#endif
+
+#include <stdlib.h> /* For malloc, realloc and free */
+#include <string.h> /* For memset */
+#include <stdio.h> /* For file I/O */
+#include "blastmidi_batch.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+/*
+* A minimal abstraction over the platform thread API.
+*/
+#ifdef _WIN32
+typedef CRITICAL_SECTION batch_mutex;
+typedef HANDLE batch_thread;
+typedef LPTHREAD_START_ROUTINE batch_thread_entry;
+#define batch_mutex_initialize(mutex) InitializeCriticalSection ( mutex )
+#define batch_mutex_destroy(mutex) DeleteCriticalSection ( mutex )
+#define batch_mutex_lock(mutex) EnterCriticalSection ( mutex )
+#define batch_mutex_unlock(mutex) LeaveCriticalSection ( mutex )
+#else
+typedef pthread_mutex_t batch_mutex;
+typedef pthread_t batch_thread;
+typedef void* ( *batch_thread_entry ) ( void* );
+#define batch_mutex_initialize(mutex) pthread_mutex_init ( mutex, NULL )
+#define batch_mutex_destroy(mutex) pthread_mutex_destroy ( mutex )
+#define batch_mutex_lock(mutex) pthread_mutex_lock ( mutex )
+#define batch_mutex_unlock(mutex) pthread_mutex_unlock ( mutex )
+#endif
+
+struct batch_context;
+
+/*
+* The state of one worker thread.
+* begin and end describe the range of path indices that the worker still has to process, and are protected by lock.
+* The worker takes paths from the front of its range, while other workers steal from the back.
+*/
+typedef struct batch_worker
+{
+    struct batch_context* context;
+    unsigned int index;
+    batch_thread thread;
+    batch_mutex lock;
+    size_t begin;
+    size_t end;
+    blastmidi instance;
+    uint8_t* buffer;
+    size_t buffer_capacity;
+    size_t files;
+    size_t failed;
+    uint64_t bytes;
+} batch_worker;
+
+typedef struct batch_context
+{
+    const char* const* paths;
+    blastmidi_batch_handler* handler;
+    void* user_data;
+    batch_worker* workers;
+    unsigned int worker_count;
+    volatile int stop;
+} batch_context;
+
+static double batch_get_time ( void )
+{
+#ifdef _WIN32
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER counter;
+    QueryPerformanceFrequency ( &frequency );
+    QueryPerformanceCounter ( &counter );
+    return ( double ) counter.QuadPart / ( double ) frequency.QuadPart;
+#else
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return ( double ) now.tv_sec + ( double ) now.tv_nsec / 1000000000.0;
+#endif
+}
+
+unsigned int blastmidi_batch_get_cpu_count ( void )
+{
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo ( &info );
+    return info.dwNumberOfProcessors > 0 ? ( unsigned int ) info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf ( _SC_NPROCESSORS_ONLN );
+    return count > 0 ? ( unsigned int ) count : 1;
+#endif
+}
+
+static int batch_take ( batch_worker* worker, size_t* index )
+{
+    int found = 0;
+    batch_mutex_lock ( &worker->lock );
+    if ( worker->begin < worker->end )
+    {
+        *index = worker->begin++;
+        found = 1;
+    }
+    batch_mutex_unlock ( &worker->lock );
+    return found;
+}
+
+static int batch_steal ( batch_worker* worker )
+{
+
+    /*
+    * Visit the other workers in turn, starting with the next one, and take the back half of the first non empty range.
+    */
+
+    batch_context* context = worker->context;
+    unsigned int i;
+    for ( i = 1; i < context->worker_count; ++i )
+    {
+        batch_worker* victim = &context->workers[ ( worker->index + i ) % context->worker_count];
+        size_t begin = 0;
+        size_t end = 0;
+        batch_mutex_lock ( &victim->lock );
+        if ( victim->begin < victim->end )
+        {
+            size_t remaining = victim->end - victim->begin;
+            end = victim->end;
+            begin = end - ( remaining + 1 ) / 2;
+            victim->end = begin;
+        }
+        batch_mutex_unlock ( &victim->lock );
+        if ( begin < end )
+        {
+            batch_mutex_lock ( &worker->lock );
+            worker->begin = begin;
+            worker->end = end;
+            batch_mutex_unlock ( &worker->lock );
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static uint8_t batch_load_file ( batch_worker* worker, const char* path, size_t* size )
+{
+    FILE* file = fopen ( path, "rb" );
+    long length = 0;
+    *size = 0;
+    if ( file == NULL )
+    {
+        return BLASTMIDI_FILEERROR;
+    }
+    if ( fseek ( file, 0, SEEK_END ) != 0 || ( length = ftell ( file ) ) < 0 || fseek ( file, 0, SEEK_SET ) != 0 )
+    {
+        fclose ( file );
+        return BLASTMIDI_FILEERROR;
+    }
+
+    /*
+    * The file buffer only ever grows, so a worker soon stops allocating.
+    */
+    if ( ( size_t ) length > worker->buffer_capacity )
+    {
+        uint8_t* buffer = ( uint8_t* ) realloc ( worker->buffer, ( size_t ) length );
+        if ( buffer == NULL )
+        {
+            fclose ( file );
+            return BLASTMIDI_OUTOFMEMORY;
+        }
+        worker->buffer = buffer;
+        worker->buffer_capacity = ( size_t ) length;
+    }
+    if ( length > 0 && fread ( worker->buffer, 1, ( size_t ) length, file ) != ( size_t ) length )
+    {
+        fclose ( file );
+        return BLASTMIDI_FILEERROR;
+    }
+    fclose ( file );
+    *size = ( size_t ) length;
+    return BLASTMIDI_OK;
+}
+
+static void batch_run_worker ( batch_worker* worker )
+{
+    batch_context* context = worker->context;
+    while ( !context->stop )
+    {
+        size_t index = 0;
+        size_t size = 0;
+        uint8_t result = 0;
+        if ( !batch_take ( worker, &index ) )
+        {
+            if ( !batch_steal ( worker ) )
+            {
+                break;
+            }
+            continue;
+        }
+        result = batch_load_file ( worker, context->paths[index], &size );
+        if ( result == BLASTMIDI_OK )
+        {
+            result = size > 0 ? blastmidi_read_memory ( &worker->instance, worker->buffer, size ) : BLASTMIDI_UNEXPECTEDEND;
+        }
+        worker->files++;
+        worker->bytes += size;
+        if ( result != BLASTMIDI_OK )
+        {
+            worker->failed++;
+        }
+        if ( context->handler && !context->handler ( &worker->instance, context->paths[index], result, worker->index, context->user_data ) )
+        {
+            context->stop = 1;
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI batch_thread_function ( LPVOID parameter )
+{
+    batch_run_worker ( ( batch_worker* ) parameter );
+    return 0;
+}
+#else
+static void* batch_thread_function ( void* parameter )
+{
+    batch_run_worker ( ( batch_worker* ) parameter );
+    return NULL;
+}
+#endif
+
+static int batch_start_thread ( batch_thread* thread, batch_thread_entry entry, void* parameter )
+{
+#ifdef _WIN32
+    *thread = CreateThread ( NULL, 0, entry, parameter, 0, NULL );
+    return *thread != NULL;
+#else
+    return pthread_create ( thread, NULL, entry, parameter ) == 0;
+#endif
+}
+
+static void batch_join_thread ( batch_thread* thread )
+{
+#ifdef _WIN32
+    WaitForSingleObject ( *thread, INFINITE );
+    CloseHandle ( *thread );
+#else
+    pthread_join ( *thread, NULL );
+#endif
+}
+
+uint8_t blastmidi_batch_read ( const char* const* paths, size_t path_count, unsigned int worker_count, blastmidi_batch_handler* handler, void* user_data, blastmidi_batch_stats* stats )
+{
+    batch_context context;
+    double start_time = 0;
+    unsigned int started = 0;
+    unsigned int i;
+
+    if ( stats )
+    {
+        memset ( ( void* ) stats, 0, sizeof ( blastmidi_batch_stats ) );
+    }
+    if ( paths == NULL && path_count > 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( path_count == 0 )
+    {
+        return BLASTMIDI_OK;
+    }
+    if ( worker_count == 0 )
+    {
+        worker_count = blastmidi_batch_get_cpu_count();
+    }
+    if ( worker_count > path_count )
+    {
+        worker_count = ( unsigned int ) path_count;
+    }
+
+    memset ( ( void* ) &context, 0, sizeof ( batch_context ) );
+    context.paths = paths;
+    context.handler = handler;
+    context.user_data = user_data;
+    context.worker_count = worker_count;
+    context.workers = ( batch_worker* ) malloc ( sizeof ( batch_worker ) * worker_count );
+    if ( context.workers == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    memset ( ( void* ) context.workers, 0, sizeof ( batch_worker ) * worker_count );
+
+    /*
+    * Give every worker an equal share of the paths up front. Stealing takes care of any imbalance later on.
+    */
+    for ( i = 0; i < worker_count; ++i )
+    {
+        batch_worker* worker = &context.workers[i];
+        worker->context = &context;
+        worker->index = i;
+        worker->begin = path_count * i / worker_count;
+        worker->end = path_count * ( i + 1 ) / worker_count;
+        batch_mutex_initialize ( &worker->lock );
+        blastmidi_initialize ( &worker->instance, NULL, NULL );
+        blastmidi_set_recycling ( &worker->instance, 1 );
+    }
+
+    start_time = batch_get_time();
+    for ( i = 0; i < worker_count; ++i )
+    {
+        if ( !batch_start_thread ( &context.workers[i].thread, batch_thread_function, &context.workers[i] ) )
+        {
+            break;
+        }
+        ++started;
+    }
+    if ( started == 0 )
+    {
+        /*
+        * We could not start any threads at all, so the calling thread does all the work.
+        */
+        batch_run_worker ( &context.workers[0] );
+    }
+    for ( i = 0; i < started; ++i )
+    {
+        batch_join_thread ( &context.workers[i].thread );
+    }
+
+    /*
+    * If only some of the threads could be started, the running workers have already stolen the work of the others.
+    */
+    for ( i = 0; i < worker_count; ++i )
+    {
+        batch_worker* worker = &context.workers[i];
+        if ( stats )
+        {
+            stats->files += worker->files;
+            stats->failed += worker->failed;
+            stats->bytes += worker->bytes;
+        }
+        blastmidi_free ( &worker->instance );
+        free ( worker->buffer );
+        batch_mutex_destroy ( &worker->lock );
+    }
+    if ( stats )
+    {
+        stats->seconds = batch_get_time() - start_time;
+        if ( stats->seconds > 0 )
+        {
+            stats->files_per_second = ( double ) stats->files / stats->seconds;
+            stats->megabytes_per_second = ( double ) stats->bytes / 1048576.0 / stats->seconds;
+        }
+    }
+    free ( context.workers );
+    return BLASTMIDI_OK;
+}
+
+/*
+* The shared state of a parallel write. The workers take the tracks to encode one at a time, in order, under lock.
+* result is the first error that any worker ran into, and is protected by lock as well.
+*/
+typedef struct batch_write_context
+{
+    blastmidi* instance;
+    const uint16_t* tracks;
+    size_t track_count;
+    size_t next;
+    uint8_t** chunks;
+    size_t* chunk_sizes;
+    size_t chunk_total;
+    uint8_t result;
+    batch_mutex lock;
+} batch_write_context;
+
+/*
+* Allocates a block with the allocation functions of the instance, and counts it in its statistics if they are enabled.
+*/
+static void* batch_allocate ( blastmidi* instance, size_t size )
+{
+#ifdef BLASTMIDI_STATS
+    instance->stats.allocations++;
+    instance->stats.bytes_allocated += size;
+#endif
+    return instance->malloc_function ( size );
+}
+
+static void batch_release ( blastmidi* instance, void* block )
+{
+    if ( block )
+    {
+        instance->free_function ( block );
+    }
+}
+
+/*
+* Allocates the buffer for an encoded chunk. The chunks are all held until the write is complete, so together with the parsed
+* file they must fit within the max_memory limit of the instance. This is called with the lock held, so the allocation functions
+* of the instance are never called from two threads at once.
+*/
+static uint8_t batch_allocate_chunk ( batch_write_context* context, size_t size, uint8_t** chunk )
+{
+    blastmidi* instance = context->instance;
+    size_t used = instance->memory_total + context->chunk_total;
+    if ( instance->limits.max_memory && ( used > instance->limits.max_memory || size > instance->limits.max_memory - used ) )
+    {
+        return BLASTMIDI_LIMITEXCEEDED;
+    }
+    *chunk = ( uint8_t* ) batch_allocate ( instance, size );
+    if ( *chunk == NULL )
+    {
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    context->chunk_total += size;
+    return BLASTMIDI_OK;
+}
+
+static void batch_run_writer ( batch_write_context* context )
+{
+    while ( 1 )
+    {
+        uint16_t track = 0;
+        uint8_t* chunk = NULL;
+        size_t size = 0;
+        uint8_t result = BLASTMIDI_OK;
+        batch_mutex_lock ( &context->lock );
+        if ( context->result != BLASTMIDI_OK || context->next >= context->track_count )
+        {
+            batch_mutex_unlock ( &context->lock );
+            break;
+        }
+        track = context->tracks[context->next++];
+        batch_mutex_unlock ( &context->lock );
+
+        result = blastmidi_encode_track ( context->instance, track, NULL, 0, &size );
+        if ( result == BLASTMIDI_OK )
+        {
+            batch_mutex_lock ( &context->lock );
+            result = batch_allocate_chunk ( context, size, &chunk );
+            batch_mutex_unlock ( &context->lock );
+        }
+        if ( result == BLASTMIDI_OK )
+        {
+            result = blastmidi_encode_track ( context->instance, track, chunk, size, &size );
+        }
+        context->chunks[track] = chunk;
+        context->chunk_sizes[track] = size;
+        if ( result != BLASTMIDI_OK )
+        {
+            batch_mutex_lock ( &context->lock );
+            if ( context->result == BLASTMIDI_OK )
+            {
+                context->result = result;
+            }
+            batch_mutex_unlock ( &context->lock );
+        }
+    }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI batch_write_thread_function ( LPVOID parameter )
+{
+    batch_run_writer ( ( batch_write_context* ) parameter );
+    return 0;
+}
+#else
+static void* batch_write_thread_function ( void* parameter )
+{
+    batch_run_writer ( ( batch_write_context* ) parameter );
+    return NULL;
+}
+#endif
+
+uint8_t blastmidi_batch_write ( blastmidi* instance, const uint8_t* source, size_t source_size, unsigned int worker_count )
+{
+    batch_write_context context;
+    batch_thread* threads = NULL;
+    uint16_t* tracks = NULL;
+    unsigned int started = 0;
+    uint8_t result = BLASTMIDI_OK;
+    size_t i;
+
+    if ( instance == NULL || instance->tracks == NULL || instance->track_count == 0 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( worker_count == 0 )
+    {
+        worker_count = blastmidi_batch_get_cpu_count();
+    }
+
+    /*
+    * A single thread gains nothing from encoding every track into a buffer of its own, so the writer of the core is used instead.
+    */
+    if ( worker_count == 1 )
+    {
+        return source ? blastmidi_write_incremental ( instance, source, source_size ) : blastmidi_write ( instance );
+    }
+
+    memset ( ( void* ) &context, 0, sizeof ( batch_write_context ) );
+    tracks = ( uint16_t* ) batch_allocate ( instance, sizeof ( uint16_t ) * instance->track_count );
+    context.chunks = ( uint8_t** ) batch_allocate ( instance, sizeof ( uint8_t* ) * instance->track_count );
+    context.chunk_sizes = ( size_t* ) batch_allocate ( instance, sizeof ( size_t ) * instance->track_count );
+    if ( tracks == NULL || context.chunks == NULL || context.chunk_sizes == NULL )
+    {
+        batch_release ( instance, tracks );
+        batch_release ( instance, context.chunks );
+        batch_release ( instance, context.chunk_sizes );
+        return BLASTMIDI_OUTOFMEMORY;
+    }
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        context.chunks[i] = NULL;
+        context.chunk_sizes[i] = 0;
+    }
+
+    /*
+    * Only the tracks that cannot be copied from the source are encoded.
+    */
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        if ( source == NULL || instance->track_sources[i].dirty )
+        {
+            tracks[context.track_count++] = ( uint16_t ) i;
+        }
+    }
+    context.instance = instance;
+    context.tracks = tracks;
+    context.result = BLASTMIDI_OK;
+    batch_mutex_initialize ( &context.lock );
+
+    if ( worker_count > context.track_count )
+    {
+        worker_count = ( unsigned int ) context.track_count;
+    }
+    /*
+    * The calling thread is one of the workers, so that the work gets done even if no other thread could be started.
+    */
+    if ( worker_count > 1 )
+    {
+        threads = ( batch_thread* ) malloc ( sizeof ( batch_thread ) * ( worker_count - 1 ) );
+    }
+    if ( threads )
+    {
+        for ( started = 0; started < worker_count - 1; ++started )
+        {
+            if ( !batch_start_thread ( &threads[started], batch_write_thread_function, &context ) )
+            {
+                break;
+            }
+        }
+    }
+
+    batch_run_writer ( &context );
+    for ( i = 0; i < started; ++i )
+    {
+        batch_join_thread ( &threads[i] );
+    }
+    result = context.result;
+
+    /*
+    * The chunks are written in order by the calling thread, one write per chunk.
+    */
+    if ( result == BLASTMIDI_OK )
+    {
+        result = blastmidi_write_encoded ( instance, source, source_size, ( const uint8_t* const* ) context.chunks, context.chunk_sizes );
+    }
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        batch_release ( instance, context.chunks[i] );
+    }
+    batch_mutex_destroy ( &context.lock );
+    free ( threads );
+    batch_release ( instance, tracks );
+    batch_release ( instance, context.chunks );
+    batch_release ( instance, context.chunk_sizes );
+    return result;
+}
@@ -0,0 +1,577 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_render.c
+* The implementation of the optional render API.
+*
+* For the API reference, see blastmidi_render.h.
+*/
+
+#include <math.h> /* For pow */
+#include <string.h> /* For memset and memcpy */
+#include "blastmidi_render.h"
+
+#if !defined(BLASTMIDI_NO_SIMD) && ( defined(__SSE2__) || defined(_M_X64) || ( defined(_M_IX86_FP) && _M_IX86_FP >= 2 ) )
+#define RENDER_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+* The index of the tone that the drum channel plays, after the 16 families of programs.
+*/
+#define RENDER_DRUMS 16
+
+/*
+* The gain of a single voice at full velocity and volume, which leaves some headroom for chords before the output is clipped.
+*/
+#define RENDER_GAIN 0.25f
+
+/*
+* Voices whose envelope falls below this level, about -80 dB, are freed.
+*/
+#define RENDER_SILENCE 0.0001f
+
+/*
+* The tone of every family of 8 General Midi programs, and of the drum channel last. The weights of the second and third
+* harmonics are relative to the fundamental. decay is the time in seconds that a held note takes to fade by 60 dB, or 0 if it
+* is sustained, and release is the same time after the note has been released.
+*/
+typedef struct render_tone
+{
+    float harmonic_2;
+    float harmonic_3;
+    double decay;
+    double release;
+} render_tone;
+
+static const render_tone render_tones[17] =
+{
+    { 0.5f, 0.25f, 1.5, 0.3 }, /* Piano */
+    { 0.1f, 0.3f, 0.8, 0.3 }, /* Chromatic percussion */
+    { 0.7f, 0.5f, 0.0, 0.05 }, /* Organ */
+    { 0.5f, 0.3f, 1.2, 0.2 }, /* Guitar */
+    { 0.4f, 0.1f, 1.5, 0.1 }, /* Bass */
+    { 0.5f, 0.33f, 0.0, 0.3 }, /* Strings */
+    { 0.5f, 0.33f, 0.0, 0.4 }, /* Ensemble */
+    { 0.7f, 0.5f, 0.0, 0.1 }, /* Brass */
+    { 0.2f, 0.5f, 0.0, 0.08 }, /* Reed */
+    { 0.1f, 0.05f, 0.0, 0.1 }, /* Pipe */
+    { 0.5f, 0.33f, 0.0, 0.1 }, /* Synth lead */
+    { 0.3f, 0.1f, 0.0, 0.8 }, /* Synth pad */
+    { 0.4f, 0.2f, 2.0, 0.5 }, /* Synth effects */
+    { 0.4f, 0.3f, 1.2, 0.2 }, /* Ethnic */
+    { 0.2f, 0.1f, 0.4, 0.1 }, /* Percussive */
+    { 0.5f, 0.5f, 1.0, 0.2 }, /* Sound effects */
+    { 0.0f, 0.0f, 0.15, 0.15 } /* Drums */
+};
+
+/*
+* The multiplier per frame that makes an envelope fade by 60 dB in the given number of seconds, or 1 for 0 seconds.
+*/
+static float render_get_decay ( double seconds, uint32_t sample_rate )
+{
+    if ( seconds <= 0 )
+    {
+        return 1.0f;
+    }
+    return ( float ) pow ( 0.001, 1.0 / ( seconds * sample_rate ) );
+}
+
+/*
+* The frame at which the current event of the renderer falls due.
+*/
+static uint64_t render_get_frame ( const blastmidi_renderer* renderer )
+{
+    const blastmidi* instance = renderer->instance;
+    uint64_t microseconds = 0;
+    if ( instance->time_type == 1 )
+    {
+        if ( instance->SMPTE_frames == 0 || instance->ticks_per_frame == 0 )
+        {
+            return 0;
+        }
+
+        /*
+        * 29 stands for 29.97 drop frame, where a frame lasts 1001 / 30000 seconds.
+        */
+        if ( instance->SMPTE_frames == 29 )
+        {
+            return renderer->tick * renderer->sample_rate * 1001u / ( 30000u * instance->ticks_per_frame );
+        }
+        return renderer->tick * renderer->sample_rate / ( ( uint64_t ) instance->SMPTE_frames * instance->ticks_per_frame );
+    }
+    if ( instance->ticks_per_beat == 0 )
+    {
+        return 0;
+    }
+    microseconds = ( renderer->tempo_time + ( renderer->tick - renderer->tempo_tick ) * renderer->tempo ) / instance->ticks_per_beat;
+    return microseconds * renderer->sample_rate / 1000000u;
+}
+
+/*
+* The gains of a voice follow the square of the velocity, volume and expression, which is close to the curves that General
+* Midi recommends. Pan keeps the near side at full gain and fades the far side.
+*/
+static void render_update_gains ( blastmidi_renderer* renderer, unsigned int voice )
+{
+    const blastmidi_render_channel* channel = &renderer->channels[renderer->voice_channels[voice]];
+    float gain = ( float ) renderer->velocities[voice] * channel->volume * channel->expression / ( 127.0f * 127.0f * 127.0f );
+    float pan = channel->pan / 127.0f;
+    gain = gain * gain * RENDER_GAIN / ( 1.0f + renderer->weights_2[voice] + renderer->weights_3[voice] );
+    renderer->lefts[voice] = pan > 0.5f ? gain * 2.0f * ( 1.0f - pan ) : gain;
+    renderer->rights[voice] = pan < 0.5f ? gain * 2.0f * pan : gain;
+}
+
+/*
+* Steps beyond half a cycle per frame would alias, so such notes are silenced by stepping exactly half a cycle.
+*/
+static void render_update_step ( blastmidi_renderer* renderer, unsigned int voice )
+{
+    const blastmidi_render_channel* channel = &renderer->channels[renderer->voice_channels[voice]];
+    float step = renderer->increments[renderer->notes[voice]];
+    if ( channel->bend != 8192 )
+    {
+        step *= ( float ) pow ( 2.0, ( ( double ) channel->bend - 8192.0 ) / ( 8192.0 * 6.0 ) );
+    }
+    renderer->steps[voice] = step < 0.5f ? step : 0.5f;
+}
+
+static void render_release ( blastmidi_renderer* renderer, unsigned int voice )
+{
+    uint8_t channel = renderer->voice_channels[voice];
+    renderer->states[voice] = 3;
+    renderer->voice_decays[voice] = renderer->releases[channel == 9 ? RENDER_DRUMS : renderer->channels[channel].program >> 3];
+}
+
+static void render_note_on ( blastmidi_renderer* renderer, uint8_t channel, uint8_t note, uint8_t velocity )
+{
+    unsigned int tone = channel == 9 ? RENDER_DRUMS : renderer->channels[channel].program >> 3;
+    unsigned int voice = 0;
+    unsigned int i = 0;
+    float quietest = 0;
+
+    /*
+    * Free voices are taken from the start, so that the voices that sound stay together in as few groups of 4 as possible.
+    */
+    for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+    {
+        float level = renderer->amplitudes[i] + ( renderer->states[i] == 3 ? 0.0f : 2.0f );
+        if ( renderer->states[i] == 0 )
+        {
+            voice = i;
+            break;
+        }
+        if ( i == 0 || level < quietest )
+        {
+            voice = i;
+            quietest = level;
+        }
+    }
+    renderer->phases[voice] = 0;
+    renderer->amplitudes[voice] = 1.0f;
+    renderer->voice_decays[voice] = renderer->decays[tone];
+    renderer->weights_2[voice] = render_tones[tone].harmonic_2;
+    renderer->weights_3[voice] = render_tones[tone].harmonic_3;
+    renderer->velocities[voice] = velocity;
+    renderer->notes[voice] = note;
+    renderer->voice_channels[voice] = channel;
+    renderer->states[voice] = 1;
+    render_update_gains ( renderer, voice );
+    render_update_step ( renderer, voice );
+}
+
+static void render_note_off ( blastmidi_renderer* renderer, uint8_t channel, uint8_t note )
+{
+    unsigned int i = 0;
+    for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+    {
+        if ( renderer->states[i] == 1 && renderer->voice_channels[i] == channel && renderer->notes[i] == note )
+        {
+            if ( renderer->channels[channel].sustain )
+            {
+                renderer->states[i] = 2;
+            }
+            else
+            {
+                render_release ( renderer, i );
+            }
+        }
+    }
+}
+
+static void render_controller ( blastmidi_renderer* renderer, uint8_t channel, uint8_t controller, uint8_t value )
+{
+    blastmidi_render_channel* state = &renderer->channels[channel];
+    unsigned int i = 0;
+    switch ( controller )
+    {
+        case 7:
+            state->volume = value;
+            break;
+        case 10:
+            state->pan = value;
+            break;
+        case 11:
+            state->expression = value;
+            break;
+        case 64:
+            state->sustain = value >= 64;
+            break;
+        case 121:
+            state->expression = 127;
+            state->bend = 8192;
+            state->sustain = 0;
+            break;
+        case 120:
+        case 123:
+            break;
+        default:
+            return;
+    }
+
+    /*
+    * Bring the voices of the channel up to date with the change.
+    */
+    for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+    {
+        if ( renderer->states[i] == 0 || renderer->voice_channels[i] != channel )
+        {
+            continue;
+        }
+        if ( controller == 120 )
+        {
+            renderer->states[i] = 0;
+            renderer->amplitudes[i] = 0;
+            continue;
+        }
+        if ( ( renderer->states[i] == 2 && !state->sustain ) || ( controller == 123 && renderer->states[i] == 1 ) )
+        {
+            if ( state->sustain )
+            {
+                renderer->states[i] = 2;
+            }
+            else
+            {
+                render_release ( renderer, i );
+            }
+        }
+        render_update_gains ( renderer, i );
+        if ( controller == 121 )
+        {
+            render_update_step ( renderer, i );
+        }
+    }
+}
+
+/*
+* Applies the current event of the renderer, and moves on to the next one.
+*/
+static void render_step ( blastmidi_renderer* renderer )
+{
+    const blastmidi_event* event = renderer->event;
+    if ( event->type == BLASTMIDI_META_EVENT && event->subtype == BLASTMIDI_META_SET_TEMPO && event->data_size >= sizeof ( uint32_t ) )
+    {
+        renderer->tempo_time += ( renderer->tick - renderer->tempo_tick ) * renderer->tempo;
+        renderer->tempo_tick = renderer->tick;
+        memcpy ( ( void* ) &renderer->tempo, ( void* ) event->data, sizeof ( uint32_t ) );
+    }
+    else if ( event->type == BLASTMIDI_CHANNEL_EVENT && event->channel >= 0 && event->channel < 16 && event->data_size >= 1 )
+    {
+        uint8_t channel = ( uint8_t ) event->channel;
+        unsigned int i = 0;
+        switch ( event->subtype )
+        {
+            case BLASTMIDI_CHANNEL_NOTE_ON:
+
+                /*
+                * A note on with a velocity of 0 is a note off.
+                */
+                if ( event->data_size >= 2 && ( event->data[1] & 0x7F ) > 0 )
+                {
+                    render_note_on ( renderer, channel, event->data[0] & 0x7F, event->data[1] & 0x7F );
+                }
+                else
+                {
+                    render_note_off ( renderer, channel, event->data[0] & 0x7F );
+                }
+                break;
+            case BLASTMIDI_CHANNEL_NOTE_OFF:
+                render_note_off ( renderer, channel, event->data[0] & 0x7F );
+                break;
+            case BLASTMIDI_CHANNEL_CONTROLLER:
+                if ( event->data_size >= 2 )
+                {
+                    render_controller ( renderer, channel, event->data[0], event->data[1] & 0x7F );
+                }
+                break;
+            case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
+                renderer->channels[channel].program = event->data[0] & 0x7F;
+                break;
+            case BLASTMIDI_CHANNEL_PITCH_BEND:
+                if ( event->data_size >= sizeof ( uint16_t ) )
+                {
+                    memcpy ( ( void* ) &renderer->channels[channel].bend, ( void* ) event->data, sizeof ( uint16_t ) );
+                    for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+                    {
+                        if ( renderer->states[i] != 0 && renderer->voice_channels[i] == channel )
+                        {
+                            render_update_step ( renderer, i );
+                        }
+                    }
+                }
+                break;
+            default:
+                break;
+        }
+    }
+    renderer->event = event->next;
+    if ( renderer->event )
+    {
+        renderer->tick += renderer->event->time;
+        renderer->event_frame = render_get_frame ( renderer );
+    }
+}
+
+/*
+* The harmonics are computed with a parabolic approximation of the sine, refined once, which is within 0.1 percent of the real
+* thing and needs no tables or divisions. The phase must lie between 0 and 1, and the second and third harmonics take the
+* fraction of twice and three times the phase. The scalar and SSE2 versions perform the same operations in the same order,
+* so that they produce the same output.
+*/
+#ifndef RENDER_SSE2
+static float render_sine ( float phase )
+{
+    float u = 1.0f - 2.0f * phase;
+    float y = 4.0f * u * ( 1.0f - ( u < 0 ? -u : u ) );
+    return y + 0.225f * ( y * ( y < 0 ? -y : y ) - y );
+}
+#endif
+
+#ifdef RENDER_SSE2
+static __m128 render_sine_4 ( __m128 phase )
+{
+    const __m128 sign = _mm_set1_ps ( -0.0f );
+    __m128 u = _mm_sub_ps ( _mm_set1_ps ( 1.0f ), _mm_mul_ps ( _mm_set1_ps ( 2.0f ), phase ) );
+    __m128 y = _mm_mul_ps ( _mm_mul_ps ( _mm_set1_ps ( 4.0f ), u ), _mm_sub_ps ( _mm_set1_ps ( 1.0f ), _mm_andnot_ps ( sign, u ) ) );
+    return _mm_add_ps ( y, _mm_mul_ps ( _mm_set1_ps ( 0.225f ), _mm_sub_ps ( _mm_mul_ps ( y, _mm_andnot_ps ( sign, y ) ), y ) ) );
+}
+
+static __m128 render_fraction_4 ( __m128 value )
+{
+    return _mm_sub_ps ( value, _mm_cvtepi32_ps ( _mm_cvttps_epi32 ( value ) ) );
+}
+
+/*
+* Synthesizes the 4 voices of a group into the mix, one frame at a time, with all their state in registers.
+*/
+static void render_group ( blastmidi_renderer* renderer, unsigned int first, size_t frames )
+{
+    const __m128 one = _mm_set1_ps ( 1.0f );
+    const __m128 two = _mm_set1_ps ( 2.0f );
+    const __m128 three = _mm_set1_ps ( 3.0f );
+    __m128 phase = _mm_loadu_ps ( renderer->phases + first );
+    __m128 step = _mm_loadu_ps ( renderer->steps + first );
+    __m128 amplitude = _mm_loadu_ps ( renderer->amplitudes + first );
+    __m128 decay = _mm_loadu_ps ( renderer->voice_decays + first );
+    __m128 left = _mm_loadu_ps ( renderer->lefts + first );
+    __m128 right = _mm_loadu_ps ( renderer->rights + first );
+    __m128 weight_2 = _mm_loadu_ps ( renderer->weights_2 + first );
+    __m128 weight_3 = _mm_loadu_ps ( renderer->weights_3 + first );
+    float* mix_left = renderer->mix[0];
+    float* mix_right = renderer->mix[1];
+    size_t i = 0;
+    for ( i = 0; i < frames; ++i )
+    {
+        __m128 sample = render_sine_4 ( phase );
+        sample = _mm_add_ps ( sample, _mm_mul_ps ( weight_2, render_sine_4 ( render_fraction_4 ( _mm_mul_ps ( phase, two ) ) ) ) );
+        sample = _mm_add_ps ( sample, _mm_mul_ps ( weight_3, render_sine_4 ( render_fraction_4 ( _mm_mul_ps ( phase, three ) ) ) ) );
+        sample = _mm_mul_ps ( sample, amplitude );
+        amplitude = _mm_mul_ps ( amplitude, decay );
+        _mm_storeu_ps ( mix_left + i * 4, _mm_add_ps ( _mm_loadu_ps ( mix_left + i * 4 ), _mm_mul_ps ( sample, left ) ) );
+        _mm_storeu_ps ( mix_right + i * 4, _mm_add_ps ( _mm_loadu_ps ( mix_right + i * 4 ), _mm_mul_ps ( sample, right ) ) );
+        phase = _mm_add_ps ( phase, step );
+        phase = _mm_sub_ps ( phase, _mm_and_ps ( _mm_cmpge_ps ( phase, one ), one ) );
+    }
+    _mm_storeu_ps ( renderer->phases + first, phase );
+    _mm_storeu_ps ( renderer->amplitudes + first, amplitude );
+}
+#else
+static void render_group ( blastmidi_renderer* renderer, unsigned int first, size_t frames )
+{
+    unsigned int lane = 0;
+    for ( lane = 0; lane < 4; ++lane )
+    {
+        unsigned int voice = first + lane;
+        float phase = renderer->phases[voice];
+        float step = renderer->steps[voice];
+        float amplitude = renderer->amplitudes[voice];
+        float decay = renderer->voice_decays[voice];
+        float left = renderer->lefts[voice];
+        float right = renderer->rights[voice];
+        float weight_2 = renderer->weights_2[voice];
+        float weight_3 = renderer->weights_3[voice];
+        float* mix_left = renderer->mix[0] + lane;
+        float* mix_right = renderer->mix[1] + lane;
+        size_t i = 0;
+        if ( renderer->states[voice] == 0 )
+        {
+            continue;
+        }
+        for ( i = 0; i < frames; ++i )
+        {
+            float sample = render_sine ( phase );
+            float phase_2 = phase * 2.0f;
+            float phase_3 = phase * 3.0f;
+            sample = sample + weight_2 * render_sine ( phase_2 - ( float ) ( int ) phase_2 );
+            sample = sample + weight_3 * render_sine ( phase_3 - ( float ) ( int ) phase_3 );
+            sample = sample * amplitude;
+            amplitude = amplitude * decay;
+            mix_left[i * 4] += sample * left;
+            mix_right[i * 4] += sample * right;
+            phase = phase + step;
+            if ( phase >= 1.0f )
+            {
+                phase -= 1.0f;
+            }
+        }
+        renderer->phases[voice] = phase;
+        renderer->amplitudes[voice] = amplitude;
+    }
+}
+#endif
+
+/*
+* Synthesizes the given number of frames, which is at most BLASTMIDI_RENDER_BLOCK, into output, and frees the voices that have
+* faded away.
+*/
+static void render_block ( blastmidi_renderer* renderer, float* output, size_t frames )
+{
+    unsigned int group = 0;
+    unsigned int i = 0;
+    size_t frame = 0;
+    memset ( ( void* ) renderer->mix[0], 0, sizeof ( float ) * 4 * frames );
+    memset ( ( void* ) renderer->mix[1], 0, sizeof ( float ) * 4 * frames );
+    for ( group = 0; group < BLASTMIDI_RENDER_VOICES; group += 4 )
+    {
+        if ( renderer->states[group] || renderer->states[group + 1] || renderer->states[group + 2] || renderer->states[group + 3] )
+        {
+            render_group ( renderer, group, frames );
+        }
+    }
+    for ( frame = 0; frame < frames; ++frame )
+    {
+        const float* lanes_left = renderer->mix[0] + frame * 4;
+        const float* lanes_right = renderer->mix[1] + frame * 4;
+        float left = ( lanes_left[0] + lanes_left[1] ) + ( lanes_left[2] + lanes_left[3] );
+        float right = ( lanes_right[0] + lanes_right[1] ) + ( lanes_right[2] + lanes_right[3] );
+        left = left < -1.0f ? -1.0f : left > 1.0f ? 1.0f : left;
+        right = right < -1.0f ? -1.0f : right > 1.0f ? 1.0f : right;
+        if ( renderer->channel_count == 2 )
+        {
+            output[frame * 2] = left;
+            output[frame * 2 + 1] = right;
+        }
+        else
+        {
+            output[frame] = ( left + right ) * 0.5f;
+        }
+    }
+    for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+    {
+        if ( renderer->states[i] != 0 && renderer->amplitudes[i] < RENDER_SILENCE )
+        {
+            renderer->states[i] = 0;
+            renderer->amplitudes[i] = 0;
+        }
+    }
+}
+
+uint8_t blastmidi_render_initialize ( blastmidi_renderer* renderer, const blastmidi* instance, uint16_t track_id, uint32_t sample_rate, uint8_t channel_count )
+{
+    unsigned int i = 0;
+    if ( renderer == NULL || instance == NULL || track_id >= instance->track_count || sample_rate == 0 || channel_count < 1 || channel_count > 2 )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    memset ( ( void* ) renderer, 0, sizeof ( blastmidi_renderer ) );
+    renderer->instance = instance;
+    renderer->event = instance->tracks[track_id];
+    renderer->sample_rate = sample_rate;
+    renderer->channel_count = channel_count;
+    renderer->tempo = 500000;
+    for ( i = 0; i < 17; ++i )
+    {
+        renderer->decays[i] = render_get_decay ( render_tones[i].decay, sample_rate );
+        renderer->releases[i] = render_get_decay ( render_tones[i].release, sample_rate );
+    }
+    for ( i = 0; i < 128; ++i )
+    {
+        renderer->increments[i] = ( float ) ( 440.0 * pow ( 2.0, ( ( double ) i - 69.0 ) / 12.0 ) / sample_rate );
+    }
+    for ( i = 0; i < 16; ++i )
+    {
+        renderer->channels[i].bend = 8192;
+        renderer->channels[i].volume = 100;
+        renderer->channels[i].expression = 127;
+        renderer->channels[i].pan = 64;
+    }
+    if ( renderer->event )
+    {
+        renderer->tick = renderer->event->time;
+        renderer->event_frame = render_get_frame ( renderer );
+    }
+    return BLASTMIDI_OK;
+}
+
+size_t blastmidi_render ( blastmidi_renderer* renderer, float* output, size_t frames )
+{
+    size_t rendered = 0;
+    while ( rendered < frames )
+    {
+        size_t count = frames - rendered;
+        unsigned int i = 0;
+        while ( renderer->event && renderer->event_frame <= renderer->position )
+        {
+            render_step ( renderer );
+        }
+
+        /*
+        * Once the track has ended, the notes that are still held are released, and rendering stops when they have faded.
+        */
+        if ( renderer->event == NULL )
+        {
+            uint8_t sounding = 0;
+            for ( i = 0; i < BLASTMIDI_RENDER_VOICES; ++i )
+            {
+                if ( renderer->states[i] != 0 && renderer->states[i] != 3 )
+                {
+                    render_release ( renderer, i );
+                }
+                sounding |= renderer->states[i];
+            }
+            if ( !sounding )
+            {
+                break;
+            }
+        }
+        if ( count > BLASTMIDI_RENDER_BLOCK )
+        {
+            count = BLASTMIDI_RENDER_BLOCK;
+        }
+        if ( renderer->event && renderer->event_frame - renderer->position < count )
+        {
+            count = ( size_t ) ( renderer->event_frame - renderer->position );
+        }
+        render_block ( renderer, output + rendered * renderer->channel_count, count );
+        renderer->position += count;
+        rendered += count;
+    }
+    return rendered;
+}
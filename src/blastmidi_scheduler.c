@@ -0,0 +1,279 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_scheduler.c
+* The implementation of the optional scheduler API.
+*
+* For the API reference, see blastmidi_scheduler.h.
+*/
+
+#include <string.h> /* For memset and memcpy */
+#include "blastmidi_scheduler.h"
+
+/*
+* Every level of the wheel indexes its slots with 8 bits of the time, so this must match BLASTMIDI_SCHEDULER_SLOTS.
+*/
+#define SCHEDULER_SLOT_BITS 8
+#define SCHEDULER_SLOT_MASK ( BLASTMIDI_SCHEDULER_SLOTS - 1 )
+
+/*
+* The time of the current event of a session since its start, in microseconds.
+*/
+static uint64_t session_get_time ( const blastmidi_scheduler_session* session )
+{
+    const blastmidi* instance = session->instance;
+    if ( instance->time_type == 1 )
+    {
+        if ( instance->SMPTE_frames == 0 || instance->ticks_per_frame == 0 )
+        {
+            return 0;
+        }
+
+        /*
+        * 29 stands for 29.97 drop frame, where a frame lasts 1001 / 30000 seconds.
+        */
+        if ( instance->SMPTE_frames == 29 )
+        {
+            return session->tick * 1001000000u / ( 30000u * instance->ticks_per_frame );
+        }
+        return session->tick * 1000000u / ( ( uint64_t ) instance->SMPTE_frames * instance->ticks_per_frame );
+    }
+    if ( instance->ticks_per_beat == 0 )
+    {
+        return 0;
+    }
+    return ( session->tempo_time + ( session->tick - session->tempo_tick ) * session->tempo ) / instance->ticks_per_beat;
+}
+
+/*
+* Moves a session past its current event, taking the tempo into account if the event sets it.
+*/
+static void session_step ( blastmidi_scheduler_session* session )
+{
+    const blastmidi_event* event = session->event;
+    if ( event->type == BLASTMIDI_META_EVENT && event->subtype == BLASTMIDI_META_SET_TEMPO && event->data_size >= sizeof ( uint32_t ) )
+    {
+        session->tempo_time += ( session->tick - session->tempo_tick ) * session->tempo;
+        session->tempo_tick = session->tick;
+        memcpy ( ( void* ) &session->tempo, ( void* ) event->data, sizeof ( uint32_t ) );
+    }
+    session->event = event->next;
+    if ( session->event )
+    {
+        session->tick += session->event->time;
+        session->due = session->start + session_get_time ( session );
+    }
+}
+
+static void session_link ( blastmidi_scheduler_session** slot, blastmidi_scheduler_session* session )
+{
+    session->slot = slot;
+    session->previous = NULL;
+    session->next = *slot;
+    if ( *slot )
+    {
+        ( *slot )->previous = session;
+    }
+    *slot = session;
+}
+
+static void session_unlink ( blastmidi_scheduler_session* session )
+{
+    if ( session->previous )
+    {
+        session->previous->next = session->next;
+    }
+    else
+    {
+        *session->slot = session->next;
+    }
+    if ( session->next )
+    {
+        session->next->previous = session->previous;
+    }
+    session->previous = NULL;
+    session->next = NULL;
+    session->slot = NULL;
+}
+
+static void scheduler_insert ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session )
+{
+
+    /*
+    * A session goes into the lowest level whose range reaches its due time, in the slot that the bits of the due time for that
+    * level select. The slot is moved down a level exactly when the wheel reaches the start of the span that the slot stands
+    * for, so the session is always back in the first level by the time it falls due. Sessions that are already late go into
+    * the slot that is dispatched next.
+    */
+    uint64_t unit = session->due / scheduler->resolution;
+    uint64_t delta = 0;
+    unsigned int level = 0;
+    if ( unit < scheduler->current )
+    {
+        unit = scheduler->current;
+    }
+    delta = unit - scheduler->current;
+    while ( level < BLASTMIDI_SCHEDULER_LEVELS - 1 && ( delta >> ( SCHEDULER_SLOT_BITS * ( level + 1 ) ) ) != 0 )
+    {
+        ++level;
+    }
+    if ( ( delta >> ( SCHEDULER_SLOT_BITS * BLASTMIDI_SCHEDULER_LEVELS ) ) != 0 )
+    {
+        unit = scheduler->current + ( ( ( uint64_t ) 1 << ( SCHEDULER_SLOT_BITS * BLASTMIDI_SCHEDULER_LEVELS ) ) - 1 );
+    }
+    session->level = ( uint8_t ) level;
+    scheduler->level_counts[level]++;
+    session_link ( &scheduler->wheel[level][ ( unit >> ( SCHEDULER_SLOT_BITS * level ) ) & SCHEDULER_SLOT_MASK], session );
+}
+
+static void scheduler_remove ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session )
+{
+    scheduler->level_counts[session->level]--;
+    session_unlink ( session );
+}
+
+static void scheduler_cascade ( blastmidi_scheduler* scheduler, unsigned int level )
+{
+    blastmidi_scheduler_session** slot = &scheduler->wheel[level][ ( scheduler->current >> ( SCHEDULER_SLOT_BITS * level ) ) & SCHEDULER_SLOT_MASK];
+    while ( *slot )
+    {
+        blastmidi_scheduler_session* session = *slot;
+        scheduler_remove ( scheduler, session );
+        scheduler_insert ( scheduler, session );
+    }
+}
+
+static size_t scheduler_run ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session, blastmidi_scheduler_callback* callback, void* user_data )
+{
+
+    /*
+    * Dispatches the events of a session that are due in the current slot. The callback may stop the session, or stop it and
+    * start it again, in which case it is linked into the wheel anew and must not be touched here any more.
+    */
+    size_t dispatched = 0;
+    while ( session->playing && session->slot == NULL && session->due / scheduler->resolution <= scheduler->current )
+    {
+        const blastmidi_event* event = session->event;
+        uint64_t due = session->due;
+        if ( event == NULL )
+        {
+            session->playing = 0;
+            scheduler->session_count--;
+            callback ( session, NULL, due, user_data );
+            return dispatched;
+        }
+        session_step ( session );
+        ++dispatched;
+        callback ( session, event, due, user_data );
+    }
+    if ( session->playing && session->slot == NULL )
+    {
+        scheduler_insert ( scheduler, session );
+    }
+    return dispatched;
+}
+
+void blastmidi_scheduler_initialize ( blastmidi_scheduler* scheduler, uint32_t resolution, uint64_t now )
+{
+    memset ( ( void* ) scheduler, 0, sizeof ( blastmidi_scheduler ) );
+    scheduler->resolution = resolution ? resolution : 1000;
+    scheduler->current = now / scheduler->resolution;
+}
+
+uint8_t blastmidi_scheduler_start ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session, blastmidi* instance, uint16_t track_id, uint64_t start, void* user_data )
+{
+    if ( scheduler == NULL || session == NULL || instance == NULL || track_id >= instance->track_count )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    memset ( ( void* ) session, 0, sizeof ( blastmidi_scheduler_session ) );
+    session->instance = instance;
+    session->event = instance->tracks[track_id];
+    session->user_data = user_data;
+    session->start = start;
+    session->tempo = 500000;
+    if ( session->event )
+    {
+        session->tick = session->event->time;
+    }
+    session->due = start + session_get_time ( session );
+    session->playing = 1;
+    scheduler->session_count++;
+    scheduler_insert ( scheduler, session );
+    return BLASTMIDI_OK;
+}
+
+void blastmidi_scheduler_stop ( blastmidi_scheduler* scheduler, blastmidi_scheduler_session* session )
+{
+    if ( session->slot )
+    {
+        scheduler_remove ( scheduler, session );
+    }
+    if ( session->playing )
+    {
+        session->playing = 0;
+        scheduler->session_count--;
+    }
+}
+
+size_t blastmidi_scheduler_advance ( blastmidi_scheduler* scheduler, uint64_t now, blastmidi_scheduler_callback* callback, void* user_data )
+{
+    uint64_t target = now / scheduler->resolution;
+    size_t dispatched = 0;
+    while ( scheduler->current <= target )
+    {
+        blastmidi_scheduler_session** slot = NULL;
+        unsigned int level = 1;
+        if ( scheduler->session_count == 0 )
+        {
+            scheduler->current = target + 1;
+            break;
+        }
+
+        /*
+        * Whenever the lower bits of the time wrap around, the next slot of the level above is spread over the levels below.
+        */
+        while ( level < BLASTMIDI_SCHEDULER_LEVELS && ( scheduler->current & ( ( ( uint64_t ) 1 << ( SCHEDULER_SLOT_BITS * level ) ) - 1 ) ) == 0 )
+        {
+            scheduler_cascade ( scheduler, level );
+            ++level;
+        }
+
+        /*
+        * Every session is taken out of the slot before it is dispatched, so the callback may stop any of the others that are
+        * still in it. Sessions that the callback starts for the present land in this slot, and are dispatched as well.
+        */
+        slot = &scheduler->wheel[0][scheduler->current & SCHEDULER_SLOT_MASK];
+        while ( *slot )
+        {
+            blastmidi_scheduler_session* session = *slot;
+            scheduler_remove ( scheduler, session );
+            dispatched += scheduler_run ( scheduler, session, callback, user_data );
+        }
+        scheduler->current++;
+
+        /*
+        * While the lowest levels are empty, nothing happens until the next slot of the lowest level that is not, so the wheel
+        * jumps straight there. This keeps long silences, and long pauses between calls, cheap.
+        */
+        level = 0;
+        while ( level < BLASTMIDI_SCHEDULER_LEVELS - 1 && scheduler->level_counts[level] == 0 )
+        {
+            ++level;
+        }
+        if ( level > 0 )
+        {
+            uint64_t mask = ( ( uint64_t ) 1 << ( SCHEDULER_SLOT_BITS * level ) ) - 1;
+            uint64_t next = ( scheduler->current + mask ) & ~mask;
+            scheduler->current = next < target + 1 ? next : target + 1;
+        }
+    }
+    return dispatched;
+}
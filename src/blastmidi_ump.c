@@ -0,0 +1,389 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_ump.c
+* The implementation of the optional Universal Midi Packet API.
+*
+* For the API reference, see blastmidi_ump.h.
+*/
+
+#include <string.h> /* For memcpy */
+#include "blastmidi_ump.h"
+
+/*
+* UMP message types, which occupy the top 4 bits of the first word of every packet.
+*/
+#define UMP_UTILITY 0x0
+#define UMP_MIDI1_CHANNEL_VOICE 0x2
+#define UMP_DATA_64 0x3
+#define UMP_MIDI2_CHANNEL_VOICE 0x4
+#define UMP_FLEX_DATA 0xD
+#define UMP_STREAM 0xF
+
+/*
+* The largest number of ticks that a single Delta Clockstamp message can hold.
+*/
+#define UMP_MAX_DELTA 0xFFFFF
+
+/*
+* Every word goes through this macro, which only stores it if it fits but always counts it.
+* This lets the same code both measure and convert.
+*/
+#define UMP_PUT(word) do { if ( position < capacity ) { words[position] = ( word ); } ++position; } while ( 0 )
+
+/*
+* blastmidi_ump_scale_up applied to every 7 bit value, since those are by far the most common.
+*/
+static const uint16_t ump_scale_7_to_16[128] =
+{
+    0x0000, 0x0200, 0x0400, 0x0600, 0x0800, 0x0A00, 0x0C00, 0x0E00,
+    0x1000, 0x1200, 0x1400, 0x1600, 0x1800, 0x1A00, 0x1C00, 0x1E00,
+    0x2000, 0x2200, 0x2400, 0x2600, 0x2800, 0x2A00, 0x2C00, 0x2E00,
+    0x3000, 0x3200, 0x3400, 0x3600, 0x3800, 0x3A00, 0x3C00, 0x3E00,
+    0x4000, 0x4200, 0x4400, 0x4600, 0x4800, 0x4A00, 0x4C00, 0x4E00,
+    0x5000, 0x5200, 0x5400, 0x5600, 0x5800, 0x5A00, 0x5C00, 0x5E00,
+    0x6000, 0x6200, 0x6400, 0x6600, 0x6800, 0x6A00, 0x6C00, 0x6E00,
+    0x7000, 0x7200, 0x7400, 0x7600, 0x7800, 0x7A00, 0x7C00, 0x7E00,
+    0x8000, 0x8208, 0x8410, 0x8618, 0x8820, 0x8A28, 0x8C30, 0x8E38,
+    0x9041, 0x9249, 0x9451, 0x9659, 0x9861, 0x9A69, 0x9C71, 0x9E79,
+    0xA082, 0xA28A, 0xA492, 0xA69A, 0xA8A2, 0xAAAA, 0xACB2, 0xAEBA,
+    0xB0C3, 0xB2CB, 0xB4D3, 0xB6DB, 0xB8E3, 0xBAEB, 0xBCF3, 0xBEFB,
+    0xC104, 0xC30C, 0xC514, 0xC71C, 0xC924, 0xCB2C, 0xCD34, 0xCF3C,
+    0xD145, 0xD34D, 0xD555, 0xD75D, 0xD965, 0xDB6D, 0xDD75, 0xDF7D,
+    0xE186, 0xE38E, 0xE596, 0xE79E, 0xE9A6, 0xEBAE, 0xEDB6, 0xEFBE,
+    0xF1C7, 0xF3CF, 0xF5D7, 0xF7DF, 0xF9E7, 0xFBEF, 0xFDF7, 0xFFFF
+};
+
+static const uint32_t ump_scale_7_to_32[128] =
+{
+    0x00000000, 0x02000000, 0x04000000, 0x06000000, 0x08000000, 0x0A000000, 0x0C000000, 0x0E000000,
+    0x10000000, 0x12000000, 0x14000000, 0x16000000, 0x18000000, 0x1A000000, 0x1C000000, 0x1E000000,
+    0x20000000, 0x22000000, 0x24000000, 0x26000000, 0x28000000, 0x2A000000, 0x2C000000, 0x2E000000,
+    0x30000000, 0x32000000, 0x34000000, 0x36000000, 0x38000000, 0x3A000000, 0x3C000000, 0x3E000000,
+    0x40000000, 0x42000000, 0x44000000, 0x46000000, 0x48000000, 0x4A000000, 0x4C000000, 0x4E000000,
+    0x50000000, 0x52000000, 0x54000000, 0x56000000, 0x58000000, 0x5A000000, 0x5C000000, 0x5E000000,
+    0x60000000, 0x62000000, 0x64000000, 0x66000000, 0x68000000, 0x6A000000, 0x6C000000, 0x6E000000,
+    0x70000000, 0x72000000, 0x74000000, 0x76000000, 0x78000000, 0x7A000000, 0x7C000000, 0x7E000000,
+    0x80000000, 0x82082082, 0x84104104, 0x86186186, 0x88208208, 0x8A28A28A, 0x8C30C30C, 0x8E38E38E,
+    0x90410410, 0x92492492, 0x94514514, 0x96596596, 0x98618618, 0x9A69A69A, 0x9C71C71C, 0x9E79E79E,
+    0xA0820820, 0xA28A28A2, 0xA4924924, 0xA69A69A6, 0xA8A28A28, 0xAAAAAAAA, 0xACB2CB2C, 0xAEBAEBAE,
+    0xB0C30C30, 0xB2CB2CB2, 0xB4D34D34, 0xB6DB6DB6, 0xB8E38E38, 0xBAEBAEBA, 0xBCF3CF3C, 0xBEFBEFBE,
+    0xC1041041, 0xC30C30C3, 0xC5145145, 0xC71C71C7, 0xC9249249, 0xCB2CB2CB, 0xCD34D34D, 0xCF3CF3CF,
+    0xD1451451, 0xD34D34D3, 0xD5555555, 0xD75D75D7, 0xD9659659, 0xDB6DB6DB, 0xDD75D75D, 0xDF7DF7DF,
+    0xE1861861, 0xE38E38E3, 0xE5965965, 0xE79E79E7, 0xE9A69A69, 0xEBAEBAEB, 0xEDB6DB6D, 0xEFBEFBEF,
+    0xF1C71C71, 0xF3CF3CF3, 0xF5D75D75, 0xF7DF7DF7, 0xF9E79E79, 0xFBEFBEFB, 0xFDF7DF7D, 0xFFFFFFFF
+};
+
+uint32_t blastmidi_ump_scale_up ( uint32_t value, uint8_t source_bits, uint8_t destination_bits )
+{
+    uint8_t scale_bits = ( uint8_t ) ( destination_bits - source_bits );
+    uint32_t shifted = value << scale_bits;
+    uint32_t center = ( uint32_t ) 1 << ( source_bits - 1 );
+    uint8_t repeat_bits = 0;
+    uint32_t repeat = 0;
+
+    /*
+    * Values up to the center are simply shifted. Values above it have their low bits repeated into the new bits,
+    * so that the maximum maps to the maximum.
+    */
+    if ( value <= center )
+    {
+        return shifted;
+    }
+    repeat_bits = ( uint8_t ) ( source_bits - 1 );
+    repeat = value & ( ( ( uint32_t ) 1 << repeat_bits ) - 1 );
+    if ( scale_bits > repeat_bits )
+    {
+        repeat <<= scale_bits - repeat_bits;
+    }
+    else
+    {
+        repeat >>= repeat_bits - scale_bits;
+    }
+    while ( repeat != 0 )
+    {
+        shifted |= repeat;
+        repeat >>= repeat_bits;
+    }
+    return shifted;
+}
+
+static void put_delta_clockstamps ( uint32_t* words, size_t capacity, size_t* position_ptr, uint32_t ticks )
+{
+    size_t position = *position_ptr;
+
+    /*
+    * Long pauses take several messages, since each one holds 20 bits.
+    */
+    while ( ticks > 0 )
+    {
+        uint32_t delta = ticks > UMP_MAX_DELTA ? UMP_MAX_DELTA : ticks;
+        UMP_PUT ( ( ( uint32_t ) UMP_UTILITY << 28 ) | 0x00400000 | delta );
+        ticks -= delta;
+    }
+    *position_ptr = position;
+}
+
+uint8_t blastmidi_ump_convert_track ( blastmidi* instance, uint16_t track_id, uint8_t group, uint32_t flags, uint32_t* words, size_t capacity, size_t* word_count )
+{
+    blastmidi_event* event = NULL;
+    size_t position = 0;
+    uint32_t pending = 0;
+    uint32_t group_bits = 0;
+    uint8_t timing = ( flags & BLASTMIDI_UMP_NO_TIMING ) == 0;
+    uint8_t in_sysex = 0;
+
+    if ( word_count )
+    {
+        *word_count = 0;
+    }
+    if ( instance == NULL || word_count == NULL || group > 15 || track_id >= instance->track_count || instance->tracks == NULL )
+    {
+        return BLASTMIDI_INVALIDPARAM;
+    }
+    if ( words == NULL )
+    {
+        capacity = 0;
+    }
+    group_bits = ( uint32_t ) group << 24;
+
+    if ( timing && instance->time_type == 0 )
+    {
+        UMP_PUT ( ( ( uint32_t ) UMP_UTILITY << 28 ) | 0x00300000 | instance->ticks_per_beat );
+    }
+    if ( flags & BLASTMIDI_UMP_CLIP )
+    {
+        UMP_PUT ( ( ( uint32_t ) UMP_STREAM << 28 ) | 0x00200000 );
+        UMP_PUT ( 0 );
+        UMP_PUT ( 0 );
+        UMP_PUT ( 0 );
+    }
+
+    for ( event = instance->tracks[track_id]; event; event = event->next )
+    {
+        uint32_t first = 0;
+        uint32_t second = 0;
+        uint8_t size = 0;
+        pending += event->time;
+
+        /*
+        * First decide on the packet, so that events without one do not consume their delta time.
+        */
+        if ( event->type == BLASTMIDI_CHANNEL_EVENT )
+        {
+            uint32_t channel = ( uint32_t ) ( event->channel & 15 );
+            uint32_t status = event->subtype;
+            uint32_t data_1 = event->data_size > 0 ? event->data[0] & 127 : 0;
+            uint32_t data_2 = event->data_size > 1 ? event->data[1] & 127 : 0;
+            if ( status == BLASTMIDI_CHANNEL_PITCH_BEND )
+            {
+                uint16_t bend = 8192;
+                if ( event->data_size >= sizeof ( uint16_t ) )
+                {
+                    memcpy ( ( void* ) &bend, ( void* ) event->data, sizeof ( uint16_t ) );
+                }
+                data_1 = bend & 127;
+                data_2 = ( bend >> 7 ) & 127;
+            }
+            if ( flags & BLASTMIDI_UMP_MIDI1 )
+            {
+                first = ( ( uint32_t ) UMP_MIDI1_CHANNEL_VOICE << 28 ) | group_bits | ( status << 20 ) | ( channel << 16 ) | ( data_1 << 8 );
+                if ( status != BLASTMIDI_CHANNEL_PROGRAM_CHANGE && status != BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH )
+                {
+                    first |= data_2;
+                }
+                size = 1;
+            }
+            else
+            {
+                first = ( ( uint32_t ) UMP_MIDI2_CHANNEL_VOICE << 28 ) | group_bits | ( channel << 16 );
+                switch ( status )
+                {
+                    case BLASTMIDI_CHANNEL_NOTE_ON:
+                        if ( data_2 == 0 )
+                        {
+                            first |= ( ( uint32_t ) BLASTMIDI_CHANNEL_NOTE_OFF << 20 ) | ( data_1 << 8 );
+                            second = 0x80000000;
+                            break;
+                        }
+                    /* Fall through */
+                    case BLASTMIDI_CHANNEL_NOTE_OFF:
+                        first |= ( status << 20 ) | ( data_1 << 8 );
+                        second = ( uint32_t ) ump_scale_7_to_16[data_2] << 16;
+                        break;
+                    case BLASTMIDI_CHANNEL_NOTE_AFTERTOUCH:
+                    case BLASTMIDI_CHANNEL_CONTROLLER:
+                        first |= ( status << 20 ) | ( data_1 << 8 );
+                        second = ump_scale_7_to_32[data_2];
+                        break;
+                    case BLASTMIDI_CHANNEL_PROGRAM_CHANGE:
+                        first |= status << 20;
+                        second = data_1 << 24;
+                        break;
+                    case BLASTMIDI_CHANNEL_CHANNEL_AFTERTOUCH:
+                        first |= status << 20;
+                        second = ump_scale_7_to_32[data_1];
+                        break;
+                    case BLASTMIDI_CHANNEL_PITCH_BEND:
+                    {
+
+                        /*
+                        * blastmidi_ump_scale_up from 14 to 32 bits, unrolled. Above the center, the low 13 bits are repeated twice.
+                        */
+                        uint32_t bend = ( data_2 << 7 ) | data_1;
+                        first |= status << 20;
+                        second = bend << 18;
+                        if ( bend > 8192 )
+                        {
+                            second |= ( ( bend & 0x1FFF ) << 5 ) | ( ( bend & 0x1FFF ) >> 8 );
+                        }
+                        break;
+                    }
+                    default:
+                        continue;
+                }
+                size = 2;
+            }
+        }
+        else if ( event->type == BLASTMIDI_META_EVENT )
+        {
+
+            /*
+            * Flex Data messages addressed to the whole group, complete in a single packet.
+            */
+            first = ( ( uint32_t ) UMP_FLEX_DATA << 28 ) | group_bits | 0x00100000;
+            if ( event->subtype == BLASTMIDI_META_SET_TEMPO && event->data_size >= sizeof ( uint32_t ) )
+            {
+                uint32_t tempo = 0;
+                memcpy ( ( void* ) &tempo, ( void* ) event->data, sizeof ( uint32_t ) );
+
+                /*
+                * The tempo is given in units of 10 nanoseconds per quarter note rather than microseconds.
+                */
+                second = tempo * 100;
+                size = 4;
+            }
+            else if ( event->subtype == BLASTMIDI_META_TIME_SIGNATURE && event->data_size >= 4 )
+            {
+                first |= 0x01;
+                second = ( ( uint32_t ) event->data[0] << 24 ) | ( ( uint32_t ) event->data[1] << 16 ) | ( ( uint32_t ) event->data[3] << 8 );
+                size = 4;
+            }
+            else
+            {
+                continue;
+            }
+        }
+        else if ( event->type == BLASTMIDI_SYSEX_EVENT && event->subtype != BLASTMIDI_SYSEX_ESCAPE )
+        {
+            size = 0;
+        }
+        else
+        {
+            continue;
+        }
+
+        /*
+        * The common case of a short packet with at most one clockstamp in front, and room to spare, skips the bounds checks.
+        */
+        if ( size > 0 && size < 4 && pending <= UMP_MAX_DELTA && capacity - position >= 3 && position < capacity )
+        {
+            uint32_t* output = words + position;
+            if ( timing && pending > 0 )
+            {
+                *output++ = ( ( uint32_t ) UMP_UTILITY << 28 ) | 0x00400000 | pending;
+            }
+            *output++ = first;
+            if ( size > 1 )
+            {
+                *output++ = second;
+            }
+            position = ( size_t ) ( output - words );
+            pending = 0;
+            continue;
+        }
+
+        if ( timing )
+        {
+            put_delta_clockstamps ( words, capacity, &position, pending );
+        }
+        pending = 0;
+
+        if ( size > 0 )
+        {
+            UMP_PUT ( first );
+            if ( size > 1 )
+            {
+                UMP_PUT ( second );
+            }
+            if ( size > 2 )
+            {
+                UMP_PUT ( 0 );
+                UMP_PUT ( 0 );
+            }
+            continue;
+        }
+
+        {
+
+            /*
+            * System exclusive data is split into packets of up to 6 bytes. The status of each packet says whether it starts,
+            * continues or ends the message, or holds all of it.
+            */
+            uint32_t remaining = event->data_size;
+            const uint8_t* data = event->data;
+            do
+            {
+                uint32_t count = remaining > 6 ? 6 : remaining;
+                uint8_t bytes[6];
+                uint32_t status = 0;
+                uint8_t last = remaining <= 6 && event->end_of_sysex;
+                memset ( ( void* ) bytes, 0, sizeof ( bytes ) );
+                if ( count > 0 )
+                {
+                    memcpy ( ( void* ) bytes, ( void* ) data, count );
+                }
+                if ( !in_sysex )
+                {
+                    status = last ? 0 : 1;
+                }
+                else
+                {
+                    status = last ? 3 : 2;
+                }
+                in_sysex = !last;
+                UMP_PUT ( ( ( uint32_t ) UMP_DATA_64 << 28 ) | group_bits | ( status << 20 ) | ( count << 16 ) | ( ( uint32_t ) ( bytes[0] & 127 ) << 8 ) | ( bytes[1] & 127 ) );
+                UMP_PUT ( ( ( uint32_t ) ( bytes[2] & 127 ) << 24 ) | ( ( uint32_t ) ( bytes[3] & 127 ) << 16 ) | ( ( uint32_t ) ( bytes[4] & 127 ) << 8 ) | ( bytes[5] & 127 ) );
+                data += count;
+                remaining -= count;
+            }
+            while ( remaining > 0 );
+        }
+    }
+
+    if ( flags & BLASTMIDI_UMP_CLIP )
+    {
+        if ( timing )
+        {
+            put_delta_clockstamps ( words, capacity, &position, pending );
+        }
+        UMP_PUT ( ( ( uint32_t ) UMP_STREAM << 28 ) | 0x00210000 );
+        UMP_PUT ( 0 );
+        UMP_PUT ( 0 );
+        UMP_PUT ( 0 );
+    }
+
+    *word_count = position;
+    if ( words && position > capacity )
+    {
+        return BLASTMIDI_BUFFERTOOSMALL;
+    }
+    return BLASTMIDI_OK;
+}
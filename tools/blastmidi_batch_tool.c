@@ -0,0 +1,165 @@
+/*
+*          BlastMidi
+*
+* A library of routines for working with Midi files.
+*
+*          Copyright Blastbay Studios (Philip Bennefall) 2014 - 2015.
+* Distributed under the Boost Software License, Version 1.0.
+*    (See accompanying file LICENSE_1_0.txt or copy at
+*          http://www.boost.org/LICENSE_1_0.txt)
+*
+*          blastmidi_batch_tool.c
+* A small command line tool which parses a list of Midi files with the batch API and reports the throughput.
+*
+* Usage: blastmidi_batch_tool [-j workers] [-v] file... (a file named - reads further paths from standard input, one per line)
+*
+* Build it together with blastmidi.c and blastmidi_batch.c, for example:
+* cc -O2 -Iinclude tools/blastmidi_batch_tool.c src/blastmidi.c src/blastmidi_batch.c -lpthread -o blastmidi_batch_tool
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blastmidi_batch.h"
+
+/*
+* Per worker counters, so that the handler never needs a lock.
+*/
+typedef struct tool_state
+{
+    size_t* events;
+    int verbose;
+} tool_state;
+
+int handle_file ( blastmidi* instance, const char* path, uint8_t result, unsigned int worker, void* user_data )
+{
+    tool_state* state = ( tool_state* ) user_data;
+    uint16_t i;
+    if ( result != BLASTMIDI_OK )
+    {
+        if ( state->verbose )
+        {
+            fprintf ( stderr, "%s: error %u\n", path, ( unsigned int ) result );
+        }
+        return 1;
+    }
+    for ( i = 0; i < instance->track_count; ++i )
+    {
+        blastmidi_event* event = NULL;
+        blastmidi_get_first_event_on_track ( instance, i, &event );
+        while ( event )
+        {
+            state->events[worker]++;
+            blastmidi_get_next_event_on_track ( instance, &event );
+        }
+    }
+    return 1;
+}
+
+int add_path ( char*** paths, size_t* count, size_t* capacity, const char* path )
+{
+    char* copy = NULL;
+    if ( *count == *capacity )
+    {
+        size_t new_capacity = *capacity ? *capacity * 2 : 1024;
+        char** new_paths = ( char** ) realloc ( *paths, sizeof ( char* ) * new_capacity );
+        if ( new_paths == NULL )
+        {
+            return 0;
+        }
+        *paths = new_paths;
+        *capacity = new_capacity;
+    }
+    copy = ( char* ) malloc ( strlen ( path ) + 1 );
+    if ( copy == NULL )
+    {
+        return 0;
+    }
+    strcpy ( copy, path );
+    ( *paths ) [ ( *count )++] = copy;
+    return 1;
+}
+
+int main ( int argc, char** argv )
+{
+    char** paths = NULL;
+    size_t path_count = 0;
+    size_t path_capacity = 0;
+    unsigned int workers = 0;
+    unsigned int worker_limit = 0;
+    tool_state state;
+    blastmidi_batch_stats stats;
+    size_t total_events = 0;
+    size_t i;
+    int a;
+
+    memset ( ( void* ) &state, 0, sizeof ( tool_state ) );
+    for ( a = 1; a < argc; ++a )
+    {
+        if ( strcmp ( argv[a], "-j" ) == 0 && a + 1 < argc )
+        {
+            workers = ( unsigned int ) atoi ( argv[++a] );
+        }
+        else if ( strcmp ( argv[a], "-v" ) == 0 )
+        {
+            state.verbose = 1;
+        }
+        else if ( strcmp ( argv[a], "-" ) == 0 )
+        {
+            char line[4096];
+            while ( fgets ( line, sizeof ( line ), stdin ) )
+            {
+                size_t length = strlen ( line );
+                while ( length > 0 && ( line[length - 1] == '\n' || line[length - 1] == '\r' ) )
+                {
+                    line[--length] = 0;
+                }
+                if ( length > 0 && !add_path ( &paths, &path_count, &path_capacity, line ) )
+                {
+                    fprintf ( stderr, "Out of memory.\n" );
+                    return 1;
+                }
+            }
+        }
+        else if ( !add_path ( &paths, &path_count, &path_capacity, argv[a] ) )
+        {
+            fprintf ( stderr, "Out of memory.\n" );
+            return 1;
+        }
+    }
+    if ( path_count == 0 )
+    {
+        fprintf ( stderr, "Usage: %s [-j workers] [-v] file... (use - to read paths from standard input)\n", argv[0] );
+        return 1;
+    }
+
+    worker_limit = workers ? workers : blastmidi_batch_get_cpu_count();
+    state.events = ( size_t* ) calloc ( worker_limit, sizeof ( size_t ) );
+    if ( state.events == NULL )
+    {
+        fprintf ( stderr, "Out of memory.\n" );
+        return 1;
+    }
+    if ( blastmidi_batch_read ( ( const char* const* ) paths, path_count, worker_limit, handle_file, &state, &stats ) != BLASTMIDI_OK )
+    {
+        fprintf ( stderr, "The batch could not be started.\n" );
+        return 1;
+    }
+    for ( i = 0; i < worker_limit; ++i )
+    {
+        total_events += state.events[i];
+    }
+    printf ( "Files: %lu (%lu failed)\n", ( unsigned long ) stats.files, ( unsigned long ) stats.failed );
+    printf ( "Bytes: %.0f\n", ( double ) stats.bytes );
+    printf ( "Events: %lu\n", ( unsigned long ) total_events );
+    printf ( "Time: %.3f s\n", stats.seconds );
+    printf ( "Throughput: %.1f files/s, %.2f MB/s\n", stats.files_per_second, stats.megabytes_per_second );
+
+    for ( i = 0; i < path_count; ++i )
+    {
+        free ( paths[i] );
+    }
+    free ( paths );
+    free ( state.events );
+    return 0;
+}